@@ -0,0 +1,344 @@
+#include "align.h"
+#include "fft.h"
+#include "guard.h"
+#include "sample.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* extra frames searched either side of the coarse offset per unit of
+ * decimation */
+#define FINE_MARGIN 4
+#define FINE_SLACK 64
+/* the coarse offset holds for the middle of the overlap, windows further
+ * out also search for clock drift up to this */
+#define MAX_DRIFT_PPM 200
+/* windows below this are left out of the drift fit */
+#define MIN_CONFIDENCE 0.3
+
+struct signal {
+  const struct riff_wave *wave;
+  enum sample_kind kind;
+  uint64_t frames;
+};
+
+static int
+signal_init(struct signal *self, const struct riff_wave *wave) {
+  self->wave = wave;
+  self->frames = riff_wave_frames(wave);
+  self->kind = sample_kind(&wave->fmt);
+  return self->kind == SAMPLE_UNSUPPORTED ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static double
+signal_mono(const struct signal *self, uint64_t frame) {
+  const uint32_t channels = self->wave->fmt.NumChannels;
+  const unsigned width = sample_bytes(self->kind);
+  const u8 *it =
+      self->wave->data.data + frame * self->wave->fmt.BlockAlign;
+  double sum = 0.0;
+  uint32_t c;
+
+  for (c = 0; c < channels; ++c) {
+    sum += sample_load(it + c * width, self->kind);
+  }
+  return sum / channels;
+}
+
+/* Mean rectified level per decimation frames, with its mean removed */
+static void
+signal_envelope(const struct signal *self, uint32_t decimation, float *out,
+                size_t length) {
+  double total = 0.0;
+  uint64_t frame = 0;
+  size_t i;
+
+  for (i = 0; i < length; ++i) {
+    double sum = 0.0;
+    uint32_t n;
+    for (n = 0; n < decimation && frame < self->frames; ++n, ++frame) {
+      sum += fabs(signal_mono(self, frame));
+    }
+    out[i] = (float)(n ? sum / n : 0.0);
+    total += (double)out[i];
+  }
+  total /= (double)length;
+  for (i = 0; i < length; ++i) {
+    out[i] -= (float)total;
+  }
+}
+
+/* Frames [first, first + length) with zeros outside the payload */
+static void
+signal_load(const struct signal *self, int64_t first, float *out,
+            size_t length) {
+  size_t i;
+  for (i = 0; i < length; ++i) {
+    int64_t frame = first + (int64_t)i;
+    out[i] = frame >= 0 && (uint64_t)frame < self->frames
+                 ? (float)signal_mono(self, (uint64_t)frame)
+                 : 0.0f;
+  }
+}
+
+static size_t
+pow2(size_t n) {
+  size_t p = 2;
+  while (p < n) {
+    p *= 2;
+  }
+  return p;
+}
+
+/* Cross-correlation c[k] = sum a[t] * b[t + k] in are, negative k wrapped
+ * to the end. ar/br hold the zero padded inputs, ai/bi are scratch. */
+static int
+correlate(size_t n, float *ar, float *ai, float *br, float *bi) {
+  struct fft fft;
+  size_t i;
+
+  if (fft_init(&fft, n) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  memset(ai, 0, n * sizeof(*ai));
+  memset(bi, 0, n * sizeof(*bi));
+  fft_forward(&fft, ar, ai);
+  fft_forward(&fft, br, bi);
+  for (i = 0; i < n; ++i) {
+    /* conj(A) * B */
+    float re = ar[i] * br[i] + ai[i] * bi[i];
+    float im = ar[i] * bi[i] - ai[i] * br[i];
+    ar[i] = re;
+    ai[i] = im;
+  }
+  fft_inverse(&fft, ar, ai);
+  fft_free(&fft);
+
+  return EXIT_SUCCESS;
+}
+
+struct buffers {
+  size_t n;
+  float *ar, *ai, *br, *bi;
+};
+
+static int
+buffers_alloc(struct buffers *self, size_t n) {
+  self->n = n;
+  self->ar = calloc(n, sizeof(float));
+  self->ai = calloc(n, sizeof(float));
+  self->br = calloc(n, sizeof(float));
+  self->bi = calloc(n, sizeof(float));
+  return self->ar && self->ai && self->br && self->bi ? EXIT_SUCCESS
+                                                      : EXIT_FAILURE;
+}
+
+static void
+buffers_free(struct buffers *self) {
+  free(self->ar);
+  free(self->ai);
+  free(self->br);
+  free(self->bi);
+}
+
+static int
+align_coarse(const struct signal *ref, const struct signal *other,
+             uint32_t decimation, int64_t *offset) {
+  const size_t la = (size_t)((ref->frames + decimation - 1) / decimation);
+  const size_t lb = (size_t)((other->frames + decimation - 1) / decimation);
+  struct buffers buf;
+  struct guard guard;
+  float best = -INFINITY;
+  size_t k;
+  int res = EXIT_FAILURE;
+
+  if (buffers_alloc(&buf, pow2(la + lb)) != EXIT_SUCCESS) {
+    goto Lfree;
+  }
+  guard_push(&guard);
+  if (sigsetjmp(guard.env, 1) != 0) {
+    guard_pop(&guard);
+    errno = EIO;
+    goto Lfree;
+  }
+  signal_envelope(ref, decimation, buf.ar, la);
+  signal_envelope(other, decimation, buf.br, lb);
+  guard_pop(&guard);
+  if (correlate(buf.n, buf.ar, buf.ai, buf.br, buf.bi) != EXIT_SUCCESS) {
+    goto Lfree;
+  }
+
+  /* lags with any overlap: [-(la - 1), lb - 1] */
+  *offset = 0;
+  for (k = 0; k < buf.n; ++k) {
+    if ((k < lb || k > buf.n - la) && buf.ar[k] > best) {
+      best = buf.ar[k];
+      *offset = k < lb ? (int64_t)k : (int64_t)k - (int64_t)buf.n;
+    }
+  }
+  *offset *= decimation;
+  res = EXIT_SUCCESS;
+
+Lfree:
+  buffers_free(&buf);
+  return res;
+}
+
+static int
+align_fine(const struct signal *ref, const struct signal *other,
+           uint64_t position, int64_t guess, uint32_t margin,
+           struct align_window *out) {
+  const size_t w = ALIGN_FINE;
+  const size_t lb = w + 2 * (size_t)margin;
+  const int64_t first = (int64_t)position + guess - margin;
+  struct buffers buf;
+  struct guard guard;
+  double *energy = NULL;
+  double ea = 0.0;
+  size_t i, k;
+  int res = EXIT_FAILURE;
+
+  out->position = position;
+  out->offset = guess;
+  out->confidence = 0.0;
+  if (buffers_alloc(&buf, pow2(w + lb)) != EXIT_SUCCESS ||
+      !(energy = calloc(lb + 1, sizeof(*energy)))) {
+    goto Lfree;
+  }
+  guard_push(&guard);
+  if (sigsetjmp(guard.env, 1) != 0) {
+    guard_pop(&guard);
+    errno = EIO;
+    goto Lfree;
+  }
+  signal_load(ref, (int64_t)position, buf.ar, w);
+  signal_load(other, first, buf.br, lb);
+  guard_pop(&guard);
+  for (i = 0; i < w; ++i) {
+    ea += (double)buf.ar[i] * (double)buf.ar[i];
+  }
+  for (i = 0; i < lb; ++i) {
+    energy[i + 1] = energy[i] + (double)buf.br[i] * (double)buf.br[i];
+  }
+  if (correlate(buf.n, buf.ar, buf.ai, buf.br, buf.bi) != EXIT_SUCCESS) {
+    goto Lfree;
+  }
+
+  for (k = 0; k <= 2 * (size_t)margin; ++k) {
+    double eb = energy[k + w] - energy[k];
+    double r;
+    if (ea <= 0.0 || eb <= 0.0) {
+      continue;
+    }
+    r = (double)buf.ar[k] / sqrt(ea * eb);
+    if (r > out->confidence) {
+      out->confidence = r;
+      out->offset = guess - margin + (int64_t)k;
+    }
+  }
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(energy);
+  buffers_free(&buf);
+  return res;
+}
+
+/* Least squares line through the confident windows */
+static void
+align_fit(struct align *self) {
+  double n = 0.0, sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0, conf = 0.0;
+  unsigned i;
+
+  for (i = 0; i < self->windows; ++i) {
+    const struct align_window *win = &self->window[i];
+    double x = (double)win->position;
+    double y = (double)win->offset;
+    if (win->confidence < MIN_CONFIDENCE) {
+      continue;
+    }
+    n += 1.0;
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+    conf += win->confidence;
+  }
+  if (n == 0.0) {
+    return;
+  }
+  self->confidence = conf / n;
+  if (n < 2.0 || n * sxx - sx * sx <= 0.0) {
+    self->offset = (int64_t)llround(sy / n);
+    return;
+  }
+  self->drift = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+  self->offset = (int64_t)llround((sy - self->drift * sx) / n);
+  self->drift *= 1e6;
+}
+
+int
+align_run(const struct riff_wave *ref, const struct riff_wave *other,
+          unsigned windows, struct align *out) {
+  struct signal a, b;
+  uint64_t longest, lo, hi, centre;
+  int64_t coarse;
+  unsigned i;
+
+  memset(out, 0, sizeof(*out));
+  if (signal_init(&a, ref) != EXIT_SUCCESS ||
+      signal_init(&b, other) != EXIT_SUCCESS ||
+      ref->fmt.SampleRate != other->fmt.SampleRate || windows == 0 ||
+      a.frames == 0 || b.frames == 0) {
+    return EXIT_FAILURE;
+  }
+  longest = a.frames > b.frames ? a.frames : b.frames;
+  out->decimation = (uint32_t)((longest + ALIGN_COARSE - 1) / ALIGN_COARSE);
+  if (align_coarse(&a, &b, out->decimation, &coarse) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  out->offset = coarse;
+
+  /* reference frames whose window lies within both files */
+  lo = coarse < 0 ? (uint64_t)-coarse : 0;
+  hi = (int64_t)b.frames - coarse < (int64_t)a.frames
+           ? (uint64_t)((int64_t)b.frames - coarse)
+           : a.frames;
+  if (hi < lo + ALIGN_FINE) {
+    /* too little overlap to refine */
+    return EXIT_SUCCESS;
+  }
+  hi -= ALIGN_FINE;
+
+  if (!(out->window = calloc(windows, sizeof(*out->window)))) {
+    return EXIT_FAILURE;
+  }
+  out->windows = windows;
+  centre = lo + (hi - lo) / 2;
+  for (i = 0; i < windows; ++i) {
+    /* centred in each of the equally sized stretches of the overlap */
+    uint64_t position =
+        lo + (2 * (uint64_t)i + 1) * (hi - lo) / (2 * windows);
+    uint64_t distance =
+        position > centre ? position - centre : centre - position;
+    uint32_t margin = FINE_MARGIN * out->decimation + FINE_SLACK +
+                      (uint32_t)(distance * MAX_DRIFT_PPM / 1000000);
+    if (align_fine(&a, &b, position, coarse, margin, &out->window[i]) !=
+        EXIT_SUCCESS) {
+      align_free(out);
+      return EXIT_FAILURE;
+    }
+  }
+  align_fit(out);
+
+  return EXIT_SUCCESS;
+}
+
+void
+align_free(struct align *self) {
+  free(self->window);
+  self->window = NULL;
+  self->windows = 0;
+}
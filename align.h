@@ -0,0 +1,52 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include "riff.h"
+
+/* Sample offset between two recordings of the same event, from the FFT
+ * cross-correlation of their mono mixes.
+ *
+ * The coarse pass correlates the whole of both files as rectified
+ * envelopes decimated to at most ALIGN_COARSE samples, which bounds the
+ * transform size regardless of the length of the recordings. The fine
+ * pass correlates ALIGN_FINE full rate samples around the coarse offset
+ * for each window, and a line fitted through the windows gives the clock
+ * drift between the recorders.
+ */
+
+#define ALIGN_COARSE (1 << 20)
+#define ALIGN_FINE 16384
+
+struct align_window {
+  /* first frame of the window in the reference */
+  uint64_t position;
+  /* frame in the other file matching position, minus position */
+  int64_t offset;
+  /* normalised correlation at the peak, 1.0 for identical content */
+  double confidence;
+};
+
+struct align {
+  /* frames the reference starts into the other file, negative when the
+   * other file starts into the reference */
+  int64_t offset;
+  double confidence;
+  /* frames averaged per coarse envelope sample */
+  uint32_t decimation;
+  /* change of the offset per reference frame, in parts per million */
+  double drift;
+  unsigned windows;
+  struct align_window *window;
+};
+
+/* Both files must have the same SampleRate. Drift needs two or more
+ * windows. Fails with errno EIO when a mapping raises SIGBUS, see
+ * guard.h. */
+int
+align_run(const struct riff_wave *ref, const struct riff_wave *other,
+          unsigned windows, struct align *out);
+
+void
+align_free(struct align *self);
+
+#endif
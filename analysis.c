@@ -0,0 +1,313 @@
+#include "analysis.h"
+#include "guard.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Float samples are measured as the 32-bit integer they would quantise to */
+#define FLOAT_SCALE 2147483648.0
+
+static int64_t
+load_word(const u8 *p, enum sample_kind kind, int *fractional) {
+  double scaled;
+  int64_t word;
+
+  if (kind != SAMPLE_F32 && kind != SAMPLE_F64) {
+    return sample_load_int(p, kind);
+  }
+  scaled = sample_load(p, kind) * FLOAT_SCALE;
+  if (!(scaled > -FLOAT_SCALE * 2 && scaled < FLOAT_SCALE * 2)) {
+    *fractional = 1;
+    return 0;
+  }
+  word = (int64_t)scaled;
+  if ((double)word != scaled) {
+    *fractional = 1;
+  }
+  return word;
+}
+
+/* The most negative word of an integer kind, 0 for floats */
+static int64_t
+word_min(enum sample_kind kind) {
+  switch (kind) {
+  case SAMPLE_U8:
+    return -128;
+  case SAMPLE_S16:
+    return INT16_MIN;
+  case SAMPLE_S24:
+    return -8388608;
+  case SAMPLE_S32:
+    return INT32_MIN;
+  default:
+    return 0;
+  }
+}
+
+/* An inverted lo word clips to the most positive one, -lo - 1 */
+static int
+inverse_words(int64_t a, int64_t b, int64_t lo) {
+  return a == -b || (a == lo && b == -lo - 1) || (b == lo && a == -lo - 1);
+}
+
+/* Integer kinds are compared by word, floats by value */
+static void
+analysis_pairs(struct analysis *self, const double *v, const int64_t *w,
+               int64_t lo) {
+  size_t p;
+
+  for (p = 0; p < self->pairs; ++p) {
+    struct analysis_pair *pair = &self->pair[p];
+    const double a = v[pair->a];
+    const double b = v[pair->b];
+
+    if (pair->identical &&
+        (lo ? w[pair->a] != w[pair->b] : a != b)) {
+      pair->identical = 0;
+    }
+    if (pair->inverted &&
+        (lo ? !inverse_words(w[pair->a], w[pair->b], lo) : a != -b)) {
+      pair->inverted = 0;
+    }
+    if (pair->correlate) {
+      pair->sum_ab += a * b;
+      pair->sum_aa += a * a;
+      pair->sum_bb += b * b;
+    }
+  }
+}
+
+int
+analysis_run(const struct riff_wave *wave, struct analysis *out) {
+  return analysis_run_segments(wave, NULL, 1, out);
+}
+
+int
+analysis_run_segments(const struct riff_wave *segments, struct input *in,
+                      size_t count, struct analysis *out) {
+  const struct riff_wave *wave = &segments[0];
+  const uint32_t channels = wave->fmt.NumChannels;
+  /* whole frames per window */
+  const size_t span = (size_t)BUDGET_WINDOW / wave->fmt.BlockAlign *
+                      wave->fmt.BlockAlign;
+  const u8 *it = NULL, *end = NULL, *until = NULL;
+  struct budget_window window;
+  int err = 0;
+  unsigned width;
+  uint64_t frame;
+  uint32_t c, d;
+  size_t live, s = 0;
+  struct guard guard;
+  int64_t lo;
+  int64_t *w;
+  double *v;
+
+  memset(out, 0, sizeof(*out));
+  if ((out->kind = sample_kind(&wave->fmt)) == SAMPLE_UNSUPPORTED) {
+    return EXIT_FAILURE;
+  }
+  width = sample_bytes(out->kind);
+  lo = word_min(out->kind);
+  out->channels = channels;
+  for (s = 0; s < count; ++s) {
+    out->frames += riff_wave_frames(&segments[s]);
+  }
+  out->pairs = (size_t)channels * (channels - 1) / 2;
+  out->channel = calloc(channels, sizeof(*out->channel));
+  out->pair = calloc(out->pairs + 1, sizeof(*out->pair));
+  v = calloc(channels, sizeof(*v));
+  w = calloc(channels, sizeof(*w));
+  if (!out->channel || !out->pair || !v || !w) {
+    free(w);
+    free(v);
+    analysis_free(out);
+    return EXIT_FAILURE;
+  }
+  for (c = 0; c < channels; ++c) {
+    out->channel[c].and_bits = UINT32_MAX;
+    out->channel[c].min = INT64_MAX;
+    out->channel[c].max = INT64_MIN;
+  }
+  for (c = 0, live = 0; c < channels; ++c) {
+    for (d = c + 1; d < channels; ++d, ++live) {
+      struct analysis_pair *pair = &out->pair[live];
+      pair->a = c;
+      pair->b = d;
+      pair->identical = 1;
+      pair->inverted = 1;
+      pair->correlate = channels <= ANALYSIS_CORRELATE_CHANNELS;
+    }
+  }
+
+  /* ending the zeroed window drops and releases nothing */
+  memset(&window, 0, sizeof(window));
+  guard_push(&guard);
+  if (sigsetjmp(guard.env, 1) != 0) {
+    err = EIO;
+    goto Lfail;
+  }
+  /* channel state is kept in separate accumulators per channel so the
+   * reductions have no dependency between lanes */
+  for (frame = 0, s = 0; frame < out->frames; ++frame) {
+    /* the payload continues in the next segment at a seam */
+    while (it == end) {
+      if (in) {
+        budget_window_end(&window);
+      }
+      it = segments[s].data.data;
+      end = it + riff_wave_frames(&segments[s]) * wave->fmt.BlockAlign;
+      if (in) {
+        budget_window_init(&window, in[s].raw, in[s].length, in[s].fd);
+        until = it;
+      }
+      ++s;
+    }
+    if (in && it == until) {
+      until = (size_t)(end - it) < span ? end : it + span;
+      if ((err = input_window_at(&in[s - 1], &window,
+                                 (size_t)(it - in[s - 1].raw),
+                                 (size_t)(until - it))) != 0) {
+        goto Lfail;
+      }
+    }
+    for (c = 0; c < channels; ++c) {
+      struct analysis_channel *ch = &out->channel[c];
+      int64_t word = load_word(it + c * width, out->kind, &ch->fractional);
+
+      ch->or_bits |= (uint32_t)word;
+      ch->and_bits &= (uint32_t)word;
+      if (word < ch->min) {
+        ch->min = word;
+      }
+      if (word > ch->max) {
+        ch->max = word;
+      }
+      v[c] = sample_load(it + c * width, out->kind);
+      w[c] = word;
+    }
+    if (out->pairs > 0) {
+      analysis_pairs(out, v, w, lo);
+      /* once every pair is disproven and not correlated the pair pass is
+       * skipped for the rest of the payload */
+      if (!out->pair[0].correlate && (frame & 0xFFF) == 0) {
+        size_t p;
+        for (p = 0, live = 0; p < out->pairs; ++p) {
+          live += out->pair[p].identical || out->pair[p].inverted;
+        }
+        if (live == 0) {
+          out->pairs = 0;
+        }
+      }
+    }
+    it += wave->fmt.BlockAlign;
+  }
+  if (in) {
+    budget_window_end(&window);
+  }
+  guard_pop(&guard);
+  free(w);
+  free(v);
+
+  return EXIT_SUCCESS;
+
+Lfail:
+  if (in) {
+    budget_window_end(&window);
+  }
+  guard_pop(&guard);
+  free(w);
+  free(v);
+  analysis_free(out);
+  errno = err;
+  return EXIT_FAILURE;
+}
+
+void
+analysis_free(struct analysis *self) {
+  free(self->channel);
+  free(self->pair);
+  self->channel = NULL;
+  self->pair = NULL;
+}
+
+int
+analysis_silent(const struct analysis *self, uint32_t channel) {
+  const struct analysis_channel *ch = &self->channel[channel];
+  return self->frames > 0 && ch->min == 0 && ch->max == 0 && !ch->fractional;
+}
+
+double
+analysis_correlation(const struct analysis_pair *pair) {
+  if (!pair->correlate || pair->sum_aa <= 0.0 || pair->sum_bb <= 0.0) {
+    return 0.0;
+  }
+  return pair->sum_ab / sqrt(pair->sum_aa * pair->sum_bb);
+}
+
+uint32_t
+analysis_droppable(const struct analysis *self, int *droppable) {
+  uint32_t dropped = 0;
+  uint32_t c;
+  size_t p;
+
+  for (c = 0; c < self->channels; ++c) {
+    droppable[c] = analysis_silent(self, c);
+  }
+  /* pairs are ordered by their lower channel, so the kept channel of a
+   * pair has already been decided */
+  for (p = 0; p < self->pairs; ++p) {
+    const struct analysis_pair *pair = &self->pair[p];
+    if ((pair->identical || pair->inverted) && !droppable[pair->a]) {
+      droppable[pair->b] = 1;
+    }
+  }
+  for (c = 0; c < self->channels; ++c) {
+    dropped += droppable[c] != 0;
+  }
+
+  return dropped;
+}
+
+unsigned
+analysis_container_bits(const struct analysis *self) {
+  if (self->kind == SAMPLE_F32 || self->kind == SAMPLE_F64) {
+    return 32;
+  }
+  return sample_bytes(self->kind) * 8;
+}
+
+unsigned
+analysis_effective_bits(const struct analysis *self, uint32_t channel) {
+  const struct analysis_channel *ch = &self->channel[channel];
+  const unsigned bits = analysis_container_bits(self);
+  uint32_t mask = bits >= 32 ? UINT32_MAX : ((uint32_t)1 << bits) - 1;
+  uint32_t varying = (ch->or_bits ^ ch->and_bits) & mask;
+
+  if (self->frames == 0 || varying == 0) {
+    return 0;
+  }
+  if (ch->fractional) {
+    /* finer than any integer format */
+    return bits + 1;
+  }
+  return bits - (unsigned)__builtin_ctz(varying);
+}
+
+double
+analysis_peak_dbfs(const struct analysis *self, uint32_t channel) {
+  const struct analysis_channel *ch = &self->channel[channel];
+  const unsigned bits = analysis_container_bits(self);
+  double full = ldexp(1.0, (int)bits - 1);
+  double peak;
+
+  if (self->frames == 0) {
+    return -INFINITY;
+  }
+  peak = (double)(-ch->min > ch->max ? -ch->min : ch->max);
+  if (peak <= 0.0) {
+    return -INFINITY;
+  }
+  return 20.0 * log10(peak / full);
+}
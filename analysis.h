@@ -0,0 +1,88 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "input.h"
+#include "riff.h"
+#include "sample.h"
+
+/* A single pass over the 'data' payload collecting per channel and per
+ * channel pair statistics for the storage reports. */
+
+/* Pairs beyond this many channels are only checked for exact equality */
+#define ANALYSIS_CORRELATE_CHANNELS 16
+/* Correlation reported as near identical */
+#define ANALYSIS_NEAR_IDENTICAL 0.999
+
+struct analysis_channel {
+  /* OR and AND of every sample word: bits that never vary are unused */
+  uint32_t or_bits;
+  uint32_t and_bits;
+  int64_t min;
+  int64_t max;
+  /* IEEE float samples that are not a multiple of 2^-31 */
+  int fractional;
+};
+
+struct analysis_pair {
+  uint32_t a;
+  uint32_t b;
+  /* cleared at the first frame that disproves them */
+  int identical;
+  int inverted;
+  int correlate;
+  double sum_ab;
+  double sum_aa;
+  double sum_bb;
+};
+
+struct analysis {
+  enum sample_kind kind;
+  uint32_t channels;
+  uint64_t frames;
+  struct analysis_channel *channel;
+  size_t pairs;
+  struct analysis_pair *pair;
+};
+
+int
+analysis_run(const struct riff_wave *wave, struct analysis *out);
+
+/* A single pass over the payloads of the segments of one stream in order,
+ * see concat.h. The segments share the 'fmt ' of the first. With the
+ * inputs they were parsed from, one per segment, the pass walks them with
+ * input_window_at(). Fails with errno EIO when a mapping raises SIGBUS,
+ * see guard.h, or with the errno of a failed read. */
+int
+analysis_run_segments(const struct riff_wave *segments, struct input *in,
+                      size_t count, struct analysis *out);
+
+void
+analysis_free(struct analysis *self);
+
+/* Bits of the sample word in use, float is measured as 32-bit integer */
+unsigned
+analysis_container_bits(const struct analysis *self);
+
+/* Container bits minus the low bits that are constant in every sample */
+unsigned
+analysis_effective_bits(const struct analysis *self, uint32_t channel);
+
+/* Every sample is digital silence */
+int
+analysis_silent(const struct analysis *self, uint32_t channel);
+
+/* Pearson correlation of the pair, 0.0 when not measured */
+double
+analysis_correlation(const struct analysis_pair *pair);
+
+/* Marks channels that can be dropped and rebuilt losslessly: silent ones
+ * and exact or polarity inverted copies of a lower kept channel. Returns
+ * the number of droppable channels. */
+uint32_t
+analysis_droppable(const struct analysis *self, int *droppable);
+
+/* Peak magnitude relative to full scale, in dBFS */
+double
+analysis_peak_dbfs(const struct analysis *self, uint32_t channel);
+
+#endif
@@ -0,0 +1,410 @@
+#include "arrow.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARROW_MAGIC "ARROW1"
+/* body buffers are aligned as recommended for SIMD access */
+#define ARROW_ALIGN 64
+
+/* Schema.fbs / Message.fbs / File.fbs */
+#define METADATA_V5 4
+#define HEADER_SCHEMA 1
+#define HEADER_RECORD_BATCH 3
+#define TYPE_INT 2
+#define TYPE_FLOATING_POINT 3
+#define TYPE_UTF8 5
+#define PRECISION_DOUBLE 2
+
+/* A flatbuffer laid out front to back: every offset points forward, to
+ * a child written after its parent. Positions are used instead of
+ * pointers as the buffer grows. Writes after an allocation failure are
+ * dropped and reported by error. */
+struct fb {
+  u8 *buf;
+  size_t length;
+  size_t capacity;
+  int error;
+};
+
+static size_t
+fb_alloc(struct fb *b, size_t size, size_t align) {
+  size_t pos = (b->length + align - 1) & ~(align - 1);
+
+  if (b->error) {
+    return 0;
+  }
+  if (pos + size > b->capacity) {
+    size_t capacity = b->capacity ? b->capacity : 1024;
+    u8 *buf;
+    while (capacity < pos + size) {
+      capacity *= 2;
+    }
+    if (!(buf = realloc(b->buf, capacity))) {
+      b->error = 1;
+      return 0;
+    }
+    b->buf = buf;
+    b->capacity = capacity;
+  }
+  memset(b->buf + b->length, 0, pos + size - b->length);
+  b->length = pos + size;
+  return pos;
+}
+
+static void
+fb_u8(struct fb *b, size_t pos, uint8_t v) {
+  if (!b->error) {
+    b->buf[pos] = v;
+  }
+}
+
+static void
+fb_u16(struct fb *b, size_t pos, uint16_t v) {
+  if (!b->error) {
+    wr_le16(b->buf + pos, v);
+  }
+}
+
+static void
+fb_u32(struct fb *b, size_t pos, uint32_t v) {
+  if (!b->error) {
+    wr_le32(b->buf + pos, v);
+  }
+}
+
+static void
+fb_u64(struct fb *b, size_t pos, uint64_t v) {
+  fb_u32(b, pos, (uint32_t)v);
+  fb_u32(b, pos + 4, (uint32_t)(v >> 32));
+}
+
+/* uoffset from the field to a later target */
+static void
+fb_ref(struct fb *b, size_t field, size_t target) {
+  fb_u32(b, field, (uint32_t)(target - field));
+}
+
+/* A table with the vtable in front of it. Fields are laid out in order,
+ * each aligned to its size, absent fields have size 0. */
+static size_t
+fb_table(struct fb *b, unsigned n, const unsigned *sizes, size_t *pos) {
+  const size_t vt = fb_alloc(b, 4 + 2 * (size_t)n, 2);
+  const size_t table = fb_alloc(b, 4, 4);
+  unsigned i;
+
+  for (i = 0; i < n; ++i) {
+    pos[i] = sizes[i] ? fb_alloc(b, sizes[i], sizes[i]) : 0;
+    fb_u16(b, vt + 4 + 2 * i, (uint16_t)(sizes[i] ? pos[i] - table : 0));
+  }
+  fb_u16(b, vt, (uint16_t)(4 + 2 * n));
+  fb_u16(b, vt + 2, (uint16_t)(b->length - table));
+  /* soffset from the table back to its vtable */
+  fb_u32(b, table, (uint32_t)(table - vt));
+  return table;
+}
+
+/* The length prefix is at the returned position, elements follow it
+ * aligned to align */
+static size_t
+fb_vector(struct fb *b, size_t count, size_t size, size_t align) {
+  size_t pos;
+
+  fb_alloc(b, 0, 4);
+  if (align > 4 && (b->length + 4) % align != 0) {
+    fb_alloc(b, 4, 4);
+  }
+  pos = fb_alloc(b, 4 + count * size, 4);
+  fb_u32(b, pos, (uint32_t)count);
+  return pos;
+}
+
+static size_t
+fb_string(struct fb *b, const char *s) {
+  const size_t length = strlen(s);
+  const size_t pos = fb_alloc(b, 4 + length + 1, 4);
+
+  fb_u32(b, pos, (uint32_t)length);
+  if (!b->error) {
+    memcpy(b->buf + pos + 4, s, length);
+  }
+  return pos;
+}
+
+static size_t
+fb_type(struct fb *b, enum arrow_type type, uint8_t *type_type) {
+  static const unsigned int_sizes[2] = {4, 1};
+  static const unsigned float_sizes[1] = {2};
+  size_t pos[2];
+  size_t table;
+
+  switch (type) {
+  case ARROW_UINT16:
+  case ARROW_UINT32:
+  case ARROW_UINT64:
+    *type_type = TYPE_INT;
+    table = fb_table(b, 2, int_sizes, pos);
+    fb_u32(b, pos[0],
+           type == ARROW_UINT16   ? 16
+           : type == ARROW_UINT32 ? 32
+                                  : 64);
+    /* is_signed stays false */
+    return table;
+  case ARROW_FLOAT64:
+    *type_type = TYPE_FLOATING_POINT;
+    table = fb_table(b, 1, float_sizes, pos);
+    fb_u16(b, pos[0], PRECISION_DOUBLE);
+    return table;
+  case ARROW_UTF8:
+    break;
+  }
+  *type_type = TYPE_UTF8;
+  return fb_table(b, 0, NULL, pos);
+}
+
+static size_t
+fb_schema(struct fb *b, const struct arrow_field *fields, unsigned n) {
+  /* endianness (little by default), fields */
+  static const unsigned schema_sizes[2] = {0, 4};
+  /* name, nullable, type_type, type, dictionary, children */
+  static const unsigned field_sizes[6] = {4, 1, 1, 4, 0, 4};
+  size_t spos[2], pos[6];
+  size_t schema, vec;
+  unsigned i;
+
+  schema = fb_table(b, 2, schema_sizes, spos);
+  vec = fb_vector(b, n, 4, 4);
+  fb_ref(b, spos[1], vec);
+  for (i = 0; i < n; ++i) {
+    size_t field = fb_table(b, 6, field_sizes, pos);
+    uint8_t type_type;
+
+    fb_ref(b, vec + 4 + 4 * (size_t)i, field);
+    fb_u8(b, pos[1], (uint8_t)(fields[i].nullable != 0));
+    fb_ref(b, pos[0], fb_string(b, fields[i].name));
+    fb_ref(b, pos[3], fb_type(b, fields[i].type, &type_type));
+    fb_u8(b, pos[2], type_type);
+    fb_ref(b, pos[5], fb_vector(b, 0, 4, 4));
+  }
+  return schema;
+}
+
+/* Root offset and Message table, returns the header field to point at
+ * the message header */
+static size_t
+fb_message(struct fb *b, uint8_t header_type, uint64_t body_length) {
+  /* version, header_type, header, bodyLength */
+  static const unsigned sizes[4] = {2, 1, 4, 8};
+  const size_t root = fb_alloc(b, 4, 4);
+  size_t pos[4];
+  size_t message = fb_table(b, 4, sizes, pos);
+
+  fb_ref(b, root, message);
+  fb_u16(b, pos[0], METADATA_V5);
+  fb_u8(b, pos[1], header_type);
+  fb_u64(b, pos[3], body_length);
+  return pos[2];
+}
+
+static void
+writer_put(struct arrow_writer *self, const void *buf, size_t length) {
+  if (length && fwrite(buf, 1, length, self->f) != length) {
+    self->error = 1;
+  }
+  self->offset += length;
+}
+
+static void
+writer_pad(struct arrow_writer *self, size_t align) {
+  static const u8 zero[ARROW_ALIGN];
+  writer_put(self, zero, (size_t)(-self->offset & (align - 1)));
+}
+
+/* Encapsulated message: continuation marker, metadata length, the
+ * flatbuffer padded so the body following it starts ARROW_ALIGN aligned
+ * in the file, body buffer offsets are relative to that start. Returns
+ * the bytes written. */
+static uint32_t
+writer_message(struct arrow_writer *self, const struct fb *b) {
+  const uint64_t end = (self->offset + 8 + b->length + ARROW_ALIGN - 1) &
+                       ~(uint64_t)(ARROW_ALIGN - 1);
+  const uint32_t padded = (uint32_t)(end - self->offset - 8);
+  u8 prefix[8];
+
+  wr_le32(prefix, 0xFFFFFFFF);
+  wr_le32(prefix + 4, padded);
+  writer_put(self, prefix, sizeof(prefix));
+  writer_put(self, b->buf, b->length);
+  writer_pad(self, ARROW_ALIGN);
+  return padded + 8;
+}
+
+int
+arrow_begin(struct arrow_writer *self, FILE *f,
+            const struct arrow_field *fields, unsigned nfields) {
+  static const u8 magic[8] = ARROW_MAGIC;
+  struct fb b = {NULL, 0, 0, 0};
+  size_t header;
+
+  memset(self, 0, sizeof(*self));
+  self->f = f;
+  self->fields = fields;
+  self->nfields = nfields;
+  writer_put(self, magic, sizeof(magic));
+
+  header = fb_message(&b, HEADER_SCHEMA, 0);
+  fb_ref(&b, header, fb_schema(&b, fields, nfields));
+  if (b.error) {
+    free(b.buf);
+    return EXIT_FAILURE;
+  }
+  writer_message(self, &b);
+  free(b.buf);
+
+  return self->error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static size_t
+type_width(enum arrow_type type) {
+  switch (type) {
+  case ARROW_UINT16:
+    return 2;
+  case ARROW_UINT32:
+    return 4;
+  case ARROW_UINT64:
+  case ARROW_FLOAT64:
+    return 8;
+  case ARROW_UTF8:
+    break;
+  }
+  return 4;
+}
+
+struct body_buffer {
+  const void *data;
+  uint64_t offset;
+  uint64_t length;
+};
+
+int
+arrow_write_batch(struct arrow_writer *self, uint64_t length,
+                  const struct arrow_column *columns) {
+  /* length, nodes, buffers */
+  static const unsigned sizes[3] = {8, 4, 4};
+  struct fb b = {NULL, 0, 0, 0};
+  struct body_buffer *buffers;
+  struct arrow_block *blocks;
+  size_t nbuffers = 0, pos[3], header, batch, nodes, vec, i;
+  uint64_t body = 0;
+  unsigned c;
+
+  if (!(buffers = calloc(3 * (size_t)self->nfields, sizeof(*buffers)))) {
+    return EXIT_FAILURE;
+  }
+  /* validity, then values or offsets and data */
+  for (c = 0; c < self->nfields; ++c) {
+    const struct arrow_column *col = &columns[c];
+    const enum arrow_type type = self->fields[c].type;
+
+    buffers[nbuffers].data = col->validity;
+    buffers[nbuffers].length =
+        col->validity && col->null_count ? (length + 7) / 8 : 0;
+    ++nbuffers;
+    if (type == ARROW_UTF8) {
+      buffers[nbuffers].data = col->offsets;
+      buffers[nbuffers].length = (length + 1) * 4;
+      ++nbuffers;
+      buffers[nbuffers].data = col->values;
+      buffers[nbuffers].length = (uint64_t)col->offsets[length];
+      ++nbuffers;
+    } else {
+      buffers[nbuffers].data = col->values;
+      buffers[nbuffers].length = length * type_width(type);
+      ++nbuffers;
+    }
+  }
+  for (i = 0; i < nbuffers; ++i) {
+    buffers[i].offset = body;
+    body = (body + buffers[i].length + ARROW_ALIGN - 1) &
+           ~(uint64_t)(ARROW_ALIGN - 1);
+  }
+
+  header = fb_message(&b, HEADER_RECORD_BATCH, body);
+  batch = fb_table(&b, 3, sizes, pos);
+  fb_ref(&b, header, batch);
+  fb_u64(&b, pos[0], length);
+  nodes = fb_vector(&b, self->nfields, 16, 8);
+  fb_ref(&b, pos[1], nodes);
+  for (c = 0; c < self->nfields; ++c) {
+    fb_u64(&b, nodes + 4 + 16 * (size_t)c, length);
+    fb_u64(&b, nodes + 12 + 16 * (size_t)c,
+           columns[c].validity ? columns[c].null_count : 0);
+  }
+  vec = fb_vector(&b, nbuffers, 16, 8);
+  fb_ref(&b, pos[2], vec);
+  for (i = 0; i < nbuffers; ++i) {
+    fb_u64(&b, vec + 4 + 16 * i, buffers[i].offset);
+    fb_u64(&b, vec + 12 + 16 * i, buffers[i].length);
+  }
+
+  blocks = realloc(self->blocks, (self->nblocks + 1) * sizeof(*blocks));
+  if (b.error || !blocks) {
+    free(b.buf);
+    free(buffers);
+    return EXIT_FAILURE;
+  }
+  self->blocks = blocks;
+  blocks[self->nblocks].offset = self->offset;
+  blocks[self->nblocks].metadata_length = writer_message(self, &b);
+  blocks[self->nblocks].body_length = body;
+  ++self->nblocks;
+  free(b.buf);
+
+  for (i = 0; i < nbuffers; ++i) {
+    writer_put(self, buffers[i].data, (size_t)buffers[i].length);
+    writer_pad(self, ARROW_ALIGN);
+  }
+  free(buffers);
+
+  return self->error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int
+arrow_end(struct arrow_writer *self) {
+  static const u8 eos[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0};
+  /* version, schema, dictionaries, recordBatches */
+  static const unsigned sizes[4] = {2, 4, 0, 4};
+  struct fb b = {NULL, 0, 0, 0};
+  size_t root, footer, vec, pos[4], i;
+  u8 trailer[4 + sizeof(ARROW_MAGIC) - 1];
+
+  writer_put(self, eos, sizeof(eos));
+
+  root = fb_alloc(&b, 4, 4);
+  footer = fb_table(&b, 4, sizes, pos);
+  fb_ref(&b, root, footer);
+  fb_u16(&b, pos[0], METADATA_V5);
+  fb_ref(&b, pos[1], fb_schema(&b, self->fields, self->nfields));
+  /* struct Block { offset: long; metaDataLength: int; bodyLength: long } */
+  vec = fb_vector(&b, self->nblocks, 24, 8);
+  fb_ref(&b, pos[3], vec);
+  for (i = 0; i < self->nblocks; ++i) {
+    fb_u64(&b, vec + 4 + 24 * i, self->blocks[i].offset);
+    fb_u32(&b, vec + 12 + 24 * i, self->blocks[i].metadata_length);
+    fb_u64(&b, vec + 20 + 24 * i, self->blocks[i].body_length);
+  }
+  if (b.error) {
+    free(b.buf);
+    return EXIT_FAILURE;
+  }
+  writer_put(self, b.buf, b.length);
+  wr_le32(trailer, (uint32_t)b.length);
+  memcpy(trailer + 4, ARROW_MAGIC, sizeof(ARROW_MAGIC) - 1);
+  writer_put(self, trailer, sizeof(trailer));
+
+  free(b.buf);
+  free(self->blocks);
+  self->blocks = NULL;
+  self->nblocks = 0;
+  return self->error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
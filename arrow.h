@@ -0,0 +1,76 @@
+#ifndef ARROW_H
+#define ARROW_H
+
+#include "riff.h"
+
+#include <stdio.h>
+
+/* Minimal writer of the Apache Arrow IPC file format (Arrow 1.0+,
+ * metadata V5), without the Arrow libraries.
+ *
+ *   "ARROW1\0\0"
+ *   Schema message
+ *   RecordBatch message, body ...
+ *   end of stream marker
+ *   Footer, int32 footer length, "ARROW1"
+ *
+ * Messages are flatbuffers built front to back by a small builder. Column
+ * buffers are 64 byte aligned in the body so readers can map them
+ * without copying.
+ */
+
+enum arrow_type {
+  ARROW_UTF8,
+  ARROW_UINT16,
+  ARROW_UINT32,
+  ARROW_UINT64,
+  ARROW_FLOAT64,
+};
+
+struct arrow_field {
+  const char *name;
+  enum arrow_type type;
+  int nullable;
+};
+
+/* One column of a record batch */
+struct arrow_column {
+  /* bit per row, LSB first, NULL when every row is valid */
+  const u8 *validity;
+  uint64_t null_count;
+  /* length values, or the UTF-8 bytes of a ARROW_UTF8 column */
+  const void *values;
+  /* ARROW_UTF8: length + 1 offsets into values */
+  const int32_t *offsets;
+};
+
+struct arrow_block {
+  uint64_t offset;
+  uint32_t metadata_length;
+  uint64_t body_length;
+};
+
+struct arrow_writer {
+  FILE *f;
+  uint64_t offset;
+  const struct arrow_field *fields;
+  unsigned nfields;
+  struct arrow_block *blocks;
+  size_t nblocks;
+  int error;
+};
+
+/* Writes the magic and the schema to f */
+int
+arrow_begin(struct arrow_writer *self, FILE *f,
+            const struct arrow_field *fields, unsigned nfields);
+
+int
+arrow_write_batch(struct arrow_writer *self, uint64_t length,
+                  const struct arrow_column *columns);
+
+/* Writes the footer, f stays open */
+int
+arrow_end(struct arrow_writer *self);
+
+#endif
@@ -0,0 +1,153 @@
+#include "budget.h"
+#include "cgroup.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t released;
+  uint64_t limit;
+  uint64_t held;
+} budget = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0};
+
+void
+budget_set(uint64_t bytes) {
+  pthread_mutex_lock(&budget.lock);
+  budget.limit = bytes;
+  pthread_cond_broadcast(&budget.released);
+  pthread_mutex_unlock(&budget.lock);
+}
+
+uint64_t
+budget_get(void) {
+  uint64_t limit;
+
+  pthread_mutex_lock(&budget.lock);
+  limit = budget.limit;
+  pthread_mutex_unlock(&budget.lock);
+  return limit;
+}
+
+static uint64_t
+memory_max(FILE *f) {
+  char value[32];
+
+  if (fscanf(f, "%31s", value) != 1 || strcmp(value, "max") == 0) {
+    return 0;
+  }
+  return strtoull(value, NULL, 10);
+}
+
+uint64_t
+budget_default(void) {
+  return cgroup_limit("memory.max", memory_max) / 2;
+}
+
+void
+budget_acquire(uint64_t bytes) {
+  pthread_mutex_lock(&budget.lock);
+  while (budget.limit && budget.held &&
+         budget.held + bytes > budget.limit) {
+    pthread_cond_wait(&budget.released, &budget.lock);
+  }
+  budget.held += bytes;
+  pthread_mutex_unlock(&budget.lock);
+}
+
+void
+budget_release(uint64_t bytes) {
+  if (bytes == 0) {
+    return;
+  }
+  pthread_mutex_lock(&budget.lock);
+  budget.held -= bytes;
+  pthread_cond_broadcast(&budget.released);
+  pthread_mutex_unlock(&budget.lock);
+}
+
+static uint64_t
+page_size(void) {
+  long size = sysconf(_SC_PAGESIZE);
+  return size > 0 ? (uint64_t)size : 4096;
+}
+
+void
+budget_drop(const u8 *raw, int fd, uint64_t offset, uint64_t length) {
+  const uint64_t page = page_size();
+  uint64_t begin, end;
+
+  begin = (offset + page - 1) / page * page;
+  end = (offset + length) / page * page;
+  if (begin >= end) {
+    return;
+  }
+  /* a shared read only mapping only loses its page table entries, the
+   * page cache is dropped separately */
+  madvise((void *)(uintptr_t)(raw + begin), (size_t)(end - begin),
+          MADV_DONTNEED);
+  posix_fadvise(fd, (off_t)begin, (off_t)(end - begin),
+                POSIX_FADV_DONTNEED);
+}
+
+void
+budget_window_init(struct budget_window *self, const u8 *raw, size_t length,
+                   int fd) {
+  self->raw = raw;
+  self->length = length;
+  self->fd = fd;
+  self->begin = 0;
+  self->end = 0;
+  self->extra = 0;
+}
+
+void
+budget_window_at(struct budget_window *self, size_t offset, size_t need) {
+  budget_window_with(self, offset, need, self->extra);
+}
+
+void
+budget_window_with(struct budget_window *self, size_t offset, size_t need,
+                   uint64_t extra) {
+  const size_t page = (size_t)page_size();
+  size_t end, first;
+
+  if (offset + need > self->length) {
+    need = self->length - offset;
+  }
+  if (offset >= self->begin && offset + need <= self->end &&
+      extra == self->extra) {
+    return;
+  }
+  /* release before waiting, a worker never holds while it waits */
+  if (offset > self->begin) {
+    budget_drop(self->raw, self->fd, self->begin,
+                (offset < self->end ? offset : self->end) - self->begin);
+  }
+  budget_release(self->end - self->begin + self->extra);
+
+  end = offset + BUDGET_WINDOW < self->length ? offset + BUDGET_WINDOW
+                                              : self->length;
+  if (end < offset + need) {
+    end = offset + need;
+  }
+  budget_acquire(end - offset + extra);
+  self->begin = offset;
+  self->end = end;
+  self->extra = extra;
+  first = offset / page * page;
+  madvise((void *)(uintptr_t)(self->raw + first), end - first,
+          MADV_WILLNEED);
+}
+
+void
+budget_window_end(struct budget_window *self) {
+  budget_drop(self->raw, self->fd, self->begin, self->end - self->begin);
+  budget_release(self->end - self->begin + self->extra);
+  self->begin = self->end = 0;
+  self->extra = 0;
+}
@@ -0,0 +1,74 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include "riff.h"
+
+/* Process wide memory budget shared by the workers. Transient memory,
+ * windows of mapped files and output and decode buffers, is charged
+ * before it is touched. A worker that does not fit waits for others to
+ * release instead of failing. A request larger than the whole budget
+ * proceeds once nothing else is held, so it cannot wait forever.
+ *
+ * Windows of mappings are dropped as soon as they are processed, with
+ * MADV_DONTNEED for the mapping and POSIX_FADV_DONTNEED for the page
+ * cache, which is charged to the cgroup of the process as well. */
+
+/* bytes of a file mapping charged and resident at a time */
+#define BUDGET_WINDOW (32 * 1024 * 1024)
+
+/* bytes, 0 for no limit, the default */
+void
+budget_set(uint64_t bytes);
+
+uint64_t
+budget_get(void);
+
+/* Half of the cgroup v2 memory.max of the process, 0 when unlimited */
+uint64_t
+budget_default(void);
+
+void
+budget_acquire(uint64_t bytes);
+
+void
+budget_release(uint64_t bytes);
+
+/* Drops the whole pages of [offset, offset + length) of a mapping of fd
+ * from the mapping and the page cache */
+void
+budget_drop(const u8 *raw, int fd, uint64_t offset, uint64_t length);
+
+/* Sequential access to a mapping of fd with at most BUDGET_WINDOW bytes
+ * charged and resident */
+struct budget_window {
+  const u8 *raw;
+  size_t length;
+  int fd;
+  /* charged [begin, end) */
+  size_t begin;
+  size_t end;
+  /* charged along with it, see budget_window_with() */
+  uint64_t extra;
+};
+
+void
+budget_window_init(struct budget_window *self, const u8 *raw, size_t length,
+                   int fd);
+
+/* Makes [offset, offset + need) part of the window, need is at most
+ * BUDGET_WINDOW. Everything before offset is dropped. */
+void
+budget_window_at(struct budget_window *self, size_t offset, size_t need);
+
+/* budget_window_at() also charging extra bytes until the next move, for
+ * buffers computed from the window. Both are acquired at once, as a
+ * caller holding one while waiting for the other could wait forever. */
+void
+budget_window_with(struct budget_window *self, size_t offset, size_t need,
+                   uint64_t extra);
+
+/* Drops and releases the remaining window */
+void
+budget_window_end(struct budget_window *self);
+
+#endif
@@ -0,0 +1,667 @@
+#include "catalog.h"
+#include "budget.h"
+#include "checkpoint.h"
+#include "guard.h"
+#include "hash.h"
+#include "input.h"
+#include "metrics.h"
+#include "pool.h"
+#include "sniff.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t
+align8(uint64_t v) {
+  return (v + 7) & ~(uint64_t)7;
+}
+
+static uint64_t
+meta_hash(const u8 *raw, size_t length) {
+  struct riff_iter iter;
+  struct riff_chunk chunk;
+  char form[4];
+  uint64_t h = 0;
+
+  if (riff_iter_init(&iter, raw, length, form) != EXIT_SUCCESS) {
+    return 0;
+  }
+  h = hash64(form, sizeof(form), 0);
+  while (riff_iter_next(&iter, &chunk) > 0) {
+    if (memcmp(chunk.id, "data", 4) != 0) {
+      h = hash64_combine(h, hash64(chunk.data - 8, (size_t)chunk.size + 8, 0));
+    }
+  }
+  return h;
+}
+
+void
+catalog_scan(struct catalog_record *record, const char *path) {
+  struct catalog_entry *entry = &record->entry;
+  struct input in;
+  struct sniff sniff;
+  struct riff_wave wave;
+  struct budget_window window;
+  struct guard guard;
+  uint64_t reference;
+  size_t count = 0, capacity = 0, offset = 0;
+  uint64_t start = metrics_now(), now;
+  int err;
+
+  memset(record, 0, sizeof(*record));
+  record->path = path;
+  err = input_open_scan(&in, path);
+  metric_add(METRIC_PHASE_OPEN, (now = metrics_now()) - start);
+  if (err != 0) {
+    entry->error = (uint16_t)err;
+    metric_add(METRIC_ERRORS_OPEN, 1);
+    return;
+  }
+  start = now;
+  budget_window_init(&window, in.raw, in.length, in.fd);
+  guard_push(&guard);
+  if (sigsetjmp(guard.env, 1) != 0) {
+    /* truncated while mapped or a failed read of the storage */
+    guard_pop(&guard);
+    budget_window_end(&window);
+    free(record->chunks);
+    record->chunks = NULL;
+    entry->chunks_count = 0;
+    entry->error = EIO;
+    metric_add(METRIC_ERRORS_BUS, 1);
+    input_close(&in);
+    return;
+  }
+
+  entry->file_size = in.length;
+  sniff_buf(in.raw, in.length < SNIFF_BYTES ? in.length : SNIFF_BYTES,
+            &sniff);
+  entry->container = (uint16_t)sniff.container;
+  memcpy(entry->form, sniff.form, sizeof(entry->form));
+
+  if (sniff_is_riff(&sniff) &&
+      riff_wave_parse(in.raw, in.length, &wave) == EXIT_SUCCESS) {
+    entry->AudioFormat = riff_fmt_code(&wave.fmt);
+    entry->NumChannels = wave.fmt.NumChannels;
+    entry->SampleRate = wave.fmt.SampleRate;
+    entry->BlockAlign = wave.fmt.BlockAlign;
+    entry->BitsPerSample = wave.fmt.BitsPerSample;
+    entry->data_offset = (uint64_t)(wave.data.data - in.raw);
+    entry->data_length = wave.data.size;
+    entry->meta_hash = meta_hash(in.raw, in.length);
+    if (wave.fmt.SampleRate &&
+        riff_wave_time_reference(&wave, &reference) == EXIT_SUCCESS) {
+      entry->flags |= CATALOG_TIMED;
+      /* a TimeReference may count from a midnight days ago */
+      entry->time_start =
+          timeline_ns(reference, wave.fmt.SampleRate) % TIMELINE_DAY;
+      entry->time_end =
+          entry->time_start +
+          timeline_ns(riff_wave_frames(&wave), wave.fmt.SampleRate);
+    }
+  } else {
+    entry->data_offset = 0;
+    entry->data_length = in.length;
+  }
+  metric_add(METRIC_PHASE_PARSE, (now = metrics_now()) - start);
+  start = now;
+
+  /* the payload is chunked window by window under the memory budget, a
+   * file read into memory was charged whole when opened */
+  while (offset < (size_t)entry->data_length) {
+    size_t until = offset + BUDGET_WINDOW - CDC_MAX;
+    if (until > (size_t)entry->data_length) {
+      until = (size_t)entry->data_length;
+    }
+    if ((err = input_window_at(&in, &window,
+                               (size_t)entry->data_offset + offset,
+                               until - offset)) != 0) {
+      entry->error = (uint16_t)err;
+      metric_add(METRIC_ERRORS_FILE, 1);
+      break;
+    }
+    if (cdc_chunks_next(in.raw + entry->data_offset,
+                        (size_t)entry->data_length, &offset, until,
+                        &record->chunks, &count,
+                        &capacity) != EXIT_SUCCESS) {
+      entry->error = ENOMEM;
+      metric_add(METRIC_ERRORS_MEMORY, 1);
+      break;
+    }
+  }
+  budget_window_end(&window);
+  guard_pop(&guard);
+  entry->chunks_count = count;
+  entry->payload_hash = cdc_payload_hash(record->chunks, count);
+  metric_add(METRIC_PHASE_CHUNK, metrics_now() - start);
+  metric_add(METRIC_FILES, 1);
+  metric_add(METRIC_BYTES, offset);
+
+  input_close(&in);
+}
+
+void
+catalog_record_free(struct catalog_record *record) {
+  free(record->chunks);
+  record->chunks = NULL;
+}
+
+static int
+record_cmp(const void *a, const void *b) {
+  const struct catalog_record *const *f = a;
+  const struct catalog_record *const *s = b;
+  return strcmp((*f)->path, (*s)->path);
+}
+
+int
+catalog_write(const char *path, struct catalog_record *records,
+              size_t length) {
+  struct catalog_header header;
+  struct catalog_record **sorted;
+  struct timeline_interval *intervals = NULL;
+  char *tmp = NULL;
+  FILE *f;
+  uint64_t chunk = 0;
+  uint64_t string = 0;
+  uint64_t timed = 0;
+  static const u8 zero[8];
+  size_t i;
+  int res = EXIT_FAILURE;
+
+  if (!(sorted = calloc(length ? length : 1, sizeof(*sorted)))) {
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < length; ++i) {
+    sorted[i] = &records[i];
+  }
+  qsort(sorted, length, sizeof(*sorted), record_cmp);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+  header.version = CATALOG_VERSION;
+  header.entry_size = sizeof(struct catalog_entry);
+  header.entries = length;
+  header.entries_offset = sizeof(header);
+  for (i = 0; i < length; ++i) {
+    struct catalog_entry *entry = &sorted[i]->entry;
+    entry->chunks_first = chunk;
+    entry->path_offset = string;
+    entry->path_length = (uint32_t)strlen(sorted[i]->path);
+    chunk += entry->chunks_count;
+    string += entry->path_length + 1;
+    timed += (entry->flags & CATALOG_TIMED) != 0;
+  }
+  header.chunks = chunk;
+  header.chunks_offset =
+      header.entries_offset + length * sizeof(struct catalog_entry);
+  header.intervals = timed;
+  header.intervals_offset =
+      header.chunks_offset + chunk * sizeof(struct cdc_chunk);
+  header.strings_offset = header.intervals_offset +
+                          timed * sizeof(struct timeline_interval);
+  header.strings_length = string;
+
+  if (!(intervals = calloc(timed ? timed : 1, sizeof(*intervals)))) {
+    goto Lfree;
+  }
+  for (i = 0, timed = 0; i < length; ++i) {
+    const struct catalog_entry *entry = &sorted[i]->entry;
+    if (entry->flags & CATALOG_TIMED) {
+      intervals[timed].start = entry->time_start;
+      intervals[timed].end = entry->time_end;
+      intervals[timed].entry = i;
+      ++timed;
+    }
+  }
+  timeline_build(intervals, timed);
+
+  if (!(tmp = malloc(strlen(path) + sizeof(".tmp")))) {
+    goto Lfree;
+  }
+  sprintf(tmp, "%s.tmp", path);
+  if (!(f = fopen(tmp, "wb"))) {
+    fprintf(stderr, "fopen(%s): %s\n", tmp, strerror(errno));
+    goto Lfree;
+  }
+
+  fwrite(&header, sizeof(header), 1, f);
+  for (i = 0; i < length; ++i) {
+    fwrite(&sorted[i]->entry, sizeof(struct catalog_entry), 1, f);
+  }
+  for (i = 0; i < length; ++i) {
+    fwrite(sorted[i]->chunks, sizeof(struct cdc_chunk),
+           (size_t)sorted[i]->entry.chunks_count, f);
+  }
+  fwrite(intervals, sizeof(*intervals), (size_t)timed, f);
+  for (i = 0; i < length; ++i) {
+    fwrite(sorted[i]->path, 1, (size_t)sorted[i]->entry.path_length + 1, f);
+  }
+  fwrite(zero, 1, (size_t)(align8(string) - string), f);
+
+  if (fflush(f) != 0 || ferror(f) || fsync(fileno(f)) < 0) {
+    fprintf(stderr, "write(%s): %s\n", tmp, strerror(errno));
+    fclose(f);
+    unlink(tmp);
+    goto Lfree;
+  }
+  fclose(f);
+  if (rename(tmp, path) < 0) {
+    fprintf(stderr, "rename(%s): %s\n", path, strerror(errno));
+    unlink(tmp);
+    goto Lfree;
+  }
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(tmp);
+  free(intervals);
+  free(sorted);
+  return res;
+}
+
+struct catalog_build {
+  char **files;
+  struct catalog_record *records;
+  /* set with release semantics once records[i] is complete */
+  u8 *done;
+  size_t *pending;
+  struct checkpoint checkpoint;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int finished;
+};
+
+static volatile sig_atomic_t catalog_stop;
+
+static void
+catalog_signal(int sig) {
+  (void)sig;
+  catalog_stop = 1;
+}
+
+static void
+catalog_build_file(void *closure, size_t index, unsigned worker) {
+  struct catalog_build *self = closure;
+  (void)worker;
+  /* once stopped the remaining indices drain without work */
+  if (catalog_stop) {
+    return;
+  }
+  index = self->pending[index];
+  catalog_scan(&self->records[index], self->files[index]);
+  __atomic_store_n(&self->done[index], 1, __ATOMIC_RELEASE);
+}
+
+/* Readahead of the files just ahead of the workers, on the pool's I/O
+ * helper thread */
+static void
+catalog_prefetch_file(void *closure, size_t index) {
+  struct catalog_build *self = closure;
+  int fd;
+
+  if (catalog_stop) {
+    return;
+  }
+  if ((fd = input_fd(self->files[self->pending[index]], O_RDONLY)) >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+}
+
+static void *
+catalog_checkpointer(void *arg) {
+  struct catalog_build *self = arg;
+  struct timespec deadline;
+
+  pthread_mutex_lock(&self->lock);
+  while (!self->finished) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += CATALOG_CHECKPOINT_INTERVAL;
+    while (!self->finished &&
+           pthread_cond_timedwait(&self->wake, &self->lock, &deadline) !=
+               ETIMEDOUT) {
+    }
+    if (!self->finished) {
+      pthread_mutex_unlock(&self->lock);
+      checkpoint_write(&self->checkpoint, self->records, self->done);
+      pthread_mutex_lock(&self->lock);
+    }
+  }
+  pthread_mutex_unlock(&self->lock);
+  return NULL;
+}
+
+int
+catalog_build(const char *path, char *files[], size_t length,
+              unsigned workers, int resume) {
+  struct catalog_build self;
+  struct sigaction sa, old_term, old_int;
+  pthread_t checkpointer;
+  size_t pending = 0;
+  size_t i;
+  int started;
+  int res = EXIT_FAILURE;
+
+  memset(&self, 0, sizeof(self));
+  self.files = files;
+  self.records = calloc(length ? length : 1, sizeof(*self.records));
+  self.done = calloc(length ? length : 1, sizeof(*self.done));
+  self.pending = calloc(length ? length : 1, sizeof(*self.pending));
+  if (!self.records || !self.done || !self.pending) {
+    goto Lfree;
+  }
+  if (checkpoint_open(&self.checkpoint, path, files, length, resume,
+                      self.records, self.done) != EXIT_SUCCESS) {
+    goto Lfree;
+  }
+  for (i = 0; i < length; ++i) {
+    if (!self.done[i]) {
+      self.pending[pending++] = i;
+    }
+  }
+
+  catalog_stop = 0;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = catalog_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, &old_term);
+  sigaction(SIGINT, &sa, &old_int);
+  pthread_mutex_init(&self.lock, NULL);
+  pthread_cond_init(&self.wake, NULL);
+  started = pthread_create(&checkpointer, NULL, catalog_checkpointer,
+                           &self) == 0;
+
+  res = pool_run_prefetch(workers, pending, catalog_build_file,
+                          catalog_prefetch_file, &self);
+
+  if (started) {
+    pthread_mutex_lock(&self.lock);
+    self.finished = 1;
+    pthread_cond_signal(&self.wake);
+    pthread_mutex_unlock(&self.lock);
+    pthread_join(checkpointer, NULL);
+  }
+  pthread_cond_destroy(&self.wake);
+  pthread_mutex_destroy(&self.lock);
+  sigaction(SIGTERM, &old_term, NULL);
+  sigaction(SIGINT, &old_int, NULL);
+
+  /* flushes the files in flight when stopped */
+  if (checkpoint_write(&self.checkpoint, self.records, self.done) !=
+      EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  if (catalog_stop) {
+    fprintf(stderr,
+            "ERROR: interrupted after %" PRIu64 " of %zu files, continue "
+            "with --resume\n",
+            self.checkpoint.header.completed, length);
+    res = EXIT_FAILURE;
+    goto Lfree;
+  }
+
+  for (i = 0; i < length; ++i) {
+    if (self.records[i].entry.error) {
+      fprintf(stderr, "%s: %s\n", files[i],
+              strerror(self.records[i].entry.error));
+    }
+  }
+  if (res == EXIT_SUCCESS &&
+      (res = catalog_write(path, self.records, length)) == EXIT_SUCCESS) {
+    checkpoint_remove(&self.checkpoint);
+  }
+
+Lfree:
+  checkpoint_close(&self.checkpoint);
+  if (self.records) {
+    for (i = 0; i < length; ++i) {
+      catalog_record_free(&self.records[i]);
+    }
+  }
+  free(self.pending);
+  free(self.done);
+  free(self.records);
+  return res;
+}
+
+/* [offset, offset + length) lies within size, without overflow */
+static int
+section_fits(uint64_t offset, uint64_t length, uint64_t size) {
+  return offset <= size && length <= size - offset;
+}
+
+int
+catalog_open(struct catalog *self, const char *path) {
+  const struct catalog_header *header;
+  struct stat st;
+  void *raw;
+  uint64_t i;
+  int fd;
+
+  memset(self, 0, sizeof(*self));
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    fprintf(stderr, "open(%s): %s\n", path, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+    fprintf(stderr, "ERROR: %s is not a catalog\n", path);
+    close(fd);
+    return EXIT_FAILURE;
+  }
+  raw = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (raw == MAP_FAILED) {
+    fprintf(stderr, "mmap(%s): %s\n", path, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  self->raw = raw;
+  self->length = (size_t)st.st_size;
+
+  header = raw;
+  if (memcmp(header->magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0 ||
+      header->version != CATALOG_VERSION ||
+      header->entry_size != sizeof(struct catalog_entry)) {
+    fprintf(stderr, "ERROR: %s is not a version %u catalog\n", path,
+            CATALOG_VERSION);
+    goto Lerr;
+  }
+  if (header->entries_offset % 8 || header->chunks_offset % 8 ||
+      header->intervals_offset % 8 ||
+      header->entries > self->length / sizeof(struct catalog_entry) ||
+      header->chunks > self->length / sizeof(struct cdc_chunk) ||
+      header->intervals > self->length / sizeof(struct timeline_interval) ||
+      !section_fits(header->entries_offset,
+                    header->entries * sizeof(struct catalog_entry),
+                    self->length) ||
+      !section_fits(header->chunks_offset,
+                    header->chunks * sizeof(struct cdc_chunk),
+                    self->length) ||
+      !section_fits(header->intervals_offset,
+                    header->intervals * sizeof(struct timeline_interval),
+                    self->length) ||
+      !section_fits(header->strings_offset, header->strings_length,
+                    self->length)) {
+    fprintf(stderr, "ERROR: %s is truncated\n", path);
+    goto Lerr;
+  }
+
+  self->header = header;
+  self->entries = (const void *)(self->raw + header->entries_offset);
+  self->chunks = (const void *)(self->raw + header->chunks_offset);
+  self->intervals = (const void *)(self->raw + header->intervals_offset);
+  self->strings = (const char *)(self->raw + header->strings_offset);
+
+  for (i = 0; i < header->entries; ++i) {
+    const struct catalog_entry *entry = &self->entries[i];
+    if (!section_fits(entry->path_offset, (uint64_t)entry->path_length + 1,
+                      header->strings_length) ||
+        self->strings[entry->path_offset + entry->path_length] != '\0' ||
+        !section_fits(entry->chunks_first, entry->chunks_count,
+                      header->chunks)) {
+      fprintf(stderr, "ERROR: %s entry %" PRIu64 " is corrupt\n", path, i);
+      goto Lerr;
+    }
+  }
+  for (i = 0; i < header->intervals; ++i) {
+    if (self->intervals[i].entry >= header->entries) {
+      fprintf(stderr, "ERROR: %s interval %" PRIu64 " is corrupt\n", path,
+              i);
+      goto Lerr;
+    }
+  }
+
+  return EXIT_SUCCESS;
+Lerr:
+  catalog_close(self);
+  return EXIT_FAILURE;
+}
+
+void
+catalog_close(struct catalog *self) {
+  if (self->raw) {
+    munmap((void *)(uintptr_t)self->raw, self->length);
+  }
+  memset(self, 0, sizeof(*self));
+}
+
+struct shared_slot {
+  uint64_t hash;
+  uint64_t first; /* entry index + 1, 0 marks an empty slot */
+  int multi;
+};
+
+int
+catalog_shared(const struct catalog *self, uint64_t *shared,
+               uint64_t *unique) {
+  const uint64_t entries = self->header->entries;
+  struct shared_slot *table;
+  size_t capacity = 16;
+  size_t mask;
+  uint64_t e, c;
+
+  while (capacity < self->header->chunks * 2) {
+    capacity *= 2;
+  }
+  mask = capacity - 1;
+  if (!(table = calloc(capacity, sizeof(*table)))) {
+    return EXIT_FAILURE;
+  }
+
+  /* open addressing on the chunk hash, remembering the first owner and
+   * whether any other entry also has the chunk */
+  *unique = 0;
+  for (e = 0; e < entries; ++e) {
+    const struct catalog_entry *entry = &self->entries[e];
+    for (c = 0; c < entry->chunks_count; ++c) {
+      const struct cdc_chunk *chunk = &self->chunks[entry->chunks_first + c];
+      size_t slot = (size_t)chunk->hash & mask;
+
+      while (table[slot].first && table[slot].hash != chunk->hash) {
+        slot = (slot + 1) & mask;
+      }
+      if (!table[slot].first) {
+        table[slot].hash = chunk->hash;
+        table[slot].first = e + 1;
+        *unique += chunk->length;
+      } else if (table[slot].first != e + 1) {
+        table[slot].multi = 1;
+      }
+    }
+  }
+
+  for (e = 0; e < entries; ++e) {
+    const struct catalog_entry *entry = &self->entries[e];
+    shared[e] = 0;
+    for (c = 0; c < entry->chunks_count; ++c) {
+      const struct cdc_chunk *chunk = &self->chunks[entry->chunks_first + c];
+      size_t slot = (size_t)chunk->hash & mask;
+
+      while (table[slot].hash != chunk->hash) {
+        slot = (slot + 1) & mask;
+      }
+      if (table[slot].multi) {
+        shared[e] += chunk->length;
+      }
+    }
+  }
+
+  free(table);
+  return EXIT_SUCCESS;
+}
+
+size_t
+catalog_timeline(const struct catalog *self, uint64_t from, uint64_t to,
+                 timeline_fn fn, void *closure) {
+  return timeline_overlap(self->intervals, (size_t)self->header->intervals,
+                          from, to, fn, closure);
+}
+
+static unsigned
+entry_changes(const struct catalog_entry *old,
+              const struct catalog_entry *new_) {
+  unsigned change = 0;
+
+  if (old->error != new_->error) {
+    change |= CATALOG_ERROR;
+  }
+  if (old->payload_hash != new_->payload_hash ||
+      old->data_length != new_->data_length) {
+    change |= CATALOG_PAYLOAD;
+  }
+  if (old->meta_hash != new_->meta_hash) {
+    change |= CATALOG_META;
+  }
+  return change;
+}
+
+static int
+entry_ordered(const struct catalog *self, uint64_t i) {
+  return i == 0 || strcmp(catalog_path(self, &self->entries[i - 1]),
+                          catalog_path(self, &self->entries[i])) < 0;
+}
+
+int
+catalog_diff(const struct catalog *old, const struct catalog *new_,
+             catalog_diff_fn fn, void *closure) {
+  const uint64_t no = old->header->entries;
+  const uint64_t nn = new_->header->entries;
+  uint64_t i = 0, j = 0;
+
+  while (i < no || j < nn) {
+    const struct catalog_entry *o = i < no ? &old->entries[i] : NULL;
+    const struct catalog_entry *n = j < nn ? &new_->entries[j] : NULL;
+    int cmp;
+
+    if ((o && !entry_ordered(old, i)) || (n && !entry_ordered(new_, j))) {
+      return EXIT_FAILURE;
+    }
+    cmp = !o ? 1 : !n ? -1
+                      : strcmp(catalog_path(old, o), catalog_path(new_, n));
+    if (cmp < 0) {
+      fn(closure, CATALOG_REMOVED, o, NULL);
+      ++i;
+    } else if (cmp > 0) {
+      fn(closure, CATALOG_ADDED, NULL, n);
+      ++j;
+    } else {
+      unsigned change = entry_changes(o, n);
+      if (change) {
+        fn(closure, change, o, n);
+      }
+      ++i;
+      ++j;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
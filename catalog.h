@@ -0,0 +1,150 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "cdc.h"
+#include "riff.h"
+#include "timeline.h"
+
+/* Binary catalog of scanned files, memory-mapped when read.
+ *
+ *   catalog_header
+ *   catalog_entry[entries]   sorted by path
+ *   cdc_chunk[chunks]        per entry content defined chunk lists
+ *   timeline_interval[intervals]  'bext' recording times, see timeline.h
+ *   strings                  NUL terminated paths
+ *
+ * Every section is 8 byte aligned and stored in the byte order of the
+ * host, catalogs are not portable between byte orders.
+ */
+
+#define CATALOG_MAGIC "RIFFCAT"
+#define CATALOG_VERSION 2
+
+/* seconds between checkpoints of catalog_build */
+#define CATALOG_CHECKPOINT_INTERVAL 30
+
+/* catalog_entry.flags */
+#define CATALOG_TIMED 0x1
+
+struct catalog_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint64_t entries;
+  uint64_t entries_offset;
+  uint64_t chunks;
+  uint64_t chunks_offset;
+  uint64_t intervals;
+  uint64_t intervals_offset;
+  uint64_t strings_offset;
+  uint64_t strings_length;
+};
+
+struct catalog_entry {
+  uint64_t path_offset;
+  uint32_t path_length;
+  uint16_t container; /* enum sniff_container */
+  uint16_t error;     /* errno when the file could not be scanned */
+  char form[4];
+  uint16_t AudioFormat; /* WAVE_FORMAT_EXTENSIBLE resolved */
+  uint16_t NumChannels;
+  uint32_t SampleRate;
+  uint16_t BlockAlign;
+  uint16_t BitsPerSample;
+  uint64_t file_size;
+  /* the 'data' chunk, or the whole file when it is not a WAVE */
+  uint64_t data_offset;
+  uint64_t data_length;
+  uint64_t payload_hash;
+  /* every chunk except 'data' */
+  uint64_t meta_hash;
+  uint64_t chunks_first;
+  uint64_t chunks_count;
+  uint32_t flags;
+  uint32_t reserved;
+  /* CATALOG_TIMED: the payload in nanoseconds since midnight */
+  uint64_t time_start;
+  uint64_t time_end;
+};
+
+struct catalog_record {
+  const char *path;
+  struct catalog_entry entry;
+  struct cdc_chunk *chunks;
+};
+
+struct catalog {
+  const u8 *raw;
+  size_t length;
+  const struct catalog_header *header;
+  const struct catalog_entry *entries;
+  const struct cdc_chunk *chunks;
+  const struct timeline_interval *intervals;
+  const char *strings;
+};
+
+/* Scans a single file into record, failures are recorded in entry.error */
+void
+catalog_scan(struct catalog_record *record, const char *path);
+
+void
+catalog_record_free(struct catalog_record *record);
+
+/* Writes the records sorted by path, atomically replacing path */
+int
+catalog_write(const char *path, struct catalog_record *records,
+              size_t length);
+
+/* Scans files with the worker pool and writes the catalog. Completed
+ * records are checkpointed every CATALOG_CHECKPOINT_INTERVAL seconds, see
+ * checkpoint.h, and resume skips the files of an earlier checkpoint.
+ * SIGTERM and SIGINT let the files in flight complete, checkpoint them
+ * and fail. */
+int
+catalog_build(const char *path, char *files[], size_t length,
+              unsigned workers, int resume);
+
+int
+catalog_open(struct catalog *self, const char *path);
+
+void
+catalog_close(struct catalog *self);
+
+static inline const char *
+catalog_path(const struct catalog *self, const struct catalog_entry *entry) {
+  return self->strings + entry->path_offset;
+}
+
+/* Per entry bytes of payload chunks also present in another entry, and
+ * the total bytes of distinct chunks across the catalog */
+int
+catalog_shared(const struct catalog *self, uint64_t *shared,
+               uint64_t *unique);
+
+enum catalog_change {
+  CATALOG_ADDED = 1,
+  CATALOG_REMOVED = 2,
+  /* modified, any combination of */
+  CATALOG_PAYLOAD = 4,
+  CATALOG_META = 8,
+  CATALOG_ERROR = 16,
+};
+
+/* old or new is NULL for added and removed entries */
+typedef void (*catalog_diff_fn)(void *closure, unsigned change,
+                                const struct catalog_entry *old,
+                                const struct catalog_entry *new_);
+
+/* Merges the path sorted entries of both catalogs in one pass, calling fn
+ * for every path added, removed or modified. Fails on a catalog whose
+ * entries are out of order. */
+int
+catalog_diff(const struct catalog *old, const struct catalog *new_,
+             catalog_diff_fn fn, void *closure);
+
+/* Calls fn for each timed entry recorded during [from, to) */
+size_t
+catalog_timeline(const struct catalog *self, uint64_t from, uint64_t to,
+                 timeline_fn fn, void *closure);
+
+#endif
@@ -0,0 +1,120 @@
+#include "cdc.h"
+#include "hash.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/* Normalisation level 2: a stricter mask before the average chunk size
+ * and a looser one after it. The gear hash shifts left, so the upper bits
+ * depend on the most recent 64 bytes and are the ones tested. */
+#define CDC_MASK_S ((((uint64_t)1 << 15) - 1) << (64 - 15))
+#define CDC_MASK_L ((((uint64_t)1 << 11) - 1) << (64 - 11))
+
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+static void
+gear_init(void) {
+  uint64_t state = 0x72696666ULL; /* "riff" */
+  size_t i;
+
+  /* splitmix64 */
+  for (i = 0; i < 256; ++i) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    gear[i] = z ^ (z >> 31);
+  }
+}
+
+size_t
+cdc_cut(const u8 *raw, size_t length) {
+  size_t normal = CDC_AVG;
+  size_t i;
+  uint64_t h = 0;
+
+  pthread_once(&gear_once, gear_init);
+  if (length <= CDC_MIN) {
+    return length;
+  }
+  if (length > CDC_MAX) {
+    length = CDC_MAX;
+  }
+  if (normal > length) {
+    normal = length;
+  }
+
+  /* cut points below CDC_MIN are never taken, skip hashing them */
+  for (i = CDC_MIN; i < normal; ++i) {
+    h = (h << 1) + gear[raw[i]];
+    if (!(h & CDC_MASK_S)) {
+      return i + 1;
+    }
+  }
+  for (; i < length; ++i) {
+    h = (h << 1) + gear[raw[i]];
+    if (!(h & CDC_MASK_L)) {
+      return i + 1;
+    }
+  }
+
+  return length;
+}
+
+int
+cdc_chunks_next(const u8 *raw, size_t length, size_t *offset, size_t until,
+                struct cdc_chunk **chunks, size_t *count, size_t *capacity) {
+  while (*offset < until) {
+    size_t cut = cdc_cut(raw + *offset, length - *offset);
+
+    if (*count == *capacity) {
+      size_t grown = *capacity ? *capacity * 2 : length / CDC_AVG + 16;
+      struct cdc_chunk *tmp;
+      if (!(tmp = realloc(*chunks, grown * sizeof(**chunks)))) {
+        return EXIT_FAILURE;
+      }
+      *chunks = tmp;
+      *capacity = grown;
+    }
+    (*chunks)[*count].hash = hash64(raw + *offset, cut, 0);
+    (*chunks)[*count].length = (uint32_t)cut;
+    (*chunks)[*count].reserved = 0;
+    ++*count;
+    *offset += cut;
+  }
+  return EXIT_SUCCESS;
+}
+
+int
+cdc_chunks(const u8 *raw, size_t length, struct cdc_chunk **out,
+           size_t *count) {
+  size_t capacity = length / CDC_AVG + 16;
+  size_t n = 0;
+  size_t offset = 0;
+  struct cdc_chunk *chunks;
+
+  if (!(chunks = malloc(capacity * sizeof(*chunks)))) {
+    return EXIT_FAILURE;
+  }
+  if (cdc_chunks_next(raw, length, &offset, length, &chunks, &n,
+                      &capacity) != EXIT_SUCCESS) {
+    free(chunks);
+    return EXIT_FAILURE;
+  }
+
+  *out = chunks;
+  *count = n;
+  return EXIT_SUCCESS;
+}
+
+uint64_t
+cdc_payload_hash(const struct cdc_chunk *chunks, size_t count) {
+  uint64_t h = hash64(NULL, 0, count);
+  size_t i;
+
+  for (i = 0; i < count; ++i) {
+    h = hash64_combine(h, chunks[i].hash);
+    h = hash64_combine(h, chunks[i].length);
+  }
+  return h;
+}
@@ -0,0 +1,43 @@
+#ifndef CDC_H
+#define CDC_H
+
+#include "riff.h"
+
+/* Content defined chunking of payloads with a gear rolling hash and the
+ * normalised cut points of FastCDC, so identical stretches of audio in
+ * different files produce identical chunks regardless of their offset.
+ * https://www.usenix.org/system/files/conference/atc16/atc16-paper-xia.pdf
+ */
+
+#define CDC_MIN (2 * 1024)
+#define CDC_AVG (8 * 1024)
+#define CDC_MAX (64 * 1024)
+
+struct cdc_chunk {
+  uint64_t hash;
+  uint32_t length;
+  uint32_t reserved;
+};
+
+/* Length of the chunk starting at raw */
+size_t
+cdc_cut(const u8 *raw, size_t length);
+
+/* Chunks the whole buffer, *out is malloc()ed */
+int
+cdc_chunks(const u8 *raw, size_t length, struct cdc_chunk **out,
+           size_t *count);
+
+/* Appends the chunks starting in [*offset, until) to *chunks, growing it
+ * with realloc(), *offset ends at the next cut. Chunks end at most
+ * CDC_MAX bytes past until, so a payload can be chunked window by window.
+ * On failure *chunks stays valid for free(). */
+int
+cdc_chunks_next(const u8 *raw, size_t length, size_t *offset, size_t until,
+                struct cdc_chunk **chunks, size_t *count, size_t *capacity);
+
+/* Hash identifying a payload by its chunk list */
+uint64_t
+cdc_payload_hash(const struct cdc_chunk *chunks, size_t count);
+
+#endif
@@ -0,0 +1,48 @@
+#include "cgroup.h"
+
+#include <limits.h>
+#include <string.h>
+
+uint64_t
+cgroup_limit(const char *file, cgroup_read_fn read) {
+  char line[PATH_MAX];
+  char path[PATH_MAX + 64];
+  char *dir = NULL;
+  uint64_t limit = 0;
+  FILE *f;
+
+  if (!(f = fopen("/proc/self/cgroup", "r"))) {
+    return 0;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, "0::/", 4) == 0) {
+      dir = line + 3;
+      dir[strcspn(dir, "\n")] = '\0';
+      break;
+    }
+  }
+  fclose(f);
+  if (!dir) {
+    return 0;
+  }
+
+  for (;;) {
+    char *slash;
+    uint64_t value;
+
+    snprintf(path, sizeof(path), "/sys/fs/cgroup%s/%s",
+             strcmp(dir, "/") == 0 ? "" : dir, file);
+    if ((f = fopen(path, "r"))) {
+      if ((value = read(f)) && (!limit || value < limit)) {
+        limit = value;
+      }
+      fclose(f);
+    }
+    if (strcmp(dir, "/") == 0) {
+      break;
+    }
+    slash = strrchr(dir, '/');
+    slash[slash == dir] = '\0';
+  }
+  return limit;
+}
@@ -0,0 +1,17 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Limits of the cgroup v2 of the process, e.g. "cpu.max" */
+
+/* Parses an open interface file, 0 for no limit */
+typedef uint64_t (*cgroup_read_fn)(FILE *f);
+
+/* The smallest limit read from file in the cgroup of the process and its
+ * ancestors up to the root of its namespace, 0 when unlimited */
+uint64_t
+cgroup_limit(const char *file, cgroup_read_fn read);
+
+#endif
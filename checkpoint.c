@@ -0,0 +1,278 @@
+#include "checkpoint.h"
+#include "hash.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char *
+suffixed(const char *path, const char *suffix) {
+  char *out = malloc(strlen(path) + strlen(suffix) + 1);
+  if (out) {
+    strcpy(out, path);
+    strcat(out, suffix);
+  }
+  return out;
+}
+
+static uint64_t
+list_hash(char *files[], size_t length) {
+  uint64_t h = hash64(&length, sizeof(length), 0);
+  size_t i;
+
+  for (i = 0; i < length; ++i) {
+    h = hash64_combine(h, hash64(files[i], strlen(files[i]), 0));
+  }
+  return h;
+}
+
+static int
+bit(const uint64_t *bitmap, size_t i) {
+  return (bitmap[i / 64] >> (i % 64)) & 1;
+}
+
+/* Reads back the journaled records covered by the checkpoint. Records
+ * with an error are requeued, it may have been transient, and journaled
+ * again once scanned. */
+static int
+load_journal(struct checkpoint *self, char *files[],
+             struct catalog_record *records, u8 *done) {
+  const struct checkpoint_header *header = &self->header;
+  uint64_t offset = 0;
+  uint64_t loaded = 0;
+  size_t i;
+
+  while (offset < header->journal_length) {
+    struct catalog_record *record;
+    struct catalog_entry entry;
+    uint64_t index;
+
+    if (fread(&index, sizeof(index), 1, self->journal) != 1 ||
+        fread(&entry, sizeof(entry), 1, self->journal) != 1 ||
+        index >= header->files || !bit(self->bitmap, (size_t)index) ||
+        done[index] ||
+        entry.chunks_count > (header->journal_length - offset) /
+                                 sizeof(struct cdc_chunk)) {
+      goto Lcorrupt;
+    }
+    record = &records[index];
+    record->path = files[index];
+    record->entry = entry;
+    record->chunks = malloc(
+        (size_t)(entry.chunks_count ? entry.chunks_count : 1) *
+        sizeof(struct cdc_chunk));
+    if (!record->chunks) {
+      return EXIT_FAILURE;
+    }
+    if (fread(record->chunks, sizeof(struct cdc_chunk),
+              (size_t)entry.chunks_count,
+              self->journal) != entry.chunks_count) {
+      goto Lcorrupt;
+    }
+    if (entry.error) {
+      catalog_record_free(record);
+    } else {
+      done[index] = 1;
+    }
+    ++loaded;
+    offset += sizeof(index) + sizeof(entry) +
+              entry.chunks_count * sizeof(struct cdc_chunk);
+  }
+  if (offset != header->journal_length || loaded != header->completed) {
+    goto Lcorrupt;
+  }
+  for (i = 0; i < header->files; ++i) {
+    if (!done[i]) {
+      self->bitmap[i / 64] &= ~((uint64_t)1 << (i % 64));
+    }
+  }
+  return EXIT_SUCCESS;
+
+Lcorrupt:
+  fprintf(stderr, "ERROR: %s does not match %s\n", self->journal_path,
+          self->path);
+  return EXIT_FAILURE;
+}
+
+static int
+resume_open(struct checkpoint *self, char *files[], size_t length,
+            struct catalog_record *records, u8 *done, int *found) {
+  struct checkpoint_header *header = &self->header;
+  const size_t words = (length + 63) / 64;
+  size_t i, completed;
+  FILE *f;
+
+  *found = 0;
+  if (!(f = fopen(self->path, "rb"))) {
+    if (errno != ENOENT) {
+      fprintf(stderr, "fopen(%s): %s\n", self->path, strerror(errno));
+      return EXIT_FAILURE;
+    }
+    fprintf(stderr, "%s: no checkpoint, starting over\n", self->path);
+    return EXIT_SUCCESS;
+  }
+  *found = 1;
+  if (fread(header, sizeof(*header), 1, f) != 1 ||
+      memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) !=
+          0 ||
+      header->version != CHECKPOINT_VERSION ||
+      header->entry_size != sizeof(struct catalog_entry) ||
+      fread(self->bitmap, sizeof(uint64_t), words, f) != words) {
+    fprintf(stderr, "ERROR: %s is not a version %u checkpoint\n", self->path,
+            CHECKPOINT_VERSION);
+    fclose(f);
+    return EXIT_FAILURE;
+  }
+  fclose(f);
+  if (header->files != length || header->list_hash != list_hash(files,
+                                                                 length)) {
+    fprintf(stderr, "ERROR: %s is for a different list of files\n",
+            self->path);
+    return EXIT_FAILURE;
+  }
+
+  if (!(self->journal = fopen(self->journal_path, "r+b"))) {
+    fprintf(stderr, "fopen(%s): %s\n", self->journal_path, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  /* drop a partial append past the checkpoint */
+  if (ftruncate(fileno(self->journal), (off_t)header->journal_length) < 0) {
+    fprintf(stderr, "ftruncate(%s): %s\n", self->journal_path,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (load_journal(self, files, records, done) != EXIT_SUCCESS ||
+      fseek(self->journal, 0, SEEK_END) != 0) {
+    return EXIT_FAILURE;
+  }
+  for (i = 0, completed = 0; i < length; ++i) {
+    completed += done[i];
+  }
+  fprintf(stderr, "%s: resuming, %zu of %zu files done\n", self->path,
+          completed, length);
+  return EXIT_SUCCESS;
+}
+
+int
+checkpoint_open(struct checkpoint *self, const char *path, char *files[],
+                size_t length, int resume, struct catalog_record *records,
+                u8 *done) {
+  int found = 0;
+
+  memset(self, 0, sizeof(*self));
+  self->path = suffixed(path, ".ckpt");
+  self->journal_path = suffixed(path, ".journal");
+  self->bitmap = calloc((length + 63) / 64 + 1, sizeof(uint64_t));
+  if (!self->path || !self->journal_path || !self->bitmap) {
+    return EXIT_FAILURE;
+  }
+
+  if (resume) {
+    if (resume_open(self, files, length, records, done, &found) !=
+        EXIT_SUCCESS) {
+      return EXIT_FAILURE;
+    }
+    if (found) {
+      return EXIT_SUCCESS;
+    }
+  }
+
+  /* the old checkpoint goes first, it describes the old journal */
+  if (unlink(self->path) < 0 && errno != ENOENT) {
+    fprintf(stderr, "unlink(%s): %s\n", self->path, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  memset(&self->header, 0, sizeof(self->header));
+  memset(self->bitmap, 0, ((length + 63) / 64 + 1) * sizeof(uint64_t));
+  memcpy(self->header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  self->header.version = CHECKPOINT_VERSION;
+  self->header.entry_size = sizeof(struct catalog_entry);
+  self->header.files = length;
+  self->header.list_hash = list_hash(files, length);
+  if (!(self->journal = fopen(self->journal_path, "w+b"))) {
+    fprintf(stderr, "fopen(%s): %s\n", self->journal_path, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int
+checkpoint_write(struct checkpoint *self,
+                 const struct catalog_record *records, const u8 *done) {
+  struct checkpoint_header *header = &self->header;
+  const size_t words = (size_t)(header->files + 63) / 64;
+  char *tmp;
+  FILE *f;
+  size_t i;
+  int res = EXIT_FAILURE;
+
+  for (i = 0; i < header->files; ++i) {
+    const struct catalog_record *record = &records[i];
+    uint64_t index = i;
+
+    if (bit(self->bitmap, i) ||
+        !__atomic_load_n(&done[i], __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+    fwrite(&index, sizeof(index), 1, self->journal);
+    fwrite(&record->entry, sizeof(record->entry), 1, self->journal);
+    fwrite(record->chunks, sizeof(struct cdc_chunk),
+           (size_t)record->entry.chunks_count, self->journal);
+    self->bitmap[i / 64] |= (uint64_t)1 << (i % 64);
+    ++header->completed;
+    header->journal_length += sizeof(index) + sizeof(record->entry) +
+                              record->entry.chunks_count *
+                                  sizeof(struct cdc_chunk);
+  }
+  if (fflush(self->journal) != 0 || ferror(self->journal) ||
+      fdatasync(fileno(self->journal)) < 0) {
+    fprintf(stderr, "write(%s): %s\n", self->journal_path, strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  if (!(tmp = suffixed(self->path, ".tmp"))) {
+    return EXIT_FAILURE;
+  }
+  if (!(f = fopen(tmp, "wb"))) {
+    fprintf(stderr, "fopen(%s): %s\n", tmp, strerror(errno));
+    goto Lfree;
+  }
+  fwrite(header, sizeof(*header), 1, f);
+  fwrite(self->bitmap, sizeof(uint64_t), words, f);
+  if (fflush(f) != 0 || ferror(f) || fsync(fileno(f)) < 0) {
+    fprintf(stderr, "write(%s): %s\n", tmp, strerror(errno));
+    fclose(f);
+    unlink(tmp);
+    goto Lfree;
+  }
+  fclose(f);
+  if (rename(tmp, self->path) < 0) {
+    fprintf(stderr, "rename(%s): %s\n", self->path, strerror(errno));
+    unlink(tmp);
+    goto Lfree;
+  }
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(tmp);
+  return res;
+}
+
+void
+checkpoint_remove(struct checkpoint *self) {
+  unlink(self->path);
+  unlink(self->journal_path);
+}
+
+void
+checkpoint_close(struct checkpoint *self) {
+  if (self->journal) {
+    fclose(self->journal);
+  }
+  free(self->bitmap);
+  free(self->journal_path);
+  free(self->path);
+  memset(self, 0, sizeof(*self));
+}
@@ -0,0 +1,71 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "catalog.h"
+
+#include <stdio.h>
+
+/* Progress of a catalog build, kept next to the catalog in two files.
+ *
+ * OUT.journal appends the records of completed inputs:
+ *
+ *   uint64_t index into the input list
+ *   catalog_entry
+ *   cdc_chunk[entry.chunks_count]
+ *
+ * OUT.ckpt is replaced atomically after the journal is synced and covers
+ * a prefix of it:
+ *
+ *   checkpoint_header
+ *   uint64_t[(files + 63) / 64]   bit per input, set once journaled
+ *
+ * Journal bytes past journal_length are from an interrupted append and
+ * are dropped on resume.
+ */
+
+#define CHECKPOINT_MAGIC "RIFFCKP"
+#define CHECKPOINT_VERSION 1
+
+struct checkpoint_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t entry_size;
+  uint64_t files;
+  /* of the input paths in order, a resume needs the same list */
+  uint64_t list_hash;
+  uint64_t completed;
+  uint64_t journal_length;
+};
+
+struct checkpoint {
+  char *path;
+  char *journal_path;
+  FILE *journal;
+  struct checkpoint_header header;
+  uint64_t *bitmap;
+};
+
+/* Starts a new checkpoint for the catalog at path or, with resume, loads
+ * the journaled records into records and marks them in done. Records
+ * with an error are left to be scanned again. A resume without a
+ * checkpoint starts over. */
+int
+checkpoint_open(struct checkpoint *self, const char *path, char *files[],
+                size_t length, int resume, struct catalog_record *records,
+                u8 *done);
+
+/* Journals the records marked done since the last call and replaces the
+ * checkpoint. done is read with acquire semantics, so workers may still
+ * be completing records. */
+int
+checkpoint_write(struct checkpoint *self,
+                 const struct catalog_record *records, const u8 *done);
+
+/* Removes both files once the catalog is written */
+void
+checkpoint_remove(struct checkpoint *self);
+
+void
+checkpoint_close(struct checkpoint *self);
+
+#endif
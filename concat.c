@@ -0,0 +1,232 @@
+#include "concat.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int
+same_fmt(const struct riff_fmt *a, const struct riff_fmt *b) {
+  return a->AudioFormat == b->AudioFormat &&
+         a->NumChannels == b->NumChannels &&
+         a->SampleRate == b->SampleRate && a->ByteRate == b->ByteRate &&
+         a->BlockAlign == b->BlockAlign &&
+         a->BitsPerSample == b->BitsPerSample &&
+         a->SubFormat == b->SubFormat && a->cbSize == b->cbSize &&
+         (a->cbSize == 0 || memcmp(a->extension, b->extension, a->cbSize) == 0);
+}
+
+static const char *
+base_name(const char *path) {
+  const char *slash = strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+/* The names are equal but for a run of digits counting up by one */
+static int
+consecutive_names(const char *a, const char *b) {
+  size_t i = 0, start;
+  char *end_a, *end_b;
+  unsigned long long na, nb;
+
+  a = base_name(a);
+  b = base_name(b);
+  while (a[i] && a[i] == b[i]) {
+    ++i;
+  }
+  /* back to the start of the counter, 0009 and 0010 share 00 */
+  for (start = i; start > 0 && isdigit((unsigned char)a[start - 1]);
+       --start) {
+  }
+  if (!isdigit((unsigned char)a[start]) || !isdigit((unsigned char)b[start])) {
+    return 0;
+  }
+  na = strtoull(a + start, &end_a, 10);
+  nb = strtoull(b + start, &end_b, 10);
+  return nb == na + 1 && strcmp(end_a, end_b) == 0;
+}
+
+static uint64_t
+segment_frames(const struct seek *seek, const struct riff_wave *wave) {
+  /* block based codecs hold several frames per BlockAlign */
+  return seek->codec != SEEK_UNSUPPORTED ? seek->frames
+                                         : riff_wave_frames(wave);
+}
+
+/* Opens the segment i, fails when it is not a WAVE file */
+static int
+segment_open(struct concat *self, size_t i) {
+  if (input_open(&self->in[i], self->path[i]) != 0) {
+    return EXIT_FAILURE;
+  }
+  if (riff_wave_parse(self->in[i].raw, self->in[i].length, &self->wave[i]) !=
+      EXIT_SUCCESS) {
+    input_close(&self->in[i]);
+    return EXIT_FAILURE;
+  }
+  if (seek_init(&self->seek[i], &self->wave[i]) != EXIT_SUCCESS) {
+    self->seek[i].codec = SEEK_UNSUPPORTED;
+  }
+  return EXIT_SUCCESS;
+}
+
+/* Largest step of a channel between consecutive frames of values */
+static double
+largest_step(const double *values, size_t frames, uint32_t channels,
+             size_t skip) {
+  double res = 0.0;
+  size_t i;
+  uint32_t c;
+
+  for (i = 1; i < frames; ++i) {
+    if (i == skip) {
+      continue;
+    }
+    for (c = 0; c < channels; ++c) {
+      double step = fabs(values[i * channels + c] -
+                         values[(i - 1) * channels + c]);
+      if (step > res) {
+        res = step;
+      }
+    }
+  }
+  return res;
+}
+
+/* Decodes the frames either side of the seam before segment i */
+static void
+seam_steps(const struct concat *self, size_t i, struct concat_seam *seam) {
+  const struct seek *a = &self->seek[i - 1], *b = &self->seek[i];
+  const uint32_t ch = a->channels;
+  size_t before, after;
+  double *values;
+
+  if (a->codec == SEEK_UNSUPPORTED || b->codec == SEEK_UNSUPPORTED) {
+    return;
+  }
+  before = a->frames < CONCAT_SEAM_FRAMES ? (size_t)a->frames
+                                          : CONCAT_SEAM_FRAMES;
+  after = b->frames < CONCAT_SEAM_FRAMES ? (size_t)b->frames
+                                         : CONCAT_SEAM_FRAMES;
+  if (before == 0 || after == 0 ||
+      !(values = malloc((before + after) * ch * sizeof(*values)))) {
+    return;
+  }
+  if (seek_frames(a, a->frames - before, before, values) == EXIT_SUCCESS &&
+      seek_frames(b, 0, after, values + before * ch) == EXIT_SUCCESS) {
+    seam->nearby = largest_step(values, before + after, ch, before);
+    seam->step = largest_step(values + (before - 1) * ch, 2, ch, 0);
+  }
+  free(values);
+}
+
+int
+concat_open(struct concat *self, char *paths[], size_t length) {
+  size_t i;
+
+  memset(self, 0, sizeof(*self));
+  self->path = paths;
+  self->in = calloc(length + 1, sizeof(*self->in));
+  self->wave = calloc(length + 1, sizeof(*self->wave));
+  self->seek = calloc(length + 1, sizeof(*self->seek));
+  self->first = calloc(length + 1, sizeof(*self->first));
+  self->seam = calloc(length + 1, sizeof(*self->seam));
+  if (!self->in || !self->wave || !self->seek || !self->first ||
+      !self->seam || length == 0 || segment_open(self, 0) != EXIT_SUCCESS) {
+    concat_close(self);
+    return EXIT_FAILURE;
+  }
+  self->count = 1;
+  self->first[1] = segment_frames(&self->seek[0], &self->wave[0]);
+
+  for (i = 1; i < length; ++i) {
+    struct concat_seam *seam = &self->seam[i - 1];
+    uint64_t frames = self->first[i] - self->first[i - 1];
+    uint64_t ta, tb;
+
+    if (segment_open(self, i) != EXIT_SUCCESS) {
+      break;
+    }
+    seam->frame = self->first[i];
+    seam->timed =
+        riff_wave_time_reference(&self->wave[i - 1], &ta) == EXIT_SUCCESS &&
+        riff_wave_time_reference(&self->wave[i], &tb) == EXIT_SUCCESS;
+    if (seam->timed) {
+      seam->time_gap = (int64_t)(tb - ta - frames);
+      if (seam->time_gap == 0) {
+        seam->link |= CONCAT_TIME;
+      }
+    }
+    if (consecutive_names(self->path[i - 1], self->path[i])) {
+      seam->link |= CONCAT_NAME;
+    }
+    if (!same_fmt(&self->wave[i - 1].fmt, &self->wave[i].fmt) ||
+        !seam->link) {
+      input_close(&self->in[i]);
+      memset(seam, 0, sizeof(*seam));
+      break;
+    }
+    self->count = i + 1;
+    self->first[i + 1] =
+        self->first[i] + segment_frames(&self->seek[i], &self->wave[i]);
+    seam_steps(self, i, seam);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+void
+concat_close(struct concat *self) {
+  size_t i;
+
+  for (i = 0; i < self->count; ++i) {
+    input_close(&self->in[i]);
+  }
+  free(self->seam);
+  free(self->first);
+  free(self->seek);
+  free(self->wave);
+  free(self->in);
+  memset(self, 0, sizeof(*self));
+}
+
+uint64_t
+concat_frames(const struct concat *self) {
+  return self->first[self->count];
+}
+
+size_t
+concat_segment(const struct concat *self, uint64_t frame) {
+  size_t lo = 0, hi = self->count;
+
+  if (frame >= concat_frames(self)) {
+    return self->count;
+  }
+  /* the last segment starting at or before frame */
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (self->first[mid] <= frame) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+int
+concat_frame(const struct concat *self, uint64_t frame, double *out) {
+  size_t s = concat_segment(self, frame);
+
+  if (s == self->count) {
+    return EXIT_FAILURE;
+  }
+  return seek_frame(&self->seek[s], frame - self->first[s], out);
+}
+
+int
+concat_seam_discontinuous(const struct concat_seam *seam) {
+  /* a click stands out against the steps of the signal around it */
+  return seam->time_gap != 0 ||
+         seam->step > 2.0 * seam->nearby + 1.0 / 32768.0;
+}
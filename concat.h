@@ -0,0 +1,79 @@
+#ifndef CONCAT_H
+#define CONCAT_H
+
+#include "input.h"
+#include "riff.h"
+#include "seek.h"
+
+/* Takes split by field recorders into 2 or 4 GiB segments, joined into
+ * one logical 'data' stream. Nothing is copied: the segments stay mapped
+ * side by side and the kernels taking segment lists, and the frame lookup
+ * below, step from one payload to the next at the seams.
+ *
+ * A file continues the previous one when their 'fmt ' chunks are equal
+ * and either its 'bext' TimeReference is the end of the previous one or
+ * the names differ only in a counter incremented by one, as in
+ * TAKE_0001.WAV, TAKE_0002.WAV.
+ */
+
+/* frames decoded on each side of a seam for its discontinuity */
+#define CONCAT_SEAM_FRAMES 32
+
+enum concat_link {
+  CONCAT_TIME = 1 << 0, /* continuous TimeReference */
+  CONCAT_NAME = 1 << 1, /* consecutive names */
+};
+
+struct concat_seam {
+  /* of the later segment, in frames of the stream */
+  uint64_t frame;
+  unsigned link;
+  /* both segments have a TimeReference */
+  int timed;
+  /* frames from the end of the earlier segment to the start of the later
+   * one by TimeReference, 0 when continuous */
+  int64_t time_gap;
+  /* largest step between consecutive samples of a channel across the
+   * seam and within CONCAT_SEAM_FRAMES either side of it, normalised to
+   * full scale, both 0 when the codec cannot be decoded */
+  double step;
+  double nearby;
+};
+
+struct concat {
+  size_t count;
+  char **path;
+  struct input *in;
+  /* parsed segments, the argument of the _segments kernels */
+  struct riff_wave *wave;
+  struct seek *seek;
+  /* first frame of each segment in the stream, count + 1 entries */
+  uint64_t *first;
+  /* seam[i] is between segments i and i + 1 */
+  struct concat_seam *seam;
+};
+
+/* Opens paths[0] and the files of paths continuing it. Fails when
+ * paths[0] is not a WAVE file; self->count is then 0. */
+int
+concat_open(struct concat *self, char *paths[], size_t length);
+
+void
+concat_close(struct concat *self);
+
+uint64_t
+concat_frames(const struct concat *self);
+
+/* Segment holding frame of the stream, count when past the end */
+size_t
+concat_segment(const struct concat *self, uint64_t frame);
+
+/* Decodes one frame of the stream into channels doubles, see seek.h */
+int
+concat_frame(const struct concat *self, uint64_t frame, double *out);
+
+/* A seam with a TimeReference gap or a step well above those next to it */
+int
+concat_seam_discontinuous(const struct concat_seam *seam);
+
+#endif
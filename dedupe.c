@@ -0,0 +1,246 @@
+#include "dedupe.h"
+#include "budget.h"
+#include "guard.h"
+#include "input.h"
+#include "pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+/* btrfs refuses larger requests, other filesystems silently shorten */
+#define DEDUPE_MAX_REQUEST (16 * 1024 * 1024)
+
+struct dedupe_pair {
+  const struct catalog_entry *src;
+  const struct catalog_entry *dst;
+  uint64_t deduped;
+  const char *result;
+};
+
+struct dedupe {
+  const struct catalog *catalog;
+  struct dedupe_pair *pairs;
+};
+
+static int
+entry_cmp(const void *a, const void *b) {
+  const struct catalog_entry *const *f = a;
+  const struct catalog_entry *const *s = b;
+
+  if ((*f)->payload_hash != (*s)->payload_hash) {
+    return (*f)->payload_hash < (*s)->payload_hash ? -1 : 1;
+  }
+  if ((*f)->data_length != (*s)->data_length) {
+    return (*f)->data_length < (*s)->data_length ? -1 : 1;
+  }
+  return 0;
+}
+
+static const char *
+dedupe_range(int src, uint64_t src_offset, int dst, uint64_t dst_offset,
+             uint64_t length, uint64_t *deduped) {
+  struct file_dedupe_range *range;
+
+  if (!(range = calloc(1, sizeof(*range) + sizeof(range->info[0])))) {
+    return strerror(ENOMEM);
+  }
+  range->dest_count = 1;
+  range->info[0].dest_fd = dst;
+
+  while (length > 0) {
+    uint64_t request = length < DEDUPE_MAX_REQUEST ? length
+                                                   : DEDUPE_MAX_REQUEST;
+    range->src_offset = src_offset;
+    range->src_length = request;
+    range->info[0].dest_offset = dst_offset;
+    range->info[0].bytes_deduped = 0;
+    range->info[0].status = 0;
+
+    if (ioctl(src, FIDEDUPERANGE, range) < 0) {
+      free(range);
+      return strerror(errno);
+    }
+    if (range->info[0].status == FILE_DEDUPE_RANGE_DIFFERS) {
+      free(range);
+      return "changed";
+    }
+    if (range->info[0].status < 0) {
+      int err = -range->info[0].status;
+      free(range);
+      return strerror(err);
+    }
+    if (range->info[0].bytes_deduped == 0) {
+      break;
+    }
+    *deduped += range->info[0].bytes_deduped;
+    src_offset += range->info[0].bytes_deduped;
+    dst_offset += range->info[0].bytes_deduped;
+    length -= range->info[0].bytes_deduped;
+  }
+
+  free(range);
+  /* the kernel shares nothing of extents it will not touch, e.g. busy or
+   * immutable ones, without reporting an error */
+  if (length > 0) {
+    return *deduped > 0 ? "partial" : "refused";
+  }
+  return "deduped";
+}
+
+/* Compares window by window under the memory budget, both windows are
+ * charged at once so a worker never holds one while waiting for the
+ * other. 1 when equal, 0 when not and -1 on SIGBUS, see guard.h. */
+static int
+same_payload(const struct input *src, uint64_t so, const struct input *dst,
+             uint64_t dof, uint64_t length) {
+  struct guard guard;
+  uint64_t offset;
+  int same = 1;
+
+  for (offset = 0; same == 1 && offset < length; offset += BUDGET_WINDOW) {
+    const uint64_t n =
+        length - offset < BUDGET_WINDOW ? length - offset : BUDGET_WINDOW;
+
+    budget_acquire(2 * n);
+    guard_push(&guard);
+    if (sigsetjmp(guard.env, 1) == 0) {
+      same = memcmp(src->raw + so + offset, dst->raw + dof + offset,
+                    (size_t)n) == 0;
+    } else {
+      same = -1;
+    }
+    guard_pop(&guard);
+    budget_drop(src->raw, src->fd, so + offset, n);
+    budget_drop(dst->raw, dst->fd, dof + offset, n);
+    budget_release(2 * n);
+  }
+  return same;
+}
+
+static void
+dedupe_pair(void *closure, size_t index, unsigned worker) {
+  struct dedupe *self = closure;
+  struct dedupe_pair *pair = &self->pairs[index];
+  const char *src_path = catalog_path(self->catalog, pair->src);
+  const char *dst_path = catalog_path(self->catalog, pair->dst);
+  uint64_t so = pair->src->data_offset;
+  uint64_t dof = pair->dst->data_offset;
+  uint64_t length = pair->src->data_length;
+  struct input src, dst;
+  struct statfs fs;
+  uint64_t block, skip;
+  int dst_fd;
+  int err;
+  (void)worker;
+
+  if ((err = input_open(&src, src_path)) != 0) {
+    pair->result = strerror(err);
+    return;
+  }
+  if ((err = input_open(&dst, dst_path)) != 0) {
+    pair->result = strerror(err);
+    input_close(&src);
+    return;
+  }
+
+  /* the catalog may be older than the files */
+  if (so + length > src.length || dof + length > dst.length ||
+      (err = same_payload(&src, so, &dst, dof, length)) == 0) {
+    pair->result = "changed";
+    goto Lclose;
+  }
+  if (err < 0) {
+    pair->result = strerror(EIO);
+    goto Lclose;
+  }
+
+  if (fstatfs(src.fd, &fs) < 0) {
+    pair->result = strerror(errno);
+    goto Lclose;
+  }
+  block = fs.f_bsize > 0 ? (uint64_t)fs.f_bsize : 4096;
+  if (so % block != dof % block) {
+    pair->result = "misaligned";
+    goto Lclose;
+  }
+  skip = (block - so % block) % block;
+  if (length < skip + block) {
+    pair->result = "too small";
+    goto Lclose;
+  }
+  length = (length - skip) / block * block;
+
+  /* FIDEDUPERANGE needs the destination writable unless we own it */
+  if ((dst_fd = input_fd(dst_path, O_RDWR)) < 0) {
+    dst_fd = dst.fd;
+  }
+  pair->result = dedupe_range(src.fd, so + skip, dst_fd, dof + skip, length,
+                              &pair->deduped);
+  if (dst_fd != dst.fd) {
+    close(dst_fd);
+  }
+
+Lclose:
+  input_close(&dst);
+  input_close(&src);
+}
+
+int
+dedupe_catalog(const struct catalog *catalog, unsigned workers) {
+  const uint64_t entries = catalog->header->entries;
+  const struct catalog_entry **sorted;
+  struct dedupe self;
+  size_t candidates = 0;
+  size_t pairs = 0;
+  uint64_t total = 0;
+  size_t i, j;
+  int res;
+
+  if (!(sorted = calloc(entries + 1, sizeof(*sorted))) ||
+      !(self.pairs = calloc(entries + 1, sizeof(*self.pairs)))) {
+    free(sorted);
+    return EXIT_FAILURE;
+  }
+  self.catalog = catalog;
+
+  for (i = 0; i < entries; ++i) {
+    const struct catalog_entry *entry = &catalog->entries[i];
+    if (!entry->error && entry->data_length > 0) {
+      sorted[candidates++] = entry;
+    }
+  }
+  qsort(sorted, candidates, sizeof(*sorted), entry_cmp);
+
+  /* the first entry of every group of equal payloads is the source */
+  for (i = 0; i < candidates; i = j) {
+    for (j = i + 1; j < candidates && entry_cmp(&sorted[i], &sorted[j]) == 0;
+         ++j) {
+      self.pairs[pairs].src = sorted[i];
+      self.pairs[pairs].dst = sorted[j];
+      ++pairs;
+    }
+  }
+
+  res = pool_run(workers, pairs, dedupe_pair, &self);
+
+  for (i = 0; i < pairs; ++i) {
+    struct dedupe_pair *pair = &self.pairs[i];
+    printf("%s\t%s\t%s\t%" PRIu64 "\n", catalog_path(catalog, pair->dst),
+           catalog_path(catalog, pair->src), pair->result, pair->deduped);
+    total += pair->deduped;
+  }
+  printf("Total[pairs: %zu, deduped: %" PRIu64 "]\n", pairs, total);
+
+  free(self.pairs);
+  free(sorted);
+  return res;
+}
@@ -0,0 +1,15 @@
+#ifndef DEDUPE_H
+#define DEDUPE_H
+
+#include "catalog.h"
+
+/* Shares the extents of identical 'data' payloads found in a catalog
+ * with FIDEDUPERANGE. Candidates with equal payload hash are verified
+ * byte for byte first, only whole filesystem blocks at the same
+ * alignment in both files can be shared. At most workers ioctls are in
+ * flight. A pair is reported "partial" or "refused" when the kernel
+ * shared only part or none of it. */
+int
+dedupe_catalog(const struct catalog *catalog, unsigned workers);
+
+#endif
@@ -0,0 +1,883 @@
+#include "edit.h"
+#include "input.h"
+#include "pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char *
+edit_result_str(enum edit_result result) {
+  switch (result) {
+  case EDIT_UNCHANGED:
+    return "unchanged";
+  case EDIT_IN_PLACE:
+    return "in-place";
+  case EDIT_RELOCATED:
+    return "relocated";
+  case EDIT_FAILED:
+    break;
+  }
+  return "failed";
+}
+
+static int
+is_padding(const char id[4]) {
+  return memcmp(id, "JUNK", 4) == 0 || memcmp(id, "junk", 4) == 0 ||
+         memcmp(id, "PAD ", 4) == 0 || memcmp(id, "FLLR", 4) == 0;
+}
+
+/* UTF-8 to Latin-1, the encoding of INFO values */
+static int
+to_latin1(const char *s, u8 *out, size_t *length) {
+  const u8 *it = (const u8 *)s;
+  size_t n = 0;
+
+  while (*it) {
+    if (*it < 0x80) {
+      out[n++] = *it++;
+    } else if ((it[0] & 0xE0) == 0xC0 && (it[1] & 0xC0) == 0x80) {
+      uint32_t cp = (uint32_t)(it[0] & 0x1F) << 6 | (it[1] & 0x3F);
+      if (cp < 0x80 || cp > 0xFF) {
+        return EXIT_FAILURE;
+      }
+      out[n++] = (u8)cp;
+      it += 2;
+    } else {
+      return EXIT_FAILURE;
+    }
+  }
+  *length = n;
+  return EXIT_SUCCESS;
+}
+
+/* The new LIST chunk with its header, of even length: the subchunks of
+ * list that are not edited, then the edited fields */
+static u8 *
+build_LIST(struct edit_file *self, const struct riff_chunk *list,
+           size_t *length) {
+  size_t capacity = 12 + (list->data ? list->size : 0);
+  size_t n = 12;
+  unsigned f;
+  u8 *buf;
+
+  for (f = 0; f < TAG_FIELDS; ++f) {
+    if (self->set & (1u << f) && self->value[f]) {
+      capacity += 8 + strlen(self->value[f]) + 2;
+    }
+  }
+  if (!(buf = malloc(capacity))) {
+    self->error = errno;
+    return NULL;
+  }
+  memcpy(buf, "LIST", 4);
+  memcpy(buf + 8, "INFO", 4);
+
+  if (list->data) {
+    const u8 *it = list->data + 4;
+    const u8 *const end = list->data + list->size;
+
+    while ((size_t)(end - it) >= 8) {
+      uint32_t size = rd_le32(it + 4);
+      int keep = 1;
+
+      if ((size_t)size > (size_t)(end - it) - 8) {
+        self->message = "malformed LIST/INFO chunk";
+        free(buf);
+        return NULL;
+      }
+      for (f = 0; f < TAG_FIELDS; ++f) {
+        if (self->set & (1u << f) && tag_INFO_is(it, (enum tag_field)f)) {
+          keep = 0;
+        }
+      }
+      if (keep) {
+        memcpy(buf + n, it, 8 + (size_t)size);
+        n += 8 + size;
+        if (n & 1) {
+          buf[n++] = '\0';
+        }
+      }
+      it += 8 + size;
+      while (it < end && *it == '\0') {
+        ++it;
+      }
+    }
+  }
+
+  for (f = 0; f < TAG_FIELDS; ++f) {
+    size_t len;
+    if (!(self->set & (1u << f)) || !self->value[f] || !*self->value[f]) {
+      continue;
+    }
+    if (to_latin1(self->value[f], buf + n + 8, &len) != EXIT_SUCCESS) {
+      self->message = "value not representable in LIST/INFO (Latin-1)";
+      free(buf);
+      return NULL;
+    }
+    memcpy(buf + n, tag_field_INFO((enum tag_field)f), 4);
+    buf[n + 8 + len++] = '\0';
+    wr_le32(buf + n + 4, (uint32_t)len);
+    n += 8 + len;
+    if (n & 1) {
+      buf[n++] = '\0';
+    }
+  }
+  wr_le32(buf + 4, (uint32_t)(n - 8));
+  *length = n;
+  return buf;
+}
+
+static int
+write_at(struct edit_file *self, int fd, const u8 *buf, size_t length,
+         uint64_t offset) {
+  ssize_t n = pwrite(fd, buf, length, (off_t)offset);
+
+  if (n >= 0 && (size_t)n != length) {
+    /* a short write leaves errno as it was */
+    errno = EIO;
+    n = -1;
+  }
+  if (n < 0 || fdatasync(fd) < 0) {
+    self->error = errno;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+/* Turns the padding chunk of total bytes at offset into the length bytes
+ * LIST without a moment where the chunk list is broken: the LIST body and
+ * the header of the padding left after it are written inside the padding
+ * first, then its size and last its ID. */
+static int
+write_into_padding(struct edit_file *self, int fd, const u8 *list,
+                   size_t length, uint64_t offset, uint64_t total) {
+  const size_t rest = length < total ? 8 : 0;
+  u8 *body;
+  int res;
+
+  if (!(body = malloc(length - 8 + rest))) {
+    self->error = errno;
+    return EXIT_FAILURE;
+  }
+  memcpy(body, list + 8, length - 8);
+  if (rest) {
+    memcpy(body + length - 8, "JUNK", 4);
+    wr_le32(body + length - 4, (uint32_t)(total - length - 8));
+  }
+  res = write_at(self, fd, body, length - 8 + rest, offset + 8);
+  free(body);
+  if (res != EXIT_SUCCESS ||
+      write_at(self, fd, list + 4, 4, offset + 4) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  return write_at(self, fd, list, 4, offset);
+}
+
+/* Grows the first of each run of padding chunks after 'fmt ' over the
+ * rest of the run, one write of its size that keeps the chunk list
+ * valid, so the renamed LISTs of earlier edits do not fragment the
+ * padding. raw is a shared mapping and sees the writes. */
+static int
+merge_padding(struct edit_file *self, int fd, const u8 *raw, uint64_t end) {
+  uint64_t offset = 12, run = 0;
+  int after_fmt = 0, in_run = 0;
+  u8 size[4];
+
+  while (offset + 8 <= end) {
+    const char *id = (const char *)raw + offset;
+    const uint32_t n = rd_le32(raw + offset + 4);
+    const uint64_t next = offset + 8 + (uint64_t)n + (n & 1);
+    const int padding = after_fmt && is_padding(id);
+
+    if (in_run && (!padding || next > end)) {
+      in_run = 0;
+      if (offset - run - 8 != rd_le32(raw + run + 4)) {
+        wr_le32(size, (uint32_t)(offset - run - 8));
+        if (write_at(self, fd, size, sizeof(size), run + 4) !=
+            EXIT_SUCCESS) {
+          return EXIT_FAILURE;
+        }
+      }
+    }
+    if (padding && !in_run && next <= end) {
+      run = offset;
+      in_run = 1;
+    }
+    if (memcmp(id, "fmt ", 4) == 0) {
+      after_fmt = 1;
+    }
+    offset = next;
+  }
+  if (in_run && offset == end && offset - run - 8 != rd_le32(raw + run + 4)) {
+    wr_le32(size, (uint32_t)(offset - run - 8));
+    return write_at(self, fd, size, sizeof(size), run + 4);
+  }
+  return EXIT_SUCCESS;
+}
+
+void
+edit_apply(struct edit_file *self) {
+  struct riff_iter iter;
+  struct riff_chunk chunk;
+  struct riff_chunk list;
+  struct stat st;
+  char form[4];
+  const u8 *raw = NULL;
+  size_t length = 0;
+  uint64_t riff_end, end;
+  /* the first LIST/INFO and the largest padding chunk */
+  uint64_t list_offset = 0;
+  uint64_t junk_offset = 0, junk_length = 0;
+  int after_fmt = 0;
+  u8 *buf = NULL, *out = NULL;
+  size_t new_length;
+  int fd, r;
+
+  self->result = EDIT_FAILED;
+  self->error = 0;
+  self->message = NULL;
+  memset(&list, 0, sizeof(list));
+
+  if ((fd = input_fd(self->path, O_RDWR)) < 0) {
+    self->error = errno;
+    return;
+  }
+  /* another path of the list may name the same file, its edits are
+   * applied after these, to the LIST written here */
+  if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0) {
+    self->error = errno;
+    goto Lclose;
+  }
+  if (!S_ISREG(st.st_mode) || st.st_size < 12) {
+    self->message = "not a RIFF WAVE file";
+    goto Lclose;
+  }
+  length = (size_t)st.st_size;
+  raw = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+  if (raw == MAP_FAILED) {
+    self->error = errno;
+    raw = NULL;
+    goto Lclose;
+  }
+  if (riff_iter_init(&iter, raw, length, form) != EXIT_SUCCESS ||
+      memcmp(form, "WAVE", 4) != 0) {
+    self->message = "not a RIFF WAVE file";
+    goto Lclose;
+  }
+  riff_end = 8 + (uint64_t)rd_le32(raw + 4);
+  if (riff_end + (riff_end & 1) < (uint64_t)length) {
+    self->message = "bytes trailing the RIFF";
+    goto Lclose;
+  }
+  /* the mapping ends early when the file is truncated */
+  end = riff_end < (uint64_t)length ? riff_end : (uint64_t)length;
+
+  while ((r = riff_iter_next(&iter, &chunk)) > 0) {
+    const uint64_t offset = (uint64_t)(chunk.data - raw) - 8;
+    uint64_t total = 8 + (uint64_t)chunk.size + (chunk.size & 1);
+
+    /* the pad byte of the last chunk may be missing */
+    if (offset + total > riff_end) {
+      total = riff_end - offset;
+    }
+    if (!list.data && memcmp(chunk.id, "LIST", 4) == 0 &&
+        chunk.size >= 4 && memcmp(chunk.data, "INFO", 4) == 0) {
+      list = chunk;
+      list_offset = offset;
+      continue;
+    }
+    /* padding in front of 'fmt ' is kept for an RF64 'ds64' */
+    if (after_fmt && is_padding(chunk.id) && total > junk_length) {
+      junk_offset = offset;
+      junk_length = total;
+    }
+    if (memcmp(chunk.id, "fmt ", 4) == 0) {
+      after_fmt = 1;
+    }
+  }
+  if (r < 0) {
+    self->message = "malformed chunk header";
+    goto Lclose;
+  }
+
+  if (!(buf = build_LIST(self, &list, &new_length))) {
+    goto Lclose;
+  }
+  if (list.data ? new_length - 8 == list.size &&
+                      memcmp(buf + 8, list.data, list.size) == 0
+                : new_length == 12) {
+    self->result = EDIT_UNCHANGED;
+    goto Lclose;
+  }
+  if (junk_length &&
+      (new_length == junk_length || new_length + 8 <= junk_length)) {
+    /* readers take the first LIST/INFO until the old one is renamed */
+    if (write_into_padding(self, fd, buf, new_length, junk_offset,
+                           junk_length) != EXIT_SUCCESS ||
+        (list.data &&
+         (write_at(self, fd, (const u8 *)"JUNK", 4, list_offset) !=
+              EXIT_SUCCESS ||
+          merge_padding(self, fd, raw, end) != EXIT_SUCCESS))) {
+      goto Lclose;
+    }
+    self->result = EDIT_IN_PLACE;
+  } else {
+    const size_t pad = (size_t)(riff_end & 1);
+    const size_t total = pad + new_length + 8 + EDIT_RESERVE;
+    u8 size[4];
+
+    if (riff_end + total - 8 > UINT32_MAX) {
+      self->message = "LIST would exceed the 4GB RIFF limit";
+      goto Lclose;
+    }
+    if (!(out = calloc(1, total))) {
+      self->error = errno;
+      goto Lclose;
+    }
+    memcpy(out + pad, buf, new_length);
+    memcpy(out + pad + new_length, "JUNK", 4);
+    wr_le32(out + pad + new_length + 4, EDIT_RESERVE);
+    if (write_at(self, fd, out, total, riff_end) != EXIT_SUCCESS) {
+      goto Lclose;
+    }
+    /* the new LIST becomes visible with the RIFF size, the old one
+     * shadows it until it is renamed */
+    wr_le32(size, (uint32_t)(riff_end + total - 8));
+    if (write_at(self, fd, size, sizeof(size), 4) != EXIT_SUCCESS) {
+      goto Lclose;
+    }
+    if (list.data &&
+        (write_at(self, fd, (const u8 *)"JUNK", 4, list_offset) !=
+             EXIT_SUCCESS ||
+         merge_padding(self, fd, raw, end) != EXIT_SUCCESS)) {
+      goto Lclose;
+    }
+    self->result = EDIT_RELOCATED;
+  }
+
+Lclose:
+  free(out);
+  free(buf);
+  if (raw) {
+    munmap((void *)(uintptr_t)raw, length);
+  }
+  close(fd);
+}
+
+struct edit {
+  char *path;
+  /* NULL to remove */
+  char *value;
+  enum tag_field field;
+  size_t seq;
+};
+
+struct edit_list {
+  const char *name;
+  struct edit *edits;
+  size_t length;
+  size_t capacity;
+};
+
+static char *
+copy_str(const char *s, size_t length) {
+  char *out = malloc(length + 1);
+  if (out) {
+    memcpy(out, s, length);
+    out[length] = '\0';
+  }
+  return out;
+}
+
+/* Takes ownership of path and value */
+static int
+list_push(struct edit_list *self, char *path, enum tag_field field,
+          char *value) {
+  if (self->length == self->capacity) {
+    size_t capacity = self->capacity ? self->capacity * 2 : 1024;
+    struct edit *edits = realloc(self->edits, capacity * sizeof(*edits));
+    if (!edits) {
+      free(path);
+      free(value);
+      return EXIT_FAILURE;
+    }
+    self->edits = edits;
+    self->capacity = capacity;
+  }
+  self->edits[self->length].path = path;
+  self->edits[self->length].value = value;
+  self->edits[self->length].field = field;
+  self->edits[self->length].seq = self->length;
+  ++self->length;
+  return EXIT_SUCCESS;
+}
+
+static void
+list_free(struct edit_list *self) {
+  size_t i;
+
+  for (i = 0; i < self->length; ++i) {
+    free(self->edits[i].path);
+    free(self->edits[i].value);
+  }
+  free(self->edits);
+}
+
+static int
+list_error(const struct edit_list *self, size_t line, const char *message,
+           const char *arg) {
+  fprintf(stderr, "ERROR: %s:%zu: %s%s\n", self->name, line, message, arg);
+  return EXIT_FAILURE;
+}
+
+/* One RFC 4180 field unquoted into out. Returns the delimiter that ended
+ * it, ',' or '\n', 0 at the end of the input, -1 on an open quote. */
+static int
+csv_field(const u8 **pit, const u8 *end, char *out, size_t *length,
+          size_t *line) {
+  const u8 *it = *pit;
+  size_t n = 0;
+  int quoted = 0;
+
+  if (it < end && *it == '"') {
+    quoted = 1;
+    ++it;
+  }
+  for (; it < end; ++it) {
+    if (quoted) {
+      if (*it == '"') {
+        if (it + 1 < end && it[1] == '"') {
+          out[n++] = '"';
+          ++it;
+        } else {
+          quoted = 0;
+        }
+        continue;
+      }
+      *line += *it == '\n';
+      out[n++] = (char)*it;
+      continue;
+    }
+    if (*it == ',' || *it == '\n') {
+      break;
+    }
+    if (*it == '\r' && (it + 1 == end || it[1] == '\n')) {
+      continue;
+    }
+    out[n++] = (char)*it;
+  }
+  out[n] = '\0';
+  *length = n;
+  if (quoted) {
+    return -1;
+  }
+  if (it == end) {
+    *pit = it;
+    return 0;
+  }
+  *line += *it == '\n';
+  *pit = it + 1;
+  return *it;
+}
+
+static int
+load_csv(struct edit_list *self, const u8 *it, const u8 *end,
+         char *scratch) {
+  size_t line = 1;
+  int first = 1;
+
+  while (it < end) {
+    const size_t record = line;
+    enum tag_field field;
+    size_t n;
+    char *path, *value;
+    int header;
+
+    if (*it == '\n' || *it == '\r') {
+      line += *it++ == '\n';
+      continue;
+    }
+    if (csv_field(&it, end, scratch, &n, &line) != ',') {
+      return list_error(self, record, "expected path,field,value", "");
+    }
+    header = first && strcmp(scratch, "path") == 0;
+    first = 0;
+    if (!(path = copy_str(scratch, n))) {
+      return EXIT_FAILURE;
+    }
+    if (csv_field(&it, end, scratch, &n, &line) != ',') {
+      free(path);
+      return list_error(self, record, "expected path,field,value", "");
+    }
+    header = header && strcmp(scratch, "field") == 0;
+    if (!header && tag_field_parse(scratch, &field) != EXIT_SUCCESS) {
+      free(path);
+      return list_error(self, record, "unknown field ", scratch);
+    }
+    switch (csv_field(&it, end, scratch, &n, &line)) {
+    case '\n':
+    case 0:
+      break;
+    case -1:
+      free(path);
+      return list_error(self, record, "unterminated quote", "");
+    default:
+      free(path);
+      return list_error(self, record, "expected path,field,value", "");
+    }
+    if (header) {
+      free(path);
+      continue;
+    }
+    value = NULL;
+    if (n && !(value = copy_str(scratch, n))) {
+      free(path);
+      return EXIT_FAILURE;
+    }
+    if (list_push(self, path, field, value) != EXIT_SUCCESS) {
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+static void
+skip_ws(const u8 **it, const u8 *end) {
+  while (*it < end && (**it == ' ' || **it == '\t' || **it == '\r')) {
+    ++*it;
+  }
+}
+
+static int
+hex4(const u8 *it, const u8 *end, uint32_t *out) {
+  unsigned i;
+
+  *out = 0;
+  if (end - it < 4) {
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < 4; ++i) {
+    const u8 c = it[i];
+    *out <<= 4;
+    if (c >= '0' && c <= '9') {
+      *out |= (uint32_t)(c - '0');
+    } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+      *out |= (uint32_t)((c | 0x20) - 'a' + 10);
+    } else {
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+/* A JSON string as UTF-8, never longer than its escaped form */
+static int
+json_string(const u8 **pit, const u8 *end, char *out, size_t *length) {
+  const u8 *it = *pit;
+  size_t n = 0;
+
+  if (it == end || *it++ != '"') {
+    return EXIT_FAILURE;
+  }
+  while (it < end && *it != '"') {
+    uint32_t cp;
+
+    if (*it < 0x20) {
+      return EXIT_FAILURE;
+    }
+    if (*it != '\\') {
+      out[n++] = (char)*it++;
+      continue;
+    }
+    if (++it == end) {
+      return EXIT_FAILURE;
+    }
+    switch (*it++) {
+    case '"':
+      out[n++] = '"';
+      continue;
+    case '\\':
+      out[n++] = '\\';
+      continue;
+    case '/':
+      out[n++] = '/';
+      continue;
+    case 'b':
+      out[n++] = '\b';
+      continue;
+    case 'f':
+      out[n++] = '\f';
+      continue;
+    case 'n':
+      out[n++] = '\n';
+      continue;
+    case 'r':
+      out[n++] = '\r';
+      continue;
+    case 't':
+      out[n++] = '\t';
+      continue;
+    case 'u':
+      break;
+    default:
+      return EXIT_FAILURE;
+    }
+    if (hex4(it, end, &cp) != EXIT_SUCCESS) {
+      return EXIT_FAILURE;
+    }
+    it += 4;
+    if (cp >= 0xD800 && cp < 0xDC00) {
+      uint32_t lo;
+      if (end - it < 6 || it[0] != '\\' || it[1] != 'u' ||
+          hex4(it + 2, end, &lo) != EXIT_SUCCESS || lo < 0xDC00 ||
+          lo >= 0xE000) {
+        return EXIT_FAILURE;
+      }
+      cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+      it += 6;
+    } else if (cp >= 0xDC00 && cp < 0xE000) {
+      return EXIT_FAILURE;
+    }
+    if (cp < 0x80) {
+      out[n++] = (char)cp;
+    } else if (cp < 0x800) {
+      out[n++] = (char)(0xC0 | (cp >> 6));
+      out[n++] = (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      out[n++] = (char)(0xE0 | (cp >> 12));
+      out[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+      out[n++] = (char)(0x80 | (cp & 0x3F));
+    } else {
+      out[n++] = (char)(0xF0 | (cp >> 18));
+      out[n++] = (char)(0x80 | ((cp >> 12) & 0x3F));
+      out[n++] = (char)(0x80 | ((cp >> 6) & 0x3F));
+      out[n++] = (char)(0x80 | (cp & 0x3F));
+    }
+  }
+  if (it == end) {
+    return EXIT_FAILURE;
+  }
+  out[n] = '\0';
+  *length = n;
+  *pit = it + 1;
+  return EXIT_SUCCESS;
+}
+
+/* One object per line, "path" and any tag fields */
+static int
+load_ndjson(struct edit_list *self, const u8 *it, const u8 *end,
+            char *scratch) {
+  size_t line = 0;
+
+  while (it < end) {
+    const u8 *eol = memchr(it, '\n', (size_t)(end - it));
+    char *value[TAG_FIELDS] = {NULL};
+    char *path = NULL;
+    unsigned set = 0;
+    unsigned f;
+    size_t n;
+    int res = EXIT_FAILURE;
+
+    if (!eol) {
+      eol = end;
+    }
+    ++line;
+    skip_ws(&it, eol);
+    if (it == eol) {
+      it = eol + (eol < end);
+      continue;
+    }
+    if (*it++ != '{') {
+      return list_error(self, line, "expected an object", "");
+    }
+    skip_ws(&it, eol);
+    while (it < eol && *it != '}') {
+      enum tag_field field;
+      if (json_string(&it, eol, scratch, &n) != EXIT_SUCCESS) {
+        list_error(self, line, "malformed key", "");
+        goto Lobject;
+      }
+      skip_ws(&it, eol);
+      if (it == eol || *it++ != ':') {
+        list_error(self, line, "expected ':'", "");
+        goto Lobject;
+      }
+      skip_ws(&it, eol);
+      if (strcmp(scratch, "path") == 0) {
+        if (json_string(&it, eol, scratch, &n) != EXIT_SUCCESS) {
+          list_error(self, line, "path must be a string", "");
+          goto Lobject;
+        }
+        free(path);
+        if (!(path = copy_str(scratch, n))) {
+          goto Lobject;
+        }
+      } else if (tag_field_parse(scratch, &field) == EXIT_SUCCESS) {
+        free(value[field]);
+        value[field] = NULL;
+        set |= 1u << field;
+        if ((size_t)(eol - it) >= 4 && memcmp(it, "null", 4) == 0) {
+          it += 4;
+        } else if (json_string(&it, eol, scratch, &n) != EXIT_SUCCESS) {
+          list_error(self, line, "value must be a string or null", "");
+          goto Lobject;
+        } else if (n && !(value[field] = copy_str(scratch, n))) {
+          goto Lobject;
+        }
+      } else {
+        list_error(self, line, "unknown field ", scratch);
+        goto Lobject;
+      }
+      skip_ws(&it, eol);
+      if (it < eol && *it == ',') {
+        ++it;
+        skip_ws(&it, eol);
+      } else if (it == eol || *it != '}') {
+        list_error(self, line, "expected ',' or '}'", "");
+        goto Lobject;
+      }
+    }
+    if (it == eol) {
+      list_error(self, line, "expected '}'", "");
+      goto Lobject;
+    }
+    ++it;
+    skip_ws(&it, eol);
+    if (it != eol) {
+      list_error(self, line, "trailing bytes after the object", "");
+      goto Lobject;
+    }
+    if (!path) {
+      list_error(self, line, "missing path", "");
+      goto Lobject;
+    }
+    res = EXIT_SUCCESS;
+    for (f = 0; f < TAG_FIELDS && res == EXIT_SUCCESS; ++f) {
+      char *copy;
+      if (!(set & (1u << f))) {
+        continue;
+      }
+      if (!(copy = copy_str(path, strlen(path)))) {
+        res = EXIT_FAILURE;
+        break;
+      }
+      res = list_push(self, copy, (enum tag_field)f, value[f]);
+      value[f] = NULL;
+    }
+
+  Lobject:
+    free(path);
+    for (f = 0; f < TAG_FIELDS; ++f) {
+      free(value[f]);
+    }
+    if (res != EXIT_SUCCESS) {
+      return res;
+    }
+    it = eol + (eol < end);
+  }
+  return EXIT_SUCCESS;
+}
+
+static int
+edit_cmp(const void *a, const void *b) {
+  const struct edit *f = a;
+  const struct edit *s = b;
+  int cmp = strcmp(f->path, s->path);
+
+  if (cmp != 0) {
+    return cmp;
+  }
+  return f->seq < s->seq ? -1 : f->seq > s->seq;
+}
+
+static void
+edit_file_worker(void *closure, size_t index, unsigned worker) {
+  struct edit_file *files = closure;
+  (void)worker;
+  edit_apply(&files[index]);
+}
+
+int
+edit_bulk(const char *name, unsigned workers) {
+  struct edit_list list;
+  struct edit_file *files = NULL;
+  struct input in;
+  size_t counts[EDIT_FAILED + 1] = {0};
+  size_t nfiles = 0, i;
+  char *scratch;
+  int err, res = EXIT_FAILURE;
+
+  memset(&list, 0, sizeof(list));
+  list.name = name;
+  if ((err = input_open(&in, name)) != 0) {
+    fprintf(stderr, "%s: %s\n", name, strerror(err));
+    return EXIT_FAILURE;
+  }
+  if (!(scratch = malloc(in.length + 1))) {
+    input_close(&in);
+    return EXIT_FAILURE;
+  }
+  {
+    const u8 *it = in.raw;
+    const u8 *const end = in.raw + in.length;
+    while (it < end && (*it == ' ' || *it == '\t' || *it == '\r' ||
+                        *it == '\n')) {
+      ++it;
+    }
+    res = it < end && *it == '{' ? load_ndjson(&list, in.raw, end, scratch)
+                                 : load_csv(&list, in.raw, end, scratch);
+  }
+  free(scratch);
+  input_close(&in);
+  if (res != EXIT_SUCCESS) {
+    goto Lfree;
+  }
+  res = EXIT_FAILURE;
+
+  /* grouped by file in list order, so the last edit of a field wins */
+  qsort(list.edits, list.length, sizeof(*list.edits), edit_cmp);
+  if (!(files = calloc(list.length ? list.length : 1, sizeof(*files)))) {
+    goto Lfree;
+  }
+  for (i = 0; i < list.length; ++i) {
+    const struct edit *edit = &list.edits[i];
+    struct edit_file *file;
+    if (i == 0 || strcmp(edit->path, list.edits[i - 1].path) != 0) {
+      files[nfiles++].path = edit->path;
+    }
+    file = &files[nfiles - 1];
+    file->value[edit->field] = edit->value;
+    file->set |= 1u << edit->field;
+  }
+
+  if (pool_run(workers, nfiles, edit_file_worker, files) != EXIT_SUCCESS) {
+    goto Lfree;
+  }
+  for (i = 0; i < nfiles; ++i) {
+    const struct edit_file *file = &files[i];
+    ++counts[file->result];
+    if (file->result == EDIT_FAILED) {
+      fprintf(stderr, "%s: %s\n", file->path,
+              file->error ? strerror(file->error) : file->message);
+    } else {
+      printf("%s\t%s\n", edit_result_str(file->result), file->path);
+    }
+  }
+  printf("Edit[files: %zu, unchanged: %zu, in-place: %zu, relocated: %zu, "
+         "failed: %zu]\n",
+         nfiles, counts[EDIT_UNCHANGED], counts[EDIT_IN_PLACE],
+         counts[EDIT_RELOCATED], counts[EDIT_FAILED]);
+  res = counts[EDIT_FAILED] ? EXIT_FAILURE : EXIT_SUCCESS;
+
+Lfree:
+  free(files);
+  list_free(&list);
+  return res;
+}
@@ -0,0 +1,62 @@
+#ifndef EDIT_H
+#define EDIT_H
+
+#include "tags.h"
+
+/* Bulk LIST/INFO edits. An edit list is either CSV, one edit per record
+ *
+ *   path,field,value
+ *   a.wav,Title,"Hello, world"
+ *
+ * or NDJSON, any number of fields per object
+ *
+ *   {"path": "a.wav", "Title": "Hello, world", "Comment": null}
+ *
+ * Fields are named as by tag_field_str(), an empty or null value removes
+ * the field. Edits are grouped by path, the last edit of a field wins.
+ * Paths naming the same file, as a.wav and ./a.wav or hard links, are
+ * applied one after the other under flock(2).
+ *
+ * The new LIST is written into the largest JUNK padding when it fits:
+ * its body inside the padding, then the chunk size and ID, so the chunk
+ * list stays valid throughout. Otherwise the LIST is relocated: appended
+ * with EDIT_RESERVE bytes of JUNK for later edits and made part of the
+ * RIFF by growing its size. Only then is the old LIST renamed to JUNK;
+ * until then readers take the first LIST/INFO. Each step is synced and
+ * changes at most 4 bytes of live chunk headers, a crash leaves either the
+ * old or the new tags.
+ */
+
+#define EDIT_RESERVE 1024
+
+enum edit_result {
+  EDIT_UNCHANGED,
+  EDIT_IN_PLACE,
+  EDIT_RELOCATED,
+  EDIT_FAILED,
+};
+
+struct edit_file {
+  const char *path;
+  /* UTF-8, NULL to remove, for each field in set */
+  const char *value[TAG_FIELDS];
+  unsigned set;
+  enum edit_result result;
+  /* EDIT_FAILED: errno or 0 and a message */
+  int error;
+  const char *message;
+};
+
+const char *
+edit_result_str(enum edit_result result);
+
+/* Rewrites the LIST/INFO chunk of one file */
+void
+edit_apply(struct edit_file *self);
+
+/* Loads the edit list, applies it with the worker pool and reports the
+ * result of each file */
+int
+edit_bulk(const char *list, unsigned workers);
+
+#endif
@@ -0,0 +1,106 @@
+// Example consumer of riff.hpp, built with the library so the templates are
+// compiled: prints the peak of each channel of a WAVE file.
+//
+//   example file
+
+#include "riff.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+template <class T, unsigned Channels>
+std::vector<float> peaks(const riff::sample_view<T, Channels> &view) {
+  std::vector<float> peak(view.channels(), 0.0f);
+  std::vector<float> channel(view.frames());
+
+  for (unsigned c = 0; c < view.channels(); ++c) {
+    view.channel_to_float(c, channel.data());
+    for (float v : channel) {
+      v = std::fabs(v);
+      peak[c] = v > peak[c] ? v : peak[c];
+    }
+  }
+  return peak;
+}
+
+// The fixed channel count path, one frame at a time
+std::vector<float>
+stereo_peaks(const riff::sample_view<std::int16_t, 2> &view) {
+  std::vector<float> peak(2, 0.0f);
+
+  view.for_each_frame([&peak](std::size_t, const float(&frame)[2]) {
+    for (unsigned c = 0; c < 2; ++c) {
+      float v = std::fabs(frame[c]);
+      peak[c] = v > peak[c] ? v : peak[c];
+    }
+  });
+  return peak;
+}
+
+std::vector<float> wave_peaks(const riff::wave &w) {
+  if (w.holds<std::int16_t, 2>()) {
+    return stereo_peaks(w.samples<std::int16_t, 2>());
+  }
+  if (w.holds<std::uint8_t>()) {
+    return peaks(w.samples<std::uint8_t>());
+  }
+  if (w.holds<std::int16_t>()) {
+    return peaks(w.samples<std::int16_t>());
+  }
+  if (w.holds<riff::int24>()) {
+    return peaks(w.samples<riff::int24>());
+  }
+  if (w.holds<std::int32_t>()) {
+    return peaks(w.samples<std::int32_t>());
+  }
+  return peaks(w.samples<float>());
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  struct stat st;
+  void *raw;
+  int fd;
+  int res = EXIT_FAILURE;
+
+  if (argc != 2) {
+    std::fprintf(stderr, "%s file\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if ((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    std::perror(argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (st.st_size == 0 ||
+      (raw = mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_SHARED,
+                  fd, 0)) == MAP_FAILED) {
+    std::fprintf(stderr, "%s: cannot map\n", argv[1]);
+    close(fd);
+    return EXIT_FAILURE;
+  }
+  try {
+    riff::wave w(raw, std::size_t(st.st_size));
+    std::vector<float> peak = wave_peaks(w);
+
+    std::printf("Peak[frames: %llu", (unsigned long long)w.frames());
+    for (std::size_t c = 0; c < peak.size(); ++c) {
+      std::printf(", Channel%zu: %f", c, double(peak[c]));
+    }
+    std::printf("]\n");
+    res = EXIT_SUCCESS;
+  } catch (const riff::error &e) {
+    std::fprintf(stderr, "ERROR: %s\n", e.what());
+  }
+  munmap(raw, std::size_t(st.st_size));
+  close(fd);
+  return res;
+}
@@ -0,0 +1,399 @@
+#include "export.h"
+#include "arrow.h"
+#include "budget.h"
+#include "guard.h"
+#include "input.h"
+#include "pool.h"
+#include "sniff.h"
+#include "tags.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum export_column {
+  EXPORT_PATH,
+  EXPORT_CONTAINER,
+  EXPORT_FORMAT,
+  EXPORT_RATE,
+  EXPORT_CHANNELS,
+  EXPORT_BITS,
+  EXPORT_DURATION,
+  EXPORT_FILE_SIZE,
+  EXPORT_DATA_LENGTH,
+  EXPORT_PAYLOAD_HASH,
+  EXPORT_META_HASH,
+  EXPORT_ERROR,
+  EXPORT_TAGS,
+  EXPORT_COLUMNS = EXPORT_TAGS + TAG_FIELDS,
+};
+
+static const struct arrow_field export_fields[EXPORT_TAGS] = {
+    {"path", ARROW_UTF8, 0},
+    {"container", ARROW_UTF8, 0},
+    {"AudioFormat", ARROW_UINT16, 0},
+    {"SampleRate", ARROW_UINT32, 0},
+    {"NumChannels", ARROW_UINT16, 0},
+    {"BitsPerSample", ARROW_UINT16, 0},
+    {"duration", ARROW_FLOAT64, 1},
+    {"file_size", ARROW_UINT64, 0},
+    {"data_length", ARROW_UINT64, 0},
+    {"payload_hash", ARROW_UINT64, 0},
+    {"meta_hash", ARROW_UINT64, 0},
+    {"error", ARROW_UINT16, 0},
+};
+
+/* UTF-8 tag values of one row, NULL when absent */
+struct export_row {
+  char *tag[TAG_FIELDS];
+  size_t tag_length[TAG_FIELDS];
+};
+
+struct export {
+  const struct catalog *catalog;
+  uint64_t first;
+  struct export_row *rows;
+};
+
+static void
+export_tags(void *closure, size_t index, unsigned worker) {
+  struct export *self = closure;
+  const struct catalog_entry *entry =
+      &self->catalog->entries[self->first + index];
+  struct export_row *row = &self->rows[index];
+  struct input in;
+  struct tags tags;
+  struct guard guard;
+  FILE *volatile out = NULL;
+  unsigned f;
+  (void)worker;
+
+  memset(row, 0, sizeof(*row));
+  if (entry->error || memcmp(entry->form, "WAVE", 4) != 0 ||
+      input_open(&in, catalog_path(self->catalog, entry)) != 0) {
+    return;
+  }
+  tags_init(&tags);
+  guard_push(&guard);
+  if (sigsetjmp(guard.env, 1) != 0) {
+    /* the file changed under the mapping, exported without tags */
+    if (out) {
+      fclose(out);
+    }
+    for (f = 0; f < TAG_FIELDS; ++f) {
+      free(row->tag[f]);
+      row->tag[f] = NULL;
+      row->tag_length[f] = 0;
+    }
+  } else if (tags_parse_wave(&tags, in.raw, in.length) == EXIT_SUCCESS) {
+    for (f = 0; f < TAG_FIELDS; ++f) {
+      if (!tags.field[f].ptr) {
+        continue;
+      }
+      if (!(out = open_memstream(&row->tag[f], &row->tag_length[f]))) {
+        continue;
+      }
+      tag_value_fput(&tags.field[f], out);
+      if (fclose(out) != 0) {
+        free(row->tag[f]);
+        row->tag[f] = NULL;
+      }
+      out = NULL;
+    }
+  }
+  guard_pop(&guard);
+  tags_free(&tags);
+  input_close(&in);
+}
+
+/* Frames are fixed size for the formats where BlockAlign is one frame */
+static int
+entry_duration(const struct catalog_entry *entry, double *out) {
+  if (entry->SampleRate == 0 || entry->BlockAlign == 0 ||
+      entry->BlockAlign !=
+          entry->NumChannels * ((entry->BitsPerSample + 7u) / 8)) {
+    return 0;
+  }
+  *out = (double)(entry->data_length / entry->BlockAlign) /
+         entry->SampleRate;
+  return 1;
+}
+
+/* Column buffers of one batch */
+struct export_batch {
+  uint64_t length;
+  int32_t *offsets[EXPORT_COLUMNS];
+  char *strings[EXPORT_COLUMNS];
+  u8 *validity[EXPORT_COLUMNS];
+  void *values[EXPORT_COLUMNS];
+  struct arrow_column column[EXPORT_COLUMNS];
+};
+
+static void
+batch_free(struct export_batch *self) {
+  unsigned c;
+
+  for (c = 0; c < EXPORT_COLUMNS; ++c) {
+    free(self->offsets[c]);
+    free(self->strings[c]);
+    free(self->validity[c]);
+    free(self->values[c]);
+  }
+}
+
+static int
+batch_strings(struct export_batch *self, unsigned c, const char *const *s,
+              const size_t *lengths) {
+  struct arrow_column *col = &self->column[c];
+  uint64_t total = 0;
+  uint64_t i;
+
+  if (!(self->offsets[c] = malloc((self->length + 1) * sizeof(int32_t))) ||
+      !(self->validity[c] = calloc((self->length + 7) / 8, 1))) {
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < self->length; ++i) {
+    self->offsets[c][i] = (int32_t)total;
+    if (s[i]) {
+      self->validity[c][i / 8] |= (u8)(1u << (i % 8));
+      total += lengths[i];
+    } else {
+      ++col->null_count;
+    }
+  }
+  if (total > INT32_MAX) {
+    fprintf(stderr, "ERROR: column '%s' exceeds 2 GiB in one batch\n",
+            c < EXPORT_TAGS ? export_fields[c].name
+                            : tag_field_str(c - EXPORT_TAGS));
+    return EXIT_FAILURE;
+  }
+  self->offsets[c][self->length] = (int32_t)total;
+  if (!(self->strings[c] = malloc(total ? total : 1))) {
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < self->length; ++i) {
+    if (s[i]) {
+      memcpy(self->strings[c] + self->offsets[c][i], s[i], lengths[i]);
+    }
+  }
+  col->offsets = self->offsets[c];
+  col->values = self->strings[c];
+  col->validity = col->null_count ? self->validity[c] : NULL;
+  return EXIT_SUCCESS;
+}
+
+static int
+batch_fill(struct export_batch *self, const struct catalog *catalog,
+           uint64_t first, const struct export_row *rows) {
+  const struct catalog_entry *entries = &catalog->entries[first];
+  const uint64_t n = self->length;
+  const char **s;
+  size_t *lengths;
+  uint16_t *u16[EXPORT_COLUMNS] = {NULL};
+  uint32_t *rate;
+  uint64_t *u64[EXPORT_COLUMNS] = {NULL};
+  double *duration;
+  uint64_t i;
+  unsigned c;
+  int res = EXIT_FAILURE;
+
+  s = calloc(n, sizeof(*s));
+  lengths = calloc(n, sizeof(*lengths));
+  if (!s || !lengths) {
+    goto Lfree;
+  }
+
+  for (i = 0; i < n; ++i) {
+    s[i] = catalog_path(catalog, &entries[i]);
+    lengths[i] = entries[i].path_length;
+  }
+  if (batch_strings(self, EXPORT_PATH, s, lengths) != EXIT_SUCCESS) {
+    goto Lfree;
+  }
+  for (i = 0; i < n; ++i) {
+    s[i] = sniff_container_str(entries[i].container);
+    lengths[i] = strlen(s[i]);
+  }
+  if (batch_strings(self, EXPORT_CONTAINER, s, lengths) != EXIT_SUCCESS) {
+    goto Lfree;
+  }
+  for (c = 0; c < TAG_FIELDS; ++c) {
+    for (i = 0; i < n; ++i) {
+      s[i] = rows[i].tag[c];
+      lengths[i] = rows[i].tag_length[c];
+    }
+    if (batch_strings(self, EXPORT_TAGS + c, s, lengths) != EXIT_SUCCESS) {
+      goto Lfree;
+    }
+  }
+
+  for (c = 0; c < EXPORT_TAGS; ++c) {
+    size_t width;
+    switch (export_fields[c].type) {
+    case ARROW_UINT16:
+      width = 2;
+      break;
+    case ARROW_UINT32:
+      width = 4;
+      break;
+    case ARROW_UINT64:
+    case ARROW_FLOAT64:
+      width = 8;
+      break;
+    case ARROW_UTF8:
+    default:
+      continue;
+    }
+    if (!(self->values[c] = malloc(n ? n * width : 1))) {
+      goto Lfree;
+    }
+    self->column[c].values = self->values[c];
+    u16[c] = self->values[c];
+    u64[c] = self->values[c];
+  }
+  rate = self->values[EXPORT_RATE];
+  duration = self->values[EXPORT_DURATION];
+  if (!(self->validity[EXPORT_DURATION] = calloc((n + 7) / 8, 1))) {
+    goto Lfree;
+  }
+  for (i = 0; i < n; ++i) {
+    const struct catalog_entry *entry = &entries[i];
+    u16[EXPORT_FORMAT][i] = entry->AudioFormat;
+    rate[i] = entry->SampleRate;
+    u16[EXPORT_CHANNELS][i] = entry->NumChannels;
+    u16[EXPORT_BITS][i] = entry->BitsPerSample;
+    if (entry_duration(entry, &duration[i])) {
+      self->validity[EXPORT_DURATION][i / 8] |= (u8)(1u << (i % 8));
+    } else {
+      duration[i] = 0;
+      ++self->column[EXPORT_DURATION].null_count;
+    }
+    u64[EXPORT_FILE_SIZE][i] = entry->file_size;
+    u64[EXPORT_DATA_LENGTH][i] = entry->data_length;
+    u64[EXPORT_PAYLOAD_HASH][i] = entry->payload_hash;
+    u64[EXPORT_META_HASH][i] = entry->meta_hash;
+    u16[EXPORT_ERROR][i] = entry->error;
+  }
+  if (self->column[EXPORT_DURATION].null_count) {
+    self->column[EXPORT_DURATION].validity = self->validity[EXPORT_DURATION];
+  }
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(lengths);
+  free(s);
+  return res;
+}
+
+/* Upper bound of the column buffers of a batch, charged to the budget:
+ * an 8 byte value or offset and a validity byte per cell plus the strings */
+static uint64_t
+batch_bytes(const struct catalog *catalog, uint64_t first,
+            const struct export_row *rows, size_t length) {
+  uint64_t res = (uint64_t)length * EXPORT_COLUMNS * 9;
+  size_t i;
+  unsigned f;
+
+  for (i = 0; i < length; ++i) {
+    res += strlen(catalog_path(catalog, &catalog->entries[first + i])) + 8;
+    for (f = 0; f < TAG_FIELDS; ++f) {
+      res += rows[i].tag_length[f];
+    }
+  }
+  return res;
+}
+
+static int
+export_batches(const struct catalog *catalog, struct arrow_writer *writer,
+               unsigned workers) {
+  struct export self;
+  const uint64_t entries = catalog->header->entries;
+  size_t i;
+  unsigned f;
+  int res = EXIT_SUCCESS;
+
+  self.catalog = catalog;
+  if (!(self.rows = calloc(EXPORT_BATCH, sizeof(*self.rows)))) {
+    return EXIT_FAILURE;
+  }
+  for (self.first = 0; self.first < entries && res == EXIT_SUCCESS;
+       self.first += EXPORT_BATCH) {
+    struct export_batch batch;
+    size_t length = (size_t)(entries - self.first < EXPORT_BATCH
+                                 ? entries - self.first
+                                 : EXPORT_BATCH);
+    uint64_t bytes = 0;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.length = length;
+    if ((res = pool_run(workers, length, export_tags, &self)) ==
+        EXIT_SUCCESS) {
+      bytes = batch_bytes(catalog, self.first, self.rows, length);
+      budget_acquire(bytes);
+      if ((res = batch_fill(&batch, catalog, self.first, self.rows)) ==
+          EXIT_SUCCESS) {
+        res = arrow_write_batch(writer, length, batch.column);
+      }
+    }
+    batch_free(&batch);
+    budget_release(bytes);
+    for (i = 0; i < length; ++i) {
+      for (f = 0; f < TAG_FIELDS; ++f) {
+        free(self.rows[i].tag[f]);
+      }
+    }
+  }
+  free(self.rows);
+  return res;
+}
+
+int
+export_arrow(const struct catalog *catalog, const char *path,
+             unsigned workers) {
+  struct arrow_field fields[EXPORT_COLUMNS];
+  struct arrow_writer writer;
+  char *tmp;
+  FILE *f;
+  unsigned c;
+  int res = EXIT_FAILURE;
+
+  memcpy(fields, export_fields, sizeof(export_fields));
+  for (c = 0; c < TAG_FIELDS; ++c) {
+    fields[EXPORT_TAGS + c].name = tag_field_str(c);
+    fields[EXPORT_TAGS + c].type = ARROW_UTF8;
+    fields[EXPORT_TAGS + c].nullable = 1;
+  }
+
+  if (!(tmp = malloc(strlen(path) + sizeof(".tmp")))) {
+    return EXIT_FAILURE;
+  }
+  sprintf(tmp, "%s.tmp", path);
+  if (!(f = fopen(tmp, "wb"))) {
+    fprintf(stderr, "fopen(%s): %s\n", tmp, strerror(errno));
+    free(tmp);
+    return EXIT_FAILURE;
+  }
+  if (arrow_begin(&writer, f, fields, EXPORT_COLUMNS) != EXIT_SUCCESS ||
+      export_batches(catalog, &writer, workers) != EXIT_SUCCESS ||
+      arrow_end(&writer) != EXIT_SUCCESS || fflush(f) != 0 || ferror(f) ||
+      fsync(fileno(f)) < 0) {
+    fprintf(stderr, "write(%s): %s\n", tmp, strerror(errno));
+    free(writer.blocks);
+    fclose(f);
+    unlink(tmp);
+    goto Lfree;
+  }
+  fclose(f);
+  if (rename(tmp, path) < 0) {
+    fprintf(stderr, "rename(%s): %s\n", path, strerror(errno));
+    unlink(tmp);
+    goto Lfree;
+  }
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(tmp);
+  return res;
+}
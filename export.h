@@ -0,0 +1,18 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "catalog.h"
+
+/* rows per record batch */
+#define EXPORT_BATCH 65536
+
+/* Writes the catalog as an Arrow IPC file, atomically replacing path:
+ * path, container, format, rate, channels, bits, duration, lengths,
+ * hashes and scan error, then one nullable column per tag field. The
+ * catalog does not store tags, each batch reopens its files on workers
+ * threads and assembles the columns from their per row results. */
+int
+export_arrow(const struct catalog *catalog, const char *path,
+             unsigned workers);
+
+#endif
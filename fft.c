@@ -0,0 +1,118 @@
+#include "fft.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+int
+fft_init(struct fft *self, size_t n) {
+  unsigned bits = 0;
+  size_t i;
+
+  self->n = n;
+  self->cos = NULL;
+  self->sin = NULL;
+  self->reverse = NULL;
+  if (n < 2 || (n & (n - 1)) != 0) {
+    return EXIT_FAILURE;
+  }
+  while (((size_t)1 << bits) < n) {
+    ++bits;
+  }
+
+  self->cos = malloc(n / 2 * sizeof(*self->cos));
+  self->sin = malloc(n / 2 * sizeof(*self->sin));
+  self->reverse = malloc(n * sizeof(*self->reverse));
+  if (!self->cos || !self->sin || !self->reverse) {
+    fft_free(self);
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < n / 2; ++i) {
+    double a = -2.0 * M_PI * (double)i / (double)n;
+    self->cos[i] = (float)cos(a);
+    self->sin[i] = (float)sin(a);
+  }
+  for (i = 0; i < n; ++i) {
+    size_t r = 0;
+    unsigned b;
+    for (b = 0; b < bits; ++b) {
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    self->reverse[i] = r;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+void
+fft_free(struct fft *self) {
+  free(self->cos);
+  free(self->sin);
+  free(self->reverse);
+  self->cos = NULL;
+  self->sin = NULL;
+  self->reverse = NULL;
+}
+
+static void
+fft_run(const struct fft *self, float *re, float *im, float sign) {
+  const size_t n = self->n;
+  size_t half, i, j;
+
+  for (i = 0; i < n; ++i) {
+    size_t r = self->reverse[i];
+    if (r > i) {
+      float t = re[i];
+      re[i] = re[r];
+      re[r] = t;
+      t = im[i];
+      im[i] = im[r];
+      im[r] = t;
+    }
+  }
+
+  for (half = 1; half < n; half *= 2) {
+    const size_t stride = n / (half * 2);
+    for (i = 0; i < n; i += half * 2) {
+      float *restrict ar = re + i;
+      float *restrict ai = im + i;
+      float *restrict br = re + i + half;
+      float *restrict bi = im + i + half;
+      for (j = 0; j < half; ++j) {
+        float wr = self->cos[j * stride];
+        float wi = sign * self->sin[j * stride];
+        float tr = br[j] * wr - bi[j] * wi;
+        float ti = br[j] * wi + bi[j] * wr;
+        br[j] = ar[j] - tr;
+        bi[j] = ai[j] - ti;
+        ar[j] += tr;
+        ai[j] += ti;
+      }
+    }
+  }
+}
+
+void
+fft_forward(const struct fft *self, float *re, float *im) {
+  fft_run(self, re, im, 1.0f);
+}
+
+void
+fft_inverse(const struct fft *self, float *re, float *im) {
+  const float scale = 1.0f / (float)self->n;
+  size_t i;
+
+  fft_run(self, re, im, -1.0f);
+  for (i = 0; i < self->n; ++i) {
+    re[i] *= scale;
+    im[i] *= scale;
+  }
+}
+
+void
+fft_hann(float *window, size_t n) {
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * (double)i / (double)n));
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <stddef.h>
+
+/* In place radix-2 complex FFT over split real/imaginary arrays. The
+ * butterflies run over contiguous spans of both arrays so the compiler
+ * can vectorise them. */
+
+struct fft {
+  size_t n;
+  /* twiddle factors e^(-2*pi*i*k/n) for k < n/2 */
+  float *cos;
+  float *sin;
+  size_t *reverse;
+};
+
+/* n must be a power of two */
+int
+fft_init(struct fft *self, size_t n);
+
+void
+fft_free(struct fft *self);
+
+void
+fft_forward(const struct fft *self, float *re, float *im);
+
+/* Inverse transform including the 1/n scaling */
+void
+fft_inverse(const struct fft *self, float *re, float *im);
+
+/* Periodic Hann window of length n */
+void
+fft_hann(float *window, size_t n);
+
+#endif
@@ -0,0 +1,47 @@
+#include "guard.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+
+static _Thread_local struct guard *guard_current;
+
+static pthread_once_t guard_once = PTHREAD_ONCE_INIT;
+
+static void
+guard_signal(int sig) {
+  struct guard *self = guard_current;
+
+  if (!self) {
+    /* the access is retried and takes the default action */
+    signal(sig, SIG_DFL);
+    return;
+  }
+  /* popped here so a fault in the recovery path is not retried forever */
+  guard_current = self->prev;
+  siglongjmp(self->env, 1);
+}
+
+static void
+guard_install(void) {
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = guard_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGBUS, &sa, NULL);
+}
+
+void
+guard_push(struct guard *self) {
+  pthread_once(&guard_once, guard_install);
+  self->prev = guard_current;
+  guard_current = self;
+}
+
+void
+guard_pop(struct guard *self) {
+  if (guard_current == self) {
+    guard_current = self->prev;
+  }
+}
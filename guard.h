@@ -0,0 +1,39 @@
+#ifndef GUARD_H
+#define GUARD_H
+
+#include <setjmp.h>
+
+/* Reads of a mapping raise SIGBUS when another process truncated the
+ * file or the storage behind it failed the read, as NFS and FUSE mounts
+ * do. A guard turns that into an error of the file being read instead of
+ * killing the process: the innermost guard of the faulting thread resumes
+ * at its sigsetjmp() with a non zero return.
+ *
+ *   struct guard guard;
+ *
+ *   guard_push(&guard);
+ *   if (sigsetjmp(guard.env, 1) == 0) {
+ *     ... reads of the mapping ...
+ *   } else {
+ *     ... EIO ...
+ *   }
+ *   guard_pop(&guard);
+ *
+ * Locals written inside and read after a fault must be volatile or have
+ * their address taken. A SIGBUS outside of any guard keeps its default
+ * action.
+ */
+
+struct guard {
+  sigjmp_buf env;
+  struct guard *prev;
+};
+
+/* Installs the SIGBUS handler on first use */
+void
+guard_push(struct guard *self);
+
+void
+guard_pop(struct guard *self);
+
+#endif
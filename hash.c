@@ -0,0 +1,96 @@
+#include "hash.h"
+
+#include <string.h>
+
+static const uint64_t P1 = 11400714785074694791ULL;
+static const uint64_t P2 = 14029467366897019727ULL;
+static const uint64_t P3 = 1609587929392839161ULL;
+static const uint64_t P4 = 9650029242287828579ULL;
+static const uint64_t P5 = 2870177450012600261ULL;
+
+static inline uint64_t
+rotl64(uint64_t x, unsigned r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+ld64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t
+ld32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t
+round64(uint64_t acc, uint64_t input) {
+  acc += input * P2;
+  acc = rotl64(acc, 31);
+  return acc * P1;
+}
+
+static inline uint64_t
+merge64(uint64_t acc, uint64_t v) {
+  acc ^= round64(0, v);
+  return acc * P1 + P4;
+}
+
+uint64_t
+hash64(const void *buf, size_t length, uint64_t seed) {
+  const unsigned char *it = buf;
+  const unsigned char *const end = it + length;
+  uint64_t h;
+
+  if (length >= 32) {
+    const unsigned char *const limit = end - 32;
+    uint64_t v1 = seed + P1 + P2;
+    uint64_t v2 = seed + P2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - P1;
+
+    /* four independent lanes keep the multipliers busy */
+    do {
+      v1 = round64(v1, ld64(it));
+      v2 = round64(v2, ld64(it + 8));
+      v3 = round64(v3, ld64(it + 16));
+      v4 = round64(v4, ld64(it + 24));
+      it += 32;
+    } while (it <= limit);
+
+    h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = merge64(h, v1);
+    h = merge64(h, v2);
+    h = merge64(h, v3);
+    h = merge64(h, v4);
+  } else {
+    h = seed + P5;
+  }
+  h += (uint64_t)length;
+
+  for (; end - it >= 8; it += 8) {
+    h ^= round64(0, ld64(it));
+    h = rotl64(h, 27) * P1 + P4;
+  }
+  if (end - it >= 4) {
+    h ^= (uint64_t)ld32(it) * P1;
+    h = rotl64(h, 23) * P2 + P3;
+    it += 4;
+  }
+  for (; it < end; ++it) {
+    h ^= (*it) * P5;
+    h = rotl64(h, 11) * P1;
+  }
+
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+
+  return h;
+}
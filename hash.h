@@ -0,0 +1,18 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 64-bit non-cryptographic hash following the XXH64 construction */
+uint64_t
+hash64(const void *buf, size_t length, uint64_t seed);
+
+/* Order dependent combination of two hashes */
+static inline uint64_t
+hash64_combine(uint64_t h, uint64_t v) {
+  h ^= v + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+  return h;
+}
+
+#endif
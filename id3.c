@@ -0,0 +1,259 @@
+#include "id3.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ID3_HEADER 10
+#define ID3_FLAG_UNSYNC 0x80
+#define ID3_FLAG_EXTENDED 0x40
+
+static const struct {
+  char id[4];
+  enum tag_field field;
+} ID3_fields[] = {
+    {{'T', 'I', 'T', '2'}, TAG_TITLE},
+    {{'T', 'P', 'E', '1'}, TAG_ARTIST},
+    {{'T', 'P', 'E', '2'}, TAG_ALBUM_ARTIST},
+    {{'T', 'C', 'O', 'M'}, TAG_COMPOSER},
+    {{'T', 'A', 'L', 'B'}, TAG_ALBUM},
+    {{'T', 'R', 'C', 'K'}, TAG_TRACK},
+    {{'T', 'D', 'R', 'C'}, TAG_DATE},
+    {{'T', 'Y', 'E', 'R'}, TAG_DATE},
+    {{'T', 'C', 'O', 'N'}, TAG_GENRE},
+    {{'C', 'O', 'M', 'M'}, TAG_COMMENT},
+    {{'T', 'C', 'O', 'P'}, TAG_COPYRIGHT},
+    {{'T', 'S', 'S', 'E'}, TAG_SOFTWARE},
+};
+
+static uint32_t
+rd_be32(const u8 *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static uint32_t
+rd_syncsafe(const u8 *p) {
+  return ((uint32_t)(p[0] & 0x7F) << 21) | ((uint32_t)(p[1] & 0x7F) << 14) |
+         ((uint32_t)(p[2] & 0x7F) << 7) | (uint32_t)(p[3] & 0x7F);
+}
+
+/* Reverses unsynchronisation: every 0xFF 0x00 pair becomes 0xFF */
+static size_t
+unsync(u8 *dst, const u8 *src, size_t length) {
+  size_t i, n = 0;
+
+  for (i = 0; i < length; ++i) {
+    dst[n++] = src[i];
+    if (src[i] == 0xFF && i + 1 < length && src[i + 1] == 0x00) {
+      ++i;
+    }
+  }
+  return n;
+}
+
+static int
+is_frame_id(const u8 *id) {
+  size_t i;
+  for (i = 0; i < 4; ++i) {
+    if (!((id[i] >= 'A' && id[i] <= 'Z') || (id[i] >= '0' && id[i] <= '9'))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int
+id3_parse(const u8 *raw, size_t length, struct tags *tags, id3_frame_fn fn,
+          void *closure) {
+  const u8 *it, *end;
+  uint32_t size;
+  int major;
+  u8 flags;
+
+  if (length < ID3_HEADER || memcmp(raw, "ID3", 3) != 0) {
+    return -1;
+  }
+  major = raw[3];
+  if (major != 3 && major != 4) {
+    return -1;
+  }
+  flags = raw[5];
+  size = rd_syncsafe(raw + 6);
+  if ((size_t)size > length - ID3_HEADER) {
+    return -1;
+  }
+
+  it = raw + ID3_HEADER;
+  end = it + size;
+  /* v2.3 unsynchronises the whole tag, frame sizes are of the decoded tag */
+  if (major == 3 && (flags & ID3_FLAG_UNSYNC)) {
+    u8 *buf;
+    if (!(buf = tags_alloc(tags, size))) {
+      return -1;
+    }
+    end = buf + unsync(buf, it, size);
+    it = buf;
+  }
+
+  if (flags & ID3_FLAG_EXTENDED) {
+    uint32_t ext;
+    if (end - it < 4) {
+      return -1;
+    }
+    /* v2.3 excludes the size field itself, v2.4 does not */
+    ext = major == 3 ? rd_be32(it) + 4 : rd_syncsafe(it);
+    if ((size_t)ext > (size_t)(end - it)) {
+      return -1;
+    }
+    it += ext;
+  }
+
+  while (end - it >= ID3_HEADER && is_frame_id(it)) {
+    struct id3_frame frame;
+    const u8 *data = it + ID3_HEADER;
+    const u8 *next;
+    uint32_t fsize = major == 4 ? rd_syncsafe(it + 4) : rd_be32(it + 4);
+    u8 format = it[9];
+    int frame_unsync = 0;
+
+    if ((size_t)fsize > (size_t)(end - data)) {
+      return -1;
+    }
+    next = data + fsize;
+    memcpy(frame.id, it, sizeof(frame.id));
+    it = next;
+
+    if (major == 4) {
+      /* compressed or encrypted frames are not decoded */
+      if (format & 0x0C) {
+        continue;
+      }
+      if (format & 0x40) {
+        data += 1;
+      }
+      if (format & 0x01) {
+        data += 4;
+      }
+      frame_unsync = (format & 0x02) || (flags & ID3_FLAG_UNSYNC);
+    } else {
+      if (format & 0xC0) {
+        continue;
+      }
+      if (format & 0x20) {
+        data += 1;
+      }
+    }
+    if (data > next) {
+      continue;
+    }
+
+    frame.data = data;
+    frame.size = (size_t)(next - data);
+    if (frame_unsync) {
+      u8 *buf;
+      if (!(buf = tags_alloc(tags, frame.size))) {
+        return -1;
+      }
+      frame.size = unsync(buf, frame.data, frame.size);
+      frame.data = buf;
+    }
+    fn(closure, &frame);
+  }
+
+  return major;
+}
+
+/* Length of the string up to its encoding specific terminator */
+static size_t
+text_length(const u8 *it, size_t length, u8 encoding) {
+  size_t i;
+
+  if (encoding == 1 || encoding == 2) {
+    for (i = 0; i + 1 < length; i += 2) {
+      if (it[i] == 0 && it[i + 1] == 0) {
+        return i;
+      }
+    }
+    return length & ~(size_t)1;
+  }
+  for (i = 0; i < length; ++i) {
+    if (it[i] == 0) {
+      return i;
+    }
+  }
+  return length;
+}
+
+int
+id3_frame_text(const struct id3_frame *frame, struct tag_value *out) {
+  const u8 *it = frame->data;
+  const u8 *const end = frame->data + frame->size;
+  u8 encoding;
+
+  if (frame->size < 1) {
+    return EXIT_FAILURE;
+  }
+  encoding = *it++;
+  if (encoding > 3) {
+    return EXIT_FAILURE;
+  }
+
+  /* COMM: language[3], short description, the comment text */
+  if (memcmp(frame->id, "COMM", 4) == 0) {
+    size_t desc;
+    if (end - it < 3) {
+      return EXIT_FAILURE;
+    }
+    it += 3;
+    desc = text_length(it, (size_t)(end - it), encoding);
+    it += desc;
+    it += (encoding == 1 || encoding == 2) ? 2 : 1;
+    if (it > end) {
+      return EXIT_FAILURE;
+    }
+  } else if (frame->id[0] != 'T' || memcmp(frame->id, "TXXX", 4) == 0) {
+    return EXIT_FAILURE;
+  }
+
+  out->encoding = encoding == 0   ? TAG_LATIN1
+                  : encoding == 3 ? TAG_UTF8
+                                  : TAG_UTF16BE;
+  if (encoding == 1 && end - it >= 2) {
+    if (it[0] == 0xFF && it[1] == 0xFE) {
+      out->encoding = TAG_UTF16LE;
+      it += 2;
+    } else if (it[0] == 0xFE && it[1] == 0xFF) {
+      it += 2;
+    }
+  }
+
+  /* v2.4 separates multiple values with a terminator, keep the first */
+  out->ptr = it;
+  out->len = text_length(it, (size_t)(end - it), encoding);
+
+  return EXIT_SUCCESS;
+}
+
+static void
+id3_tags_frame(void *closure, const struct id3_frame *frame) {
+  struct tags *tags = closure;
+  size_t i;
+
+  for (i = 0; i < sizeof(ID3_fields) / sizeof(ID3_fields[0]); ++i) {
+    if (memcmp(frame->id, ID3_fields[i].id, 4) == 0) {
+      struct tag_value value;
+      if (id3_frame_text(frame, &value) == EXIT_SUCCESS) {
+        tags_set(tags, ID3_fields[i].field, &value);
+      }
+      break;
+    }
+  }
+}
+
+int
+id3_parse_tags(const u8 *raw, size_t length, struct tags *tags) {
+  if (id3_parse(raw, length, tags, id3_tags_frame, tags) < 0) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,35 @@
+#ifndef ID3_H
+#define ID3_H
+
+#include "tags.h"
+
+/* ID3v2.3 and ID3v2.4 tags as stored in 'id3 '/'ID3 ' WAVE chunks.
+ * https://id3.org/id3v2.3.0
+ * https://id3.org/id3v2.4.0-structure
+ */
+
+struct id3_frame {
+  char id[4];
+  /* frame content with unsynchronisation, grouping and data length
+   * indicator already removed */
+  const u8 *data;
+  size_t size;
+};
+
+typedef void (*id3_frame_fn)(void *closure, const struct id3_frame *frame);
+
+/* Calls fn for every frame of the tag, returns the major version (3 or 4)
+ * or -1 if raw is not a supported tag. Decoded buffers are owned by tags. */
+int
+id3_parse(const u8 *raw, size_t length, struct tags *tags, id3_frame_fn fn,
+          void *closure);
+
+/* Text content of a T??? or COMM frame */
+int
+id3_frame_text(const struct id3_frame *frame, struct tag_value *out);
+
+/* Merges the frames of a tag into tags */
+int
+id3_parse_tags(const u8 *raw, size_t length, struct tags *tags);
+
+#endif
@@ -0,0 +1,424 @@
+#define _GNU_SOURCE
+
+#include "input.h"
+#include "budget.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+/* statfs(2) f_type, the first entry stands for any other filesystem */
+static const struct input_fs {
+  unsigned long type;
+  const char *name;
+  enum input_strategy strategy;
+  /* bytes per pread(2), around the largest request the mount serves */
+  size_t readahead;
+} input_fs[] = {
+    {0, "other", INPUT_MMAP, INPUT_READ_SIZE},
+    {0xEF53, "ext4", INPUT_MMAP, INPUT_READ_SIZE},
+    {0x58465342, "xfs", INPUT_MMAP, INPUT_READ_SIZE},
+    {0x9123683E, "btrfs", INPUT_MMAP, INPUT_READ_SIZE},
+    {0xF2F52010, "f2fs", INPUT_MMAP, INPUT_READ_SIZE},
+    {0x01021994, "tmpfs", INPUT_MMAP, INPUT_READ_SIZE},
+    {0x794C7630, "overlayfs", INPUT_MMAP, INPUT_READ_SIZE},
+    {0x6969, "nfs", INPUT_PREAD, 1024 * 1024},
+    {0xFF534D42, "cifs", INPUT_PREAD, 4 * 1024 * 1024},
+    {0xFE534D42, "smb2", INPUT_PREAD, 4 * 1024 * 1024},
+    {0x00C36400, "ceph", INPUT_PREAD, 4 * 1024 * 1024},
+    {0x65735546, "fuse", INPUT_PREAD, 1024 * 1024},
+};
+
+#define INPUT_FS (sizeof(input_fs) / sizeof(input_fs[0]))
+
+struct input_stats {
+  uint64_t files;
+  uint64_t bytes;
+  uint64_t open_ns;
+  uint64_t read_ns;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  enum input_strategy strategy;
+  struct {
+    dev_t dev;
+    unsigned fs;
+  } mount[INPUT_MOUNTS];
+  unsigned mounts;
+  struct input_stats stats[INPUT_FS][INPUT_DIRECT + 1];
+} inputs = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+int
+input_fd(const char *path, int flags) {
+  int fd;
+  /* O_NOATIME is only permitted for the owner of the file */
+  if ((fd = open(path, flags | O_NOATIME)) < 0 && errno == EPERM) {
+    fd = open(path, flags);
+  }
+  return fd;
+}
+
+const char *
+input_strategy_str(enum input_strategy strategy) {
+  switch (strategy) {
+  case INPUT_AUTO:
+    return "auto";
+  case INPUT_MMAP:
+    return "mmap";
+  case INPUT_PREAD:
+    return "pread";
+  case INPUT_DIRECT:
+    return "direct";
+  }
+  return "unknown";
+}
+
+void
+input_set_strategy(enum input_strategy strategy) {
+  inputs.strategy = strategy;
+}
+
+/* The input_fs entry of the mount holding the file, cached by device */
+static unsigned
+input_mount_fs(int fd, const struct stat *st) {
+  struct statfs fs;
+  unsigned i, res = 0;
+
+  pthread_mutex_lock(&inputs.lock);
+  for (i = 0; i < inputs.mounts; ++i) {
+    if (inputs.mount[i].dev == st->st_dev) {
+      res = inputs.mount[i].fs;
+      pthread_mutex_unlock(&inputs.lock);
+      return res;
+    }
+  }
+  if (fstatfs(fd, &fs) == 0) {
+    for (i = 1; i < INPUT_FS; ++i) {
+      if ((unsigned long)fs.f_type == input_fs[i].type) {
+        res = i;
+        break;
+      }
+    }
+    if (inputs.mounts < INPUT_MOUNTS) {
+      inputs.mount[inputs.mounts].dev = st->st_dev;
+      inputs.mount[inputs.mounts].fs = res;
+      ++inputs.mounts;
+    }
+  }
+  pthread_mutex_unlock(&inputs.lock);
+  return res;
+}
+
+/* Opens a regular file, self->length is its size */
+static int
+input_begin(struct input *self, const char *path, int flags,
+            struct stat *st) {
+  self->raw = NULL;
+  self->length = 0;
+  self->strategy = INPUT_MMAP;
+  self->charged = 0;
+  self->capacity = 0;
+  self->window_read = 0;
+  self->fs = 0;
+  self->read_ns = 0;
+  self->opened = 0;
+  if ((self->fd = input_fd(path, O_RDONLY | flags)) < 0) {
+    return errno;
+  }
+  if (fstat(self->fd, st) < 0) {
+    goto Lerr;
+  }
+  if (!S_ISREG(st->st_mode)) {
+    errno = EINVAL;
+    goto Lerr;
+  }
+  self->fs = input_mount_fs(self->fd, st);
+  self->length = (size_t)st->st_size;
+  return 0;
+
+Lerr:
+  close(self->fd);
+  self->fd = -1;
+  return errno;
+}
+
+static int
+input_map(struct input *self) {
+  void *raw;
+
+  if ((raw = mmap(NULL, self->length, PROT_READ, MAP_SHARED, self->fd,
+                  0)) == MAP_FAILED) {
+    return errno;
+  }
+  self->raw = raw;
+  return 0;
+}
+
+/* Reads the whole file into page aligned anonymous memory, as O_DIRECT
+ * needs, with requests of size bytes. A file that shrank meanwhile is
+ * cut to what could be read. */
+static int
+input_read(struct input *self, size_t size) {
+  const size_t capacity = (self->length + 4095) & ~(size_t)4095;
+  uint64_t start;
+  size_t done = 0;
+  u8 *raw;
+  int err;
+
+  budget_acquire(capacity);
+  if ((raw = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+    err = errno;
+    budget_release(capacity);
+    return err;
+  }
+  start = metrics_now();
+  posix_fadvise(self->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  while (done < self->length) {
+    size_t n = capacity - done < size ? capacity - done : size;
+    ssize_t r = pread(self->fd, raw + done, n, (off_t)done);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r < 0) {
+      err = errno;
+      munmap(raw, capacity);
+      budget_release(capacity);
+      return err;
+    }
+    if (r == 0) {
+      break;
+    }
+    done += (size_t)r;
+  }
+  self->read_ns = metrics_now() - start;
+  self->raw = raw;
+  self->length = done < self->length ? done : self->length;
+  self->charged = capacity;
+  self->capacity = capacity;
+  return 0;
+}
+
+/* Reads the whole pages of [begin, end) into the anonymous memory of a
+ * file read window by window, with requests of size bytes */
+static int
+input_fill(struct input *self, size_t begin, size_t end, size_t size) {
+  u8 *raw = (u8 *)(uintptr_t)self->raw;
+  uint64_t start = metrics_now();
+  size_t limit;
+  int err = 0;
+
+  end = end < self->length ? end : self->length;
+  limit = (end + 4095) & ~(size_t)4095;
+  begin &= ~(size_t)4095;
+  while (begin < end) {
+    size_t n = limit - begin < size ? limit - begin : size;
+    ssize_t r = pread(self->fd, raw + begin, n, (off_t)begin);
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      /* the file shrank since it was opened */
+      err = r < 0 ? errno : EIO;
+      break;
+    }
+    begin += (size_t)r;
+  }
+  self->read_ns += metrics_now() - start;
+  return err;
+}
+
+/* Anonymous memory for the whole file, holding what a parse touches */
+static int
+input_reserve(struct input *self, size_t size) {
+  const size_t capacity = (self->length + 4095) & ~(size_t)4095;
+  struct riff_iter iter;
+  struct riff_chunk chunk;
+  char form[4];
+  void *raw;
+  size_t at;
+  int err;
+
+  if ((raw = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) ==
+      MAP_FAILED) {
+    return errno;
+  }
+  self->raw = raw;
+  self->capacity = capacity;
+  self->window_read = size;
+  if ((err = input_fill(self, 0, 12, size)) == 0 &&
+      riff_iter_init(&iter, self->raw, self->length, form) == EXIT_SUCCESS) {
+    while (err == 0 && iter.it != iter.end) {
+      at = (size_t)(iter.it - self->raw);
+      if ((err = input_fill(self, at, at + 8, size)) != 0 ||
+          riff_iter_next(&iter, &chunk) <= 0) {
+        break;
+      }
+      if (memcmp(chunk.id, "data", 4) != 0) {
+        err = input_fill(self, at + 8, at + 8 + chunk.size, size);
+      }
+    }
+  }
+  if (err != 0) {
+    munmap(raw, capacity);
+    self->raw = NULL;
+    self->capacity = 0;
+    self->window_read = 0;
+  }
+  return err;
+}
+
+int
+input_open(struct input *self, const char *path) {
+  struct stat st;
+  int err;
+
+  if ((err = input_begin(self, path, 0, &st)) != 0) {
+    return err;
+  }
+  if (self->length > 0 && (err = input_map(self)) != 0) {
+    close(self->fd);
+    self->fd = -1;
+  }
+  return err;
+}
+
+int
+input_open_scan(struct input *self, const char *path) {
+  struct stat st;
+  size_t size;
+  int fd;
+  int err;
+
+  if ((err = input_begin(self, path, 0, &st)) != 0) {
+    return err;
+  }
+  self->opened = metrics_now();
+  self->strategy = inputs.strategy != INPUT_AUTO
+                       ? inputs.strategy
+                       : input_fs[self->fs].strategy;
+  if (self->length == 0) {
+    return 0;
+  }
+  if (self->strategy == INPUT_DIRECT) {
+    /* not every filesystem takes O_DIRECT, tmpfs for one */
+    if ((fd = input_fd(path, O_RDONLY | O_DIRECT)) >= 0) {
+      close(self->fd);
+      self->fd = fd;
+    } else {
+      self->strategy = INPUT_PREAD;
+    }
+  }
+  switch (self->strategy) {
+  case INPUT_PREAD:
+  case INPUT_DIRECT:
+    size = self->strategy == INPUT_PREAD ? input_fs[self->fs].readahead
+                                         : INPUT_READ_SIZE;
+    /* a pass windows larger files under the budget, as it does mappings */
+    err = self->length > BUDGET_WINDOW ? input_reserve(self, size)
+                                       : input_read(self, size);
+    break;
+  default:
+    err = input_map(self);
+    break;
+  }
+  if (err != 0) {
+    close(self->fd);
+    self->fd = -1;
+  }
+  return err;
+}
+
+int
+input_window_at(struct input *self, struct budget_window *window,
+                size_t offset, size_t need) {
+  const size_t begin = window->begin, end = window->end;
+
+  if (self->strategy != INPUT_MMAP && !self->window_read) {
+    return 0;
+  }
+  budget_window_at(window, offset, need);
+  if (!self->window_read ||
+      (window->begin == begin && window->end == end)) {
+    return 0;
+  }
+  /* what is left of the previous window is still in memory */
+  return input_fill(self,
+                    window->begin >= begin && window->begin < end
+                        ? end
+                        : window->begin,
+                    window->end, self->window_read);
+}
+
+void
+input_close(struct input *self) {
+  /* only scans are counted, mappings live as long as their users */
+  if (self->fd >= 0 && self->opened != 0) {
+    struct input_stats *stats = &inputs.stats[self->fs][self->strategy];
+    uint64_t now = metrics_now();
+
+    pthread_mutex_lock(&inputs.lock);
+    ++stats->files;
+    stats->bytes += self->length;
+    stats->open_ns += now - self->opened;
+    stats->read_ns += self->read_ns;
+    pthread_mutex_unlock(&inputs.lock);
+  }
+  if (self->raw) {
+    munmap((void *)(uintptr_t)self->raw,
+           self->capacity ? self->capacity : self->length);
+    self->raw = NULL;
+  }
+  budget_release(self->charged);
+  self->charged = 0;
+  self->capacity = 0;
+  self->window_read = 0;
+  if (self->fd >= 0) {
+    close(self->fd);
+    self->fd = -1;
+  }
+}
+
+void
+input_stats_fput(FILE *f) {
+  unsigned fs, s;
+
+  pthread_mutex_lock(&inputs.lock);
+  for (fs = 0; fs < INPUT_FS; ++fs) {
+    for (s = INPUT_MMAP; s <= INPUT_DIRECT; ++s) {
+      const struct input_stats *stats = &inputs.stats[fs][s];
+      double seconds = (double)stats->open_ns * 1e-9;
+
+      if (stats->files == 0) {
+        continue;
+      }
+      fprintf(f, "IO[filesystem: %s, strategy: %s", input_fs[fs].name,
+              input_strategy_str((enum input_strategy)s));
+      if (s == INPUT_PREAD) {
+        fprintf(f, ", readahead: %zu", input_fs[fs].readahead);
+      }
+      fprintf(f,
+              ", files: %" PRIu64 ", bytes: %" PRIu64
+              ", seconds: %.3f, MBps: %.1f",
+              stats->files, stats->bytes, seconds,
+              seconds > 0 ? (double)stats->bytes / seconds / 1e6 : 0.0);
+      if (stats->read_ns > 0) {
+        fprintf(f, ", ReadMBps: %.1f",
+                (double)stats->bytes / ((double)stats->read_ns * 1e-9) /
+                    1e6);
+      }
+      fprintf(f, "]\n");
+    }
+  }
+  pthread_mutex_unlock(&inputs.lock);
+}
@@ -0,0 +1,88 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "budget.h"
+#include "riff.h"
+
+#include <stdio.h>
+
+/* How a file is brought into memory. Local disk filesystems are mapped,
+ * pages are read on demand and shared with the page cache. Network and
+ * FUSE mounts fault pages in one small readahead at a time and raise
+ * SIGBUS on errors, so files scanned whole are read into memory with
+ * large pread(2) calls there instead. O_DIRECT reads bypass the page cache
+ * and are only used when asked for. */
+enum input_strategy {
+  INPUT_AUTO,
+  INPUT_MMAP,
+  INPUT_PREAD,
+  INPUT_DIRECT,
+};
+
+/* request size of O_DIRECT reads and of pread on unknown filesystems */
+#define INPUT_READ_SIZE (1024 * 1024)
+/* filesystems cached by device */
+#define INPUT_MOUNTS 64
+
+/* A read only view of a whole file */
+struct input {
+  int fd;
+  /* NULL for an empty file */
+  const u8 *raw;
+  size_t length;
+  enum input_strategy strategy;
+  /* bytes of the memory budget held while open */
+  uint64_t charged;
+  /* of the anonymous memory a file is read into, 0 when mapped */
+  size_t capacity;
+  /* request size of a file read window by window, 0 when mapped or read
+   * whole */
+  size_t window_read;
+  /* for --stats */
+  unsigned fs;
+  uint64_t opened;
+  uint64_t read_ns;
+};
+
+/* open(2) with O_NOATIME when permitted */
+int
+input_fd(const char *path, int flags);
+
+/* A mapping of the whole file, for access to parts of it. Returns 0 or an
+ * errno value. */
+int
+input_open(struct input *self, const char *path);
+
+/* For a pass over the whole file, read with the strategy of its
+ * filesystem or the one set with input_set_strategy(). Files read into
+ * memory are charged to the memory budget until closed. Those larger than
+ * BUDGET_WINDOW are read window by window instead: only the first page
+ * and the RIFF chunks other than 'data' are read when opened, uncharged
+ * like the pages a parse faults into a mapping. */
+int
+input_open_scan(struct input *self, const char *path);
+
+/* budget_window_at() for an input of input_open_scan(), reading the
+ * window of a file read window by window. A pass calls it before each
+ * part it touches, it does nothing for a file read whole. Returns 0 or
+ * an errno value, EIO when the file shrank. */
+int
+input_window_at(struct input *self, struct budget_window *window,
+                size_t offset, size_t need);
+
+void
+input_close(struct input *self);
+
+const char *
+input_strategy_str(enum input_strategy strategy);
+
+/* Overrides the choice of input_open_scan(), INPUT_AUTO by default */
+void
+input_set_strategy(enum input_strategy strategy);
+
+/* One line per filesystem and strategy used: files, bytes and the
+ * throughput over the time files were open and spent reading */
+void
+input_stats_fput(FILE *f);
+
+#endif
@@ -0,0 +1,301 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct metrics_slot {
+  _Alignas(64) uint64_t value[METRICS];
+};
+
+static const struct {
+  const char *name;
+  const char *label;
+  const char *type;
+  const char *help;
+  /* of the exported value, nanoseconds are exported as seconds */
+  double scale;
+} metric_info[METRICS] = {
+    {"riff_files_total", NULL, "counter", "Files scanned", 1},
+    {"riff_bytes_total", NULL, "counter", "Payload bytes chunked", 1},
+    {"riff_phase_seconds_total", "phase=\"open\"", "counter",
+     "Time spent per phase of a scan", 1e-9},
+    {"riff_phase_seconds_total", "phase=\"parse\"", "counter", NULL, 1e-9},
+    {"riff_phase_seconds_total", "phase=\"chunk\"", "counter", NULL, 1e-9},
+    {"riff_queued_total", NULL, "counter", "Work items queued to workers", 1},
+    {"riff_dequeued_total", NULL, "counter",
+     "Work items claimed by workers", 1},
+    {"riff_errors_total", "kind=\"open\"", "counter", "Errors by kind", 1},
+    {"riff_errors_total", "kind=\"memory\"", "counter", NULL, 1},
+    {"riff_errors_total", "kind=\"bus\"", "counter", NULL, 1},
+    {"riff_errors_total", "kind=\"request\"", "counter", NULL, 1},
+    {"riff_errors_total", "kind=\"file\"", "counter", NULL, 1},
+    {"riff_errors_total", "kind=\"send\"", "counter", NULL, 1},
+    {"riff_cache_hits_total", NULL, "counter", "Parsed file cache hits", 1},
+    {"riff_cache_misses_total", NULL, "counter", "Parsed file cache misses",
+     1},
+    {"riff_requests_total", NULL, "counter", "Daemon requests", 1},
+    {"riff_sent_bytes_total", NULL, "counter", "Daemon response bytes", 1},
+    {"riff_connections_opened_total", NULL, "counter",
+     "Daemon connections accepted", 1},
+    {"riff_connections_closed_total", NULL, "counter",
+     "Daemon connections closed", 1},
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_once_t once;
+  pthread_key_t key;
+  uint64_t start;
+  struct metrics_slot slot[METRICS_SLOTS];
+  unsigned char used[METRICS_SLOTS];
+  /* of the threads without a slot, added to atomically */
+  struct metrics_slot shared;
+  /* of the exited threads */
+  uint64_t retired[METRICS];
+} metrics = {.lock = PTHREAD_MUTEX_INITIALIZER, .once = PTHREAD_ONCE_INIT};
+
+static _Thread_local struct metrics_slot *metrics_local;
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t thread;
+  const char *path;
+  int started;
+  int stop;
+} writer = {.lock = PTHREAD_MUTEX_INITIALIZER,
+            .wake = PTHREAD_COND_INITIALIZER};
+
+uint64_t
+metrics_now(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/* pthread key destructor, on exit of a thread with a slot */
+static void
+metrics_retire(void *arg) {
+  struct metrics_slot *slot = arg;
+  unsigned m;
+
+  pthread_mutex_lock(&metrics.lock);
+  for (m = 0; m < METRICS; ++m) {
+    metrics.retired[m] += slot->value[m];
+    slot->value[m] = 0;
+  }
+  metrics.used[slot - metrics.slot] = 0;
+  pthread_mutex_unlock(&metrics.lock);
+}
+
+static void
+metrics_once(void) {
+  pthread_key_create(&metrics.key, metrics_retire);
+  metrics.start = metrics_now();
+}
+
+void
+metrics_init(void) {
+  pthread_once(&metrics.once, metrics_once);
+}
+
+static struct metrics_slot *
+metrics_claim(void) {
+  unsigned i;
+
+  metrics_init();
+  pthread_mutex_lock(&metrics.lock);
+  for (i = 0; i < METRICS_SLOTS && metrics.used[i]; ++i) {
+  }
+  if (i < METRICS_SLOTS) {
+    metrics.used[i] = 1;
+    metrics_local = &metrics.slot[i];
+  } else {
+    metrics_local = &metrics.shared;
+  }
+  pthread_mutex_unlock(&metrics.lock);
+  if (metrics_local != &metrics.shared) {
+    pthread_setspecific(metrics.key, metrics_local);
+  }
+  return metrics_local;
+}
+
+void
+metric_add(enum metric m, uint64_t n) {
+  struct metrics_slot *slot = metrics_local;
+
+  if (!slot) {
+    slot = metrics_claim();
+  }
+  if (slot == &metrics.shared) {
+    __atomic_fetch_add(&slot->value[m], n, __ATOMIC_RELAXED);
+  } else {
+    /* the owner is the only writer, readers need untorn values only */
+    __atomic_store_n(&slot->value[m],
+                     __atomic_load_n(&slot->value[m], __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+  }
+}
+
+static void
+metrics_sum(uint64_t *total) {
+  unsigned i, m;
+
+  metrics_init();
+  pthread_mutex_lock(&metrics.lock);
+  for (m = 0; m < METRICS; ++m) {
+    total[m] = metrics.retired[m] +
+               __atomic_load_n(&metrics.shared.value[m], __ATOMIC_RELAXED);
+  }
+  for (i = 0; i < METRICS_SLOTS; ++i) {
+    if (metrics.used[i]) {
+      for (m = 0; m < METRICS; ++m) {
+        total[m] +=
+            __atomic_load_n(&metrics.slot[i].value[m], __ATOMIC_RELAXED);
+      }
+    }
+  }
+  pthread_mutex_unlock(&metrics.lock);
+}
+
+static void
+metrics_gauge(FILE *f, const char *name, const char *help, double value) {
+  fprintf(f, "# HELP %s %s\n# TYPE %s gauge\n%s %.15g\n", name, help, name,
+          name, value);
+}
+
+int
+metrics_write(FILE *f) {
+  uint64_t total[METRICS];
+  double uptime;
+  unsigned m;
+
+  metrics_sum(total);
+  uptime = (double)(metrics_now() - metrics.start) * 1e-9;
+
+  for (m = 0; m < METRICS; ++m) {
+    if (metric_info[m].help) {
+      fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", metric_info[m].name,
+              metric_info[m].help, metric_info[m].name, metric_info[m].type);
+    }
+    if (metric_info[m].label) {
+      fprintf(f, "%s{%s} %.15g\n", metric_info[m].name,
+              metric_info[m].label, (double)total[m] * metric_info[m].scale);
+    } else {
+      fprintf(f, "%s %.15g\n", metric_info[m].name,
+              (double)total[m] * metric_info[m].scale);
+    }
+  }
+
+  /* derived, for readers without a query language on top */
+  metrics_gauge(f, "riff_uptime_seconds", "Seconds since start",
+                uptime);
+  metrics_gauge(f, "riff_files_per_second", "Files scanned per second",
+                uptime > 0 ? (double)total[METRIC_FILES] / uptime : 0);
+  metrics_gauge(f, "riff_bytes_per_second", "Payload bytes per second",
+                uptime > 0 ? (double)total[METRIC_BYTES] / uptime : 0);
+  metrics_gauge(f, "riff_queue_depth", "Work items not yet claimed",
+                (double)(total[METRIC_QUEUED] - total[METRIC_DEQUEUED]));
+  metrics_gauge(f, "riff_connections", "Open daemon connections",
+                (double)(total[METRIC_CONNECTIONS_OPENED] -
+                         total[METRIC_CONNECTIONS_CLOSED]));
+  metrics_gauge(f, "riff_cache_hit_ratio", "Parsed file cache hit ratio",
+                total[METRIC_CACHE_HITS] + total[METRIC_CACHE_MISSES]
+                    ? (double)total[METRIC_CACHE_HITS] /
+                          (double)(total[METRIC_CACHE_HITS] +
+                                   total[METRIC_CACHE_MISSES])
+                    : 0);
+
+  return ferror(f) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Written to path.tmp and renamed, scrapers never see a partial file */
+static int
+metrics_file_write(const char *path) {
+  char *tmp;
+  FILE *f;
+  int res = EXIT_FAILURE;
+
+  if (!(tmp = malloc(strlen(path) + sizeof(".tmp")))) {
+    return res;
+  }
+  sprintf(tmp, "%s.tmp", path);
+  if (!(f = fopen(tmp, "w"))) {
+    fprintf(stderr, "fopen(%s): %s\n", tmp, strerror(errno));
+    goto Lfree;
+  }
+  metrics_write(f);
+  if (fflush(f) != 0 || ferror(f)) {
+    fprintf(stderr, "write(%s): %s\n", tmp, strerror(errno));
+    fclose(f);
+    unlink(tmp);
+    goto Lfree;
+  }
+  fclose(f);
+  if (rename(tmp, path) < 0) {
+    fprintf(stderr, "rename(%s): %s\n", path, strerror(errno));
+    unlink(tmp);
+    goto Lfree;
+  }
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(tmp);
+  return res;
+}
+
+static void *
+metrics_writer(void *arg) {
+  struct timespec deadline;
+  (void)arg;
+
+  pthread_mutex_lock(&writer.lock);
+  while (!writer.stop) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += METRICS_INTERVAL;
+    while (!writer.stop &&
+           pthread_cond_timedwait(&writer.wake, &writer.lock, &deadline) !=
+               ETIMEDOUT) {
+    }
+    pthread_mutex_unlock(&writer.lock);
+    metrics_file_write(writer.path);
+    pthread_mutex_lock(&writer.lock);
+  }
+  pthread_mutex_unlock(&writer.lock);
+  return NULL;
+}
+
+int
+metrics_file_start(const char *path) {
+  int err;
+
+  writer.path = path;
+  if (metrics_file_write(path) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  if ((err = pthread_create(&writer.thread, NULL, metrics_writer, NULL)) !=
+      0) {
+    fprintf(stderr, "pthread_create(): %s\n", strerror(err));
+    return EXIT_FAILURE;
+  }
+  writer.started = 1;
+  return EXIT_SUCCESS;
+}
+
+void
+metrics_file_stop(void) {
+  if (!writer.started) {
+    return;
+  }
+  pthread_mutex_lock(&writer.lock);
+  writer.stop = 1;
+  pthread_cond_signal(&writer.wake);
+  pthread_mutex_unlock(&writer.lock);
+  pthread_join(writer.thread, NULL);
+  writer.started = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Live counters of long running scans and the daemon. Every thread adds
+ * to a cache line aligned slot of its own, readers sum the slots, so the
+ * hot path never writes a line another thread writes. Slots of exited
+ * threads are folded into the totals and reused.
+ *
+ * The totals and the rates derived from them are exported in the
+ * Prometheus text format, to a file rewritten atomically every
+ * METRICS_INTERVAL seconds or by the METRICS request of the daemon.
+ */
+
+/* threads with a slot of their own, more share an atomic one */
+#define METRICS_SLOTS 256
+/* seconds between rewrites of the metrics file */
+#define METRICS_INTERVAL 5
+
+/* entries with the same name are exported as one labelled family */
+enum metric {
+  METRIC_FILES,
+  METRIC_BYTES,
+  METRIC_PHASE_OPEN,
+  METRIC_PHASE_PARSE,
+  METRIC_PHASE_CHUNK,
+  METRIC_QUEUED,
+  METRIC_DEQUEUED,
+  METRIC_ERRORS_OPEN,
+  METRIC_ERRORS_MEMORY,
+  METRIC_ERRORS_BUS,
+  METRIC_ERRORS_REQUEST,
+  METRIC_ERRORS_FILE,
+  METRIC_ERRORS_SEND,
+  METRIC_CACHE_HITS,
+  METRIC_CACHE_MISSES,
+  METRIC_REQUESTS,
+  METRIC_SENT_BYTES,
+  METRIC_CONNECTIONS_OPENED,
+  METRIC_CONNECTIONS_CLOSED,
+  METRICS,
+};
+
+/* Starts the clock of the rates, otherwise started by the first metric */
+void
+metrics_init(void);
+
+void
+metric_add(enum metric m, uint64_t n);
+
+/* CLOCK_MONOTONIC in nanoseconds, for the METRIC_PHASE_ counters */
+uint64_t
+metrics_now(void);
+
+/* The current totals in the Prometheus text format */
+int
+metrics_write(FILE *f);
+
+/* Rewrites path every METRICS_INTERVAL seconds from a thread of its own
+ * until metrics_file_stop(), which writes it a last time */
+int
+metrics_file_start(const char *path);
+
+void
+metrics_file_stop(void);
+
+#endif
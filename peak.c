@@ -0,0 +1,375 @@
+#include "peak.h"
+#include "sample.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* levl header following ckID/ckSize: 8 DWORD, strTimestamp[28],
+ * reserved[60]. dwOffsetToPeaks is counted from ckID. */
+#define LEVL_HEADER 120
+#define LEVL_BLOCK_SIZE 256
+
+const char *
+peak_source_str(enum peak_source source) {
+  switch (source) {
+  case PEAK_SOURCE_PEAK:
+    return "PEAK";
+  case PEAK_SOURCE_LEVL:
+    return "levl";
+  case PEAK_SOURCE_DATA:
+    return "data";
+  }
+  return "";
+}
+
+int
+peak_levl_parse(const struct riff_wave *wave, struct peak_levl *out) {
+  const u8 *it = wave->levl.data;
+  uint32_t offset;
+  uint64_t expected;
+  uint64_t bytes;
+
+  if (!it || wave->levl.size < LEVL_HEADER) {
+    return EXIT_FAILURE;
+  }
+  if (rd_le32(it) != 1) {
+    return EXIT_FAILURE;
+  }
+  out->format = rd_le32(it + 4);
+  out->points_per_value = rd_le32(it + 8);
+  out->block_size = rd_le32(it + 12);
+  out->channels = rd_le32(it + 16);
+  out->frames = rd_le32(it + 20);
+  out->pos_peak_of_peaks = rd_le32(it + 24);
+  offset = rd_le32(it + 28);
+
+  if (out->format != 1 && out->format != 2) {
+    return EXIT_FAILURE;
+  }
+  if (out->points_per_value != 1 && out->points_per_value != 2) {
+    return EXIT_FAILURE;
+  }
+  if (out->block_size == 0 || out->channels != wave->fmt.NumChannels) {
+    return EXIT_FAILURE;
+  }
+  /* a stale envelope written before the payload was edited is ignored */
+  expected = (riff_wave_frames(wave) + out->block_size - 1) / out->block_size;
+  if ((uint64_t)out->frames != expected) {
+    return EXIT_FAILURE;
+  }
+  if (offset < LEVL_HEADER + 8 || offset - 8 > wave->levl.size) {
+    return EXIT_FAILURE;
+  }
+  bytes = (uint64_t)out->frames * out->channels * out->points_per_value *
+          out->format;
+  if (bytes > (uint64_t)(wave->levl.size - (offset - 8))) {
+    return EXIT_FAILURE;
+  }
+  out->peaks = it + (offset - 8);
+
+  return EXIT_SUCCESS;
+}
+
+static float
+levl_point(const struct peak_levl *levl, uint64_t frame, uint32_t channel,
+           uint32_t point) {
+  uint64_t idx =
+      (frame * levl->channels + channel) * levl->points_per_value + point;
+
+  if (levl->format == 1) {
+    return (float)levl->peaks[idx] / 127.0f;
+  }
+  return (float)rd_le16(levl->peaks + idx * 2) / 32767.0f;
+}
+
+/* Per channel maximum positive and negative magnitude over [first, last) */
+static void
+scan_data(const struct riff_wave *wave, enum sample_kind kind,
+          uint64_t first, uint64_t last, float *pos, float *neg,
+          uint64_t *peak_frame) {
+  const uint32_t channels = wave->fmt.NumChannels;
+  const unsigned width = sample_bytes(kind);
+  const u8 *it = wave->data.data + first * wave->fmt.BlockAlign;
+  double best = -1.0;
+  uint64_t frame;
+  uint32_t c;
+
+  for (c = 0; c < channels; ++c) {
+    pos[c] = 0.0f;
+    neg[c] = 0.0f;
+  }
+
+  for (frame = first; frame < last; ++frame) {
+    for (c = 0; c < channels; ++c) {
+      double v = sample_load(it + c * width, kind);
+      if (v > (double)pos[c]) {
+        pos[c] = (float)v;
+      } else if (-v > (double)neg[c]) {
+        neg[c] = (float)-v;
+      }
+      if (peak_frame && (v > best || -v > best)) {
+        best = v < 0 ? -v : v;
+        *peak_frame = frame;
+      }
+    }
+    it += wave->fmt.BlockAlign;
+  }
+}
+
+int
+peak_channels(const struct riff_wave *wave, float *out,
+              enum peak_source *source) {
+  const uint32_t channels = wave->fmt.NumChannels;
+  struct peak_levl levl;
+  enum sample_kind kind;
+  float *neg;
+  uint32_t c;
+
+  /* PEAK: dwVersion, dwTimeStamp, {float value, DWORD position}[channels] */
+  if (wave->peak.data && wave->peak.size == 8 + 8 * channels &&
+      rd_le32(wave->peak.data) == 1) {
+    for (c = 0; c < channels; ++c) {
+      uint32_t bits = rd_le32(wave->peak.data + 8 + c * 8);
+      memcpy(&out[c], &bits, sizeof(out[c]));
+    }
+    *source = PEAK_SOURCE_PEAK;
+    return EXIT_SUCCESS;
+  }
+
+  if (peak_levl_parse(wave, &levl) == EXIT_SUCCESS) {
+    uint64_t frame;
+    uint32_t p;
+
+    for (c = 0; c < channels; ++c) {
+      out[c] = 0.0f;
+    }
+    for (frame = 0; frame < levl.frames; ++frame) {
+      for (c = 0; c < channels; ++c) {
+        for (p = 0; p < levl.points_per_value; ++p) {
+          float v = levl_point(&levl, frame, c, p);
+          if (v > out[c]) {
+            out[c] = v;
+          }
+        }
+      }
+    }
+    *source = PEAK_SOURCE_LEVL;
+    return EXIT_SUCCESS;
+  }
+
+  if ((kind = sample_kind(&wave->fmt)) == SAMPLE_UNSUPPORTED) {
+    return EXIT_FAILURE;
+  }
+  if (!(neg = calloc(channels, sizeof(*neg)))) {
+    return EXIT_FAILURE;
+  }
+  scan_data(wave, kind, 0, riff_wave_frames(wave), out, neg, NULL);
+  for (c = 0; c < channels; ++c) {
+    if (neg[c] > out[c]) {
+      out[c] = neg[c];
+    }
+  }
+  free(neg);
+  *source = PEAK_SOURCE_DATA;
+
+  return EXIT_SUCCESS;
+}
+
+int
+peak_overview(const struct riff_wave *wave, uint32_t buckets,
+              struct peak_overview *out, enum peak_source *source) {
+  const uint32_t channels = wave->fmt.NumChannels;
+  struct peak_levl levl;
+  enum sample_kind kind = SAMPLE_UNSUPPORTED;
+  int have_levl;
+  uint64_t total;
+  uint32_t b;
+
+  if (buckets == 0) {
+    return EXIT_FAILURE;
+  }
+  have_levl = peak_levl_parse(wave, &levl) == EXIT_SUCCESS;
+  if (!have_levl && (kind = sample_kind(&wave->fmt)) == SAMPLE_UNSUPPORTED) {
+    return EXIT_FAILURE;
+  }
+
+  out->channels = channels;
+  out->buckets = buckets;
+  out->pos = calloc((size_t)buckets * channels, sizeof(*out->pos));
+  out->neg = calloc((size_t)buckets * channels, sizeof(*out->neg));
+  if (!out->pos || !out->neg) {
+    peak_overview_free(out);
+    return EXIT_FAILURE;
+  }
+
+  total = have_levl ? levl.frames : riff_wave_frames(wave);
+  for (b = 0; b < buckets; ++b) {
+    float *pos = out->pos + (size_t)b * channels;
+    float *neg = out->neg + (size_t)b * channels;
+    uint64_t first = (uint64_t)b * total / buckets;
+    uint64_t last = (uint64_t)(b + 1) * total / buckets;
+
+    if (!have_levl) {
+      scan_data(wave, kind, first, last, pos, neg, NULL);
+      continue;
+    }
+
+    /* more buckets than peak frames: repeat the covering peak frame */
+    if (last <= first && first < total) {
+      last = first + 1;
+    }
+    for (; first < last; ++first) {
+      uint32_t c;
+      for (c = 0; c < channels; ++c) {
+        float p = levl_point(&levl, first, c, 0);
+        float n = levl.points_per_value == 2 ? levl_point(&levl, first, c, 1)
+                                             : p;
+        if (p > pos[c]) {
+          pos[c] = p;
+        }
+        if (n > neg[c]) {
+          neg[c] = n;
+        }
+      }
+    }
+  }
+  *source = have_levl ? PEAK_SOURCE_LEVL : PEAK_SOURCE_DATA;
+
+  return EXIT_SUCCESS;
+}
+
+void
+peak_overview_free(struct peak_overview *self) {
+  free(self->pos);
+  free(self->neg);
+  self->pos = NULL;
+  self->neg = NULL;
+}
+
+static uint16_t
+levl_quantize(float v) {
+  float q = v * 32767.0f + 0.5f;
+  if (q >= 32767.0f) {
+    return 32767;
+  }
+  return (uint16_t)q;
+}
+
+int
+peak_write_levl(int fd, const u8 *raw, size_t length,
+                const struct riff_wave *wave) {
+  const uint32_t channels = wave->fmt.NumChannels;
+  const uint64_t frames = riff_wave_frames(wave);
+  const uint64_t peak_frames = (frames + LEVL_BLOCK_SIZE - 1) / LEVL_BLOCK_SIZE;
+  enum sample_kind kind;
+  uint64_t riff_end = 8 + (uint64_t)rd_le32(raw + 4);
+  uint64_t payload;
+  uint64_t offset;
+  uint64_t peak_of_peaks = 0;
+  float best = -1.0f;
+  float *pos, *neg;
+  size_t total;
+  u8 *buf, *it;
+  uint64_t b;
+  int res = EXIT_FAILURE;
+
+  if (wave->levl.data) {
+    fprintf(stderr, "ERROR: file already has a 'levl' chunk\n");
+    return EXIT_FAILURE;
+  }
+  if ((kind = sample_kind(&wave->fmt)) == SAMPLE_UNSUPPORTED) {
+    fprintf(stderr, "ERROR: unsupported AudioFormat for peak envelope\n");
+    return EXIT_FAILURE;
+  }
+  offset = riff_end + (riff_end & 1);
+  if (offset < (uint64_t)length) {
+    fprintf(stderr, "ERROR: %zu bytes trailing the RIFF, not appending\n",
+            length - (size_t)riff_end);
+    return EXIT_FAILURE;
+  }
+
+  payload = LEVL_HEADER + peak_frames * channels * 2 * sizeof(uint16_t);
+  if (offset + payload > UINT32_MAX) {
+    fprintf(stderr, "ERROR: 'levl' chunk would exceed the 4GB RIFF limit\n");
+    return EXIT_FAILURE;
+  }
+
+  total = (size_t)(offset - riff_end) + 8 + (size_t)payload;
+  pos = calloc(channels, sizeof(*pos));
+  neg = calloc(channels, sizeof(*neg));
+  buf = calloc(1, total);
+  if (!pos || !neg || !buf) {
+    goto Lfree;
+  }
+
+  it = buf + (offset - riff_end);
+  memcpy(it, "levl", 4);
+  wr_le32(it + 4, (uint32_t)payload);
+  it += 8;
+  wr_le32(it, 1);
+  wr_le32(it + 4, 2);
+  wr_le32(it + 8, 2);
+  wr_le32(it + 12, LEVL_BLOCK_SIZE);
+  wr_le32(it + 16, channels);
+  wr_le32(it + 20, (uint32_t)peak_frames);
+  wr_le32(it + 28, LEVL_HEADER + 8);
+  {
+    char stamp[29];
+    time_t now = time(NULL);
+    struct tm tm;
+    if (localtime_r(&now, &tm) &&
+        strftime(stamp, sizeof(stamp), "%Y:%m:%d:%H-%M-%S:00", &tm) > 0) {
+      memcpy(it + 32, stamp, strlen(stamp));
+    }
+  }
+  it += LEVL_HEADER;
+
+  for (b = 0; b < peak_frames; ++b) {
+    uint64_t first = b * LEVL_BLOCK_SIZE;
+    uint64_t last = first + LEVL_BLOCK_SIZE < frames ? first + LEVL_BLOCK_SIZE
+                                                     : frames;
+    uint64_t frame = first;
+    uint32_t c;
+
+    scan_data(wave, kind, first, last, pos, neg, &frame);
+    for (c = 0; c < channels; ++c) {
+      if (pos[c] > best || neg[c] > best) {
+        best = pos[c] > neg[c] ? pos[c] : neg[c];
+        peak_of_peaks = frame;
+      }
+      wr_le16(it, levl_quantize(pos[c]));
+      wr_le16(it + 2, levl_quantize(neg[c]));
+      it += 4;
+    }
+  }
+  wr_le32(buf + (offset - riff_end) + 8 + 24, (uint32_t)peak_of_peaks);
+
+  if (pwrite(fd, buf, total, (off_t)riff_end) != (ssize_t)total) {
+    fprintf(stderr, "ERROR: pwrite(levl): %s\n", strerror(errno));
+    goto Lfree;
+  }
+  /* the RIFF ChunkSize is only grown once the chunk is on disk */
+  if (fdatasync(fd) < 0) {
+    fprintf(stderr, "ERROR: fdatasync(): %s\n", strerror(errno));
+    goto Lfree;
+  }
+  {
+    u8 size[4];
+    wr_le32(size, (uint32_t)(riff_end + total - 8));
+    if (pwrite(fd, size, sizeof(size), 4) != (ssize_t)sizeof(size)) {
+      fprintf(stderr, "ERROR: pwrite(RIFF): %s\n", strerror(errno));
+      goto Lfree;
+    }
+  }
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(buf);
+  free(neg);
+  free(pos);
+  return res;
+}
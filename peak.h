@@ -0,0 +1,60 @@
+#ifndef PEAK_H
+#define PEAK_H
+
+#include "riff.h"
+
+/* Peak queries served from the embedded EBU 'levl' peak envelope or the
+ * 'PEAK' chunk when present, falling back to a pass over the payload.
+ * https://tech.ebu.ch/docs/tech/tech3285s3.pdf
+ */
+
+enum peak_source {
+  PEAK_SOURCE_PEAK,
+  PEAK_SOURCE_LEVL,
+  PEAK_SOURCE_DATA,
+};
+
+struct peak_levl {
+  uint32_t format;           /* 1: u8, 2: u16 */
+  uint32_t points_per_value; /* 1: positive only, 2: positive and negative */
+  uint32_t block_size;       /* frames per peak frame */
+  uint32_t channels;
+  uint32_t frames;
+  uint32_t pos_peak_of_peaks;
+  const u8 *peaks;
+};
+
+struct peak_overview {
+  uint32_t channels;
+  uint32_t buckets;
+  /* [bucket * channels + channel], magnitudes in [0.0, 1.0] */
+  float *pos;
+  float *neg;
+};
+
+const char *
+peak_source_str(enum peak_source source);
+
+/* Decodes the 'levl' chunk and validates it against the 'fmt ' and 'data' */
+int
+peak_levl_parse(const struct riff_wave *wave, struct peak_levl *out);
+
+/* Per channel peak magnitude, out has room for NumChannels values */
+int
+peak_channels(const struct riff_wave *wave, float *out,
+              enum peak_source *source);
+
+int
+peak_overview(const struct riff_wave *wave, uint32_t buckets,
+              struct peak_overview *out, enum peak_source *source);
+
+void
+peak_overview_free(struct peak_overview *self);
+
+/* Computes the peak envelope and appends it as a 'levl' chunk. fd must be
+ * opened for writing and raw/length be the current mapping of it. */
+int
+peak_write_levl(int fd, const u8 *raw, size_t length,
+                const struct riff_wave *wave);
+
+#endif
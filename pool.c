@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+
+#include "pool.h"
+#include "cgroup.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct pool {
+  size_t next;
+  size_t length;
+  pool_fn fn;
+  pool_prefetch_fn prefetch;
+  void *closure;
+};
+
+struct pool_worker {
+  pthread_t thread;
+  struct pool *pool;
+  unsigned id;
+};
+
+static void *
+pool_worker_main(void *arg) {
+  struct pool_worker *self = arg;
+  struct pool *pool = self->pool;
+  size_t index;
+
+  while ((index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) <
+         pool->length) {
+    metric_add(METRIC_DEQUEUED, 1);
+    pool->fn(pool->closure, index, self->id);
+  }
+
+  return NULL;
+}
+
+/* Stays at most POOL_PREFETCH indices ahead of the last claimed one and
+ * skips indices the workers caught up with */
+static void *
+pool_prefetch_main(void *arg) {
+  static const struct timespec wait = {0, 100 * 1000};
+  struct pool *pool = arg;
+  size_t index = 0;
+
+  while (index < pool->length) {
+    size_t next = __atomic_load_n(&pool->next, __ATOMIC_RELAXED);
+    if (next >= pool->length) {
+      break;
+    }
+    if (index < next) {
+      index = next;
+    }
+    if (index >= next + POOL_PREFETCH) {
+      nanosleep(&wait, NULL);
+      continue;
+    }
+    pool->prefetch(pool->closure, index++);
+  }
+
+  return NULL;
+}
+
+/* The affinity mask of the process, NULL when it cannot be read */
+static cpu_set_t *
+pool_affinity(size_t *size) {
+  size_t cpus = 1024;
+
+  for (;;) {
+    cpu_set_t *set = CPU_ALLOC(cpus);
+    if (!set) {
+      return NULL;
+    }
+    *size = CPU_ALLOC_SIZE(cpus);
+    if (sched_getaffinity(0, *size, set) == 0) {
+      return set;
+    }
+    CPU_FREE(set);
+    if (errno != EINVAL || cpus >= (1 << 20)) {
+      return NULL;
+    }
+    cpus *= 2;
+  }
+}
+
+/* ceil(quota / period), 0 for "max" */
+static uint64_t
+cpu_max(FILE *f) {
+  char quota[32];
+  unsigned long period;
+  uint64_t res = 0;
+
+  if (fscanf(f, "%31s %lu", quota, &period) == 2 &&
+      strcmp(quota, "max") != 0 && period > 0) {
+    unsigned long q = strtoul(quota, NULL, 10);
+    res = (q + period - 1) / period;
+    if (res == 0) {
+      res = 1;
+    }
+  }
+  return res;
+}
+
+unsigned
+pool_default_workers(void) {
+  cpu_set_t *set;
+  size_t size;
+  uint64_t limit;
+  long n;
+
+  if ((set = pool_affinity(&size))) {
+    n = CPU_COUNT_S(size, set);
+    CPU_FREE(set);
+  } else {
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (n <= 0) {
+    n = 1;
+  }
+  if ((limit = cgroup_limit("cpu.max", cpu_max)) &&
+      limit < (unsigned long)n) {
+    n = (long)limit;
+  }
+  return (unsigned)n;
+}
+
+int
+pool_run(unsigned workers, size_t length, pool_fn fn, void *closure) {
+  return pool_run_prefetch(workers, length, fn, NULL, closure);
+}
+
+int
+pool_run_prefetch(unsigned workers, size_t length, pool_fn fn,
+                  pool_prefetch_fn prefetch, void *closure) {
+  struct pool pool = {0, length, fn, prefetch, closure};
+  struct pool_worker *threads = NULL;
+  cpu_set_t *set = NULL, *one = NULL;
+  unsigned *cpus = NULL;
+  unsigned ncpus = 0;
+  unsigned started = 0;
+  size_t size = 0;
+  pthread_t helper;
+  int helper_started = 0;
+  unsigned i;
+
+  metric_add(METRIC_QUEUED, length);
+  if (workers > length) {
+    workers = (unsigned)length;
+  }
+  if (workers > 1) {
+    if (!(threads = calloc(workers, sizeof(*threads)))) {
+      return EXIT_FAILURE;
+    }
+    /* the allowed CPUs in order, workers are pinned round robin */
+    if ((set = pool_affinity(&size)) &&
+        (cpus = calloc((unsigned)CPU_COUNT_S(size, set), sizeof(*cpus))) &&
+        (one = CPU_ALLOC(size * 8))) {
+      for (i = 0; i < size * 8; ++i) {
+        if (CPU_ISSET_S(i, size, set)) {
+          cpus[ncpus++] = i;
+        }
+      }
+    }
+  }
+  if (prefetch && length) {
+    helper_started =
+        pthread_create(&helper, NULL, pool_prefetch_main, &pool) == 0;
+  }
+
+  for (i = 0; i < workers && workers > 1; ++i) {
+    pthread_attr_t attr;
+    int err;
+
+    threads[i].pool = &pool;
+    threads[i].id = i;
+    pthread_attr_init(&attr);
+    if (ncpus > 1) {
+      CPU_ZERO_S(size, one);
+      CPU_SET_S(cpus[i % ncpus], size, one);
+      pthread_attr_setaffinity_np(&attr, size, one);
+    }
+    err = pthread_create(&threads[i].thread, &attr, pool_worker_main,
+                         &threads[i]);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+      fprintf(stderr, "pthread_create(): %s\n", strerror(err));
+      break;
+    }
+    ++started;
+  }
+  /* with no worker started the caller runs the loop itself */
+  if (started == 0) {
+    struct pool_worker self = {0, &pool, 0};
+    pool_worker_main(&self);
+  }
+  for (i = 0; i < started; ++i) {
+    pthread_join(threads[i].thread, NULL);
+  }
+  if (helper_started) {
+    pthread_join(helper, NULL);
+  }
+
+  if (one) {
+    CPU_FREE(one);
+  }
+  if (set) {
+    CPU_FREE(set);
+  }
+  free(cpus);
+  free(threads);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,35 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/* Parallel for over the indices [0, length). Workers claim the next index
+ * from a shared counter, results are expected to be written to per index
+ * slots so workers never share a cache line on the hot path.
+ *
+ * Workers are pinned round robin to the CPUs of the process affinity
+ * mask. I/O is kept off them: an optional prefetch function runs on a
+ * separate, unpinned helper thread ahead of the workers. */
+
+/* indices the prefetch helper may run ahead of the workers */
+#define POOL_PREFETCH 64
+
+typedef void (*pool_fn)(void *closure, size_t index, unsigned worker);
+
+/* Called in index order from the I/O helper thread */
+typedef void (*pool_prefetch_fn)(void *closure, size_t index);
+
+/* The CPUs of the affinity mask, limited by the cgroup v2 cpu.max quota
+ * of the process and its ancestors, rounded up */
+unsigned
+pool_default_workers(void);
+
+int
+pool_run(unsigned workers, size_t length, pool_fn fn, void *closure);
+
+/* pool_run with prefetch, which may be NULL, called for every index */
+int
+pool_run_prefetch(unsigned workers, size_t length, pool_fn fn,
+                  pool_prefetch_fn prefetch, void *closure);
+
+#endif
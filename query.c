@@ -0,0 +1,293 @@
+#include "query.h"
+#include "id3.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+  const char *name;
+  size_t offset;
+  size_t width;
+} fmt_fields[] = {
+    {"AudioFormat", 0, 2}, {"NumChannels", 2, 2}, {"SampleRate", 4, 4},
+    {"ByteRate", 8, 4},    {"BlockAlign", 12, 2}, {"BitsPerSample", 14, 2},
+};
+
+static int
+parse_id(const char *it, size_t len, char id[4]) {
+  if (len == 0 || len > 4) {
+    return EXIT_FAILURE;
+  }
+  memset(id, ' ', 4);
+  memcpy(id, it, len);
+  return EXIT_SUCCESS;
+}
+
+/* Splits path into at most three '/' separated components */
+static int
+query_parse(const char *path, size_t len, struct query *out) {
+  const char *part[3];
+  size_t part_len[3];
+  size_t parts = 0;
+  const char *it = path;
+  const char *const end = path + len;
+  size_t i;
+
+  memset(out, 0, sizeof(*out));
+  while (it <= end && parts < 3) {
+    const char *sep = memchr(it, '/', (size_t)(end - it));
+    if (!sep) {
+      sep = end;
+    }
+    part[parts] = it;
+    part_len[parts] = (size_t)(sep - it);
+    ++parts;
+    it = sep + 1;
+  }
+  if (it <= end || parse_id(part[0], part_len[0], out->id) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+
+  if (parts == 1) {
+    out->kind = QUERY_CHUNK;
+    return EXIT_SUCCESS;
+  }
+
+  if (memcmp(out->id, "RIFF", 4) == 0) {
+    out->kind = QUERY_RIFF;
+    if (part_len[1] == 9 && memcmp(part[1], "ChunkSize", 9) == 0) {
+      out->field = 0;
+    } else if (part_len[1] == 6 && memcmp(part[1], "Format", 6) == 0) {
+      out->field = 1;
+    } else {
+      return EXIT_FAILURE;
+    }
+    return parts == 2 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (parts == 2 && part_len[1] == 4 && memcmp(part[1], "size", 4) == 0) {
+    out->kind = QUERY_SIZE;
+    return EXIT_SUCCESS;
+  }
+
+  if (memcmp(out->id, "fmt ", 4) == 0 && parts == 2) {
+    out->kind = QUERY_FMT;
+    for (i = 0; i < sizeof(fmt_fields) / sizeof(fmt_fields[0]); ++i) {
+      if (strlen(fmt_fields[i].name) == part_len[1] &&
+          memcmp(fmt_fields[i].name, part[1], part_len[1]) == 0) {
+        out->field = (unsigned)i;
+        return EXIT_SUCCESS;
+      }
+    }
+    return EXIT_FAILURE;
+  }
+
+  if (memcmp(out->id, "LIST", 4) == 0 && parts == 3 && part_len[1] == 4 &&
+      memcmp(part[1], "INFO", 4) == 0) {
+    out->kind = QUERY_INFO;
+    return parse_id(part[2], part_len[2], out->sub);
+  }
+
+  if ((memcmp(out->id, "id3 ", 4) == 0 || memcmp(out->id, "ID3 ", 4) == 0) &&
+      parts == 2) {
+    out->kind = QUERY_ID3;
+    return parse_id(part[1], part_len[1], out->sub);
+  }
+
+  return EXIT_FAILURE;
+}
+
+int
+query_compile(const char *paths, struct query **out, size_t *length) {
+  const char *it = paths;
+  size_t n = 1;
+  size_t i;
+
+  for (; *it; ++it) {
+    if (*it == ',') {
+      ++n;
+    }
+  }
+  if (!(*out = calloc(n, sizeof(**out)))) {
+    return EXIT_FAILURE;
+  }
+  *length = n;
+
+  for (it = paths, i = 0; i < n; ++i) {
+    const char *sep = strchr(it, ',');
+    size_t len = sep ? (size_t)(sep - it) : strlen(it);
+    if (query_parse(it, len, &(*out)[i]) != EXIT_SUCCESS) {
+      fprintf(stderr, "ERROR: invalid path '%.*s'\n", (int)len, it);
+      free(*out);
+      *out = NULL;
+      return EXIT_FAILURE;
+    }
+    it += len + 1;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static void
+query_text(struct query *self, const u8 *ptr, size_t len) {
+  while (len > 0 && ptr[len - 1] == '\0') {
+    --len;
+  }
+  self->text.ptr = ptr;
+  self->text.len = len;
+  self->text.encoding = TAG_LATIN1;
+  self->found = 1;
+}
+
+static size_t
+query_INFO(struct query *queries, size_t length, const u8 *raw,
+           size_t raw_length) {
+  const u8 *it = raw + 4;
+  const u8 *const end = raw + raw_length;
+  size_t resolved = 0;
+
+  while ((size_t)(end - it) >= 8) {
+    uint32_t size = rd_le32(it + 4);
+    size_t i;
+
+    if ((size_t)size > (size_t)(end - it) - 8) {
+      break;
+    }
+    for (i = 0; i < length; ++i) {
+      struct query *q = &queries[i];
+      if (!q->found && q->kind == QUERY_INFO && memcmp(q->sub, it, 4) == 0) {
+        query_text(q, it + 8, size);
+        ++resolved;
+      }
+    }
+    it += 8 + size;
+    while (it < end && *it == '\0') {
+      ++it;
+    }
+  }
+
+  return resolved;
+}
+
+struct query_id3 {
+  struct query *queries;
+  size_t length;
+  size_t resolved;
+};
+
+static void
+query_ID3_frame(void *closure, const struct id3_frame *frame) {
+  struct query_id3 *self = closure;
+  size_t i;
+
+  for (i = 0; i < self->length; ++i) {
+    struct query *q = &self->queries[i];
+    if (!q->found && q->kind == QUERY_ID3 &&
+        memcmp(q->sub, frame->id, 4) == 0 &&
+        id3_frame_text(frame, &q->text) == EXIT_SUCCESS) {
+      q->found = 1;
+      ++self->resolved;
+    }
+  }
+}
+
+int
+query_run(struct query *queries, size_t length, const u8 *raw,
+          size_t raw_length, struct tags *tags) {
+  struct riff_iter iter;
+  struct riff_chunk chunk;
+  char form[4];
+  size_t pending = length;
+  size_t i;
+  int res = 0;
+
+  if (riff_iter_init(&iter, raw, raw_length, form) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < length; ++i) {
+    struct query *q = &queries[i];
+    if (q->kind == QUERY_RIFF) {
+      if (q->field == 0) {
+        q->number = rd_le32(raw + 4);
+        q->found = 1;
+      } else {
+        query_text(q, raw + 8, 4);
+      }
+      --pending;
+    }
+  }
+
+  while (pending > 0 && (res = riff_iter_next(&iter, &chunk)) > 0) {
+    int is_id3 =
+        memcmp(chunk.id, "id3 ", 4) == 0 || memcmp(chunk.id, "ID3 ", 4) == 0;
+    int wanted = 0;
+
+    for (i = 0; i < length; ++i) {
+      struct query *q = &queries[i];
+      if (q->found) {
+        continue;
+      }
+      if (q->kind == QUERY_ID3 ? is_id3 : memcmp(q->id, chunk.id, 4) == 0) {
+        wanted = 1;
+      }
+      if (memcmp(q->id, chunk.id, 4) != 0) {
+        continue;
+      }
+      if (q->kind == QUERY_SIZE) {
+        q->number = chunk.size;
+        q->found = 1;
+        --pending;
+      } else if (q->kind == QUERY_CHUNK) {
+        query_text(q, chunk.data, chunk.size);
+        --pending;
+      } else if (q->kind == QUERY_FMT &&
+                 fmt_fields[q->field].offset + fmt_fields[q->field].width <=
+                     chunk.size) {
+        const u8 *p = chunk.data + fmt_fields[q->field].offset;
+        q->number = fmt_fields[q->field].width == 2 ? rd_le16(p) : rd_le32(p);
+        q->found = 1;
+        --pending;
+      }
+    }
+    if (!wanted) {
+      continue;
+    }
+
+    if (memcmp(chunk.id, "LIST", 4) == 0 && chunk.size >= 4 &&
+        memcmp(chunk.data, "INFO", 4) == 0) {
+      pending -= query_INFO(queries, length, chunk.data, chunk.size);
+    } else if (is_id3) {
+      struct query_id3 closure = {queries, length, 0};
+      id3_parse(chunk.data, chunk.size, tags, query_ID3_frame, &closure);
+      pending -= closure.resolved;
+    }
+  }
+
+  return res < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void
+query_fput(const struct query *query, FILE *out) {
+  if (query->found) {
+    switch (query->kind) {
+    case QUERY_RIFF:
+      if (query->field == 0) {
+        fprintf(out, "%" PRIu64, query->number);
+      } else {
+        tag_value_fput(&query->text, out);
+      }
+      break;
+    case QUERY_FMT:
+    case QUERY_SIZE:
+      fprintf(out, "%" PRIu64, query->number);
+      break;
+    case QUERY_INFO:
+    case QUERY_ID3:
+    case QUERY_CHUNK:
+      tag_value_fput(&query->text, out);
+      break;
+    }
+  }
+  fputc('\n', out);
+}
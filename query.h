@@ -0,0 +1,55 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "tags.h"
+
+#include <stdio.h>
+
+/* Chunk path queries such as "LIST/INFO/INAM" or "fmt /SampleRate".
+ *
+ *   RIFF/ChunkSize, RIFF/Format
+ *   fmt /<field>       AudioFormat, NumChannels, SampleRate, ByteRate,
+ *                      BlockAlign, BitsPerSample
+ *   LIST/INFO/<id>     INFO subchunk text
+ *   id3 /<frame>       ID3v2 text frame of an 'id3 ' or 'ID3 ' chunk
+ *   <id>/size          SubChunk size
+ *   <id>               SubChunk payload
+ *
+ * Chunk ids shorter than four characters are padded with spaces.
+ */
+
+enum query_kind {
+  QUERY_RIFF,
+  QUERY_FMT,
+  QUERY_INFO,
+  QUERY_ID3,
+  QUERY_SIZE,
+  QUERY_CHUNK,
+};
+
+struct query {
+  enum query_kind kind;
+  char id[4];
+  char sub[4];
+  unsigned field;
+
+  int found;
+  uint64_t number;
+  struct tag_value text;
+};
+
+/* Compiles a comma separated list of paths */
+int
+query_compile(const char *paths, struct query **out, size_t *length);
+
+/* Walks the chunks until every query is resolved. Values of ID3 frames
+ * needing decoding are owned by tags. */
+int
+query_run(struct query *queries, size_t length, const u8 *raw,
+          size_t raw_length, struct tags *tags);
+
+/* Bare value followed by a newline, an empty line when not found */
+void
+query_fput(const struct query *query, FILE *out);
+
+#endif
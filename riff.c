@@ -1,8 +1,11 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -14,12 +17,65 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "align.h"
+#include "analysis.h"
+#include "budget.h"
+#include "catalog.h"
+#include "concat.h"
+#include "dedupe.h"
+#include "edit.h"
+#include "export.h"
+#include "guard.h"
+#include "id3.h"
+#include "input.h"
+#include "metrics.h"
+#include "peak.h"
+#include "pool.h"
+#include "query.h"
+#include "seek.h"
+#include "serve.h"
+#include "riff.h"
+#include "sniff.h"
+#include "spectrogram.h"
+#include "spectrum.h"
+#include "tags.h"
+
 /* https://sites.google.com/site/musicgapi/technical-documents/wav-file-format
  * http://www.robotplanet.dk/audio/wav_meta_data/
  * http://soundfile.sapp.org/doc/WaveFormat/
  */
 
-typedef unsigned char u8;
+struct options {
+  int align;
+  unsigned align_windows;
+  int analyze;
+  int cutoff;
+  unsigned cutoff_windows;
+  unsigned jobs;
+  uint64_t memory;
+  const char *metrics;
+  int io;
+  int stats;
+  int resume;
+  const char *catalog;
+  const char *list;
+  const char *shared;
+  const char *timeline;
+  int diff;
+  const char *arrow;
+  const char *dedupe;
+  const char *edit;
+  int classify;
+  int concat;
+  const char *get;
+  int tags;
+  int peaks;
+  const char *sample;
+  const char *spectrogram;
+  const char *serve;
+  uint32_t overview;
+  int write_levl;
+};
 
 static const char *
 AudioFormat(uint16_t format);
@@ -69,21 +125,9 @@ read_bytes(const u8 *it, const u8 *end, void *buf, size_t bytes) {
 
   return it + bytes;
 }
-/*
- * Track Artist (IART)
- * Album Artist (IAAR)
- * Composer (ICOM/IMUS)
- * Title (INAM)
- * Product (IPRD) - "Album Title"
- * Album Title (IALB)
- * Track Number (ITRK)
- * Date Created (ICRD/IYER) - "year"
- * Genre (IGNR/IGRE)
- * Comments (ICMT)
- * Copyright (ICOP)
- * Software (ISFT)
- */
 
+/* Prints every INFO subchunk, the ids read as tags are listed with
+ * INFO_fields in tags.c */
 static int
 parse_subchunk_INFO(const u8 *raw, size_t length) {
   char buf[4];
@@ -137,6 +181,44 @@ parse_subchunk_INFO(const u8 *raw, size_t length) {
   return EXIT_SUCCESS;
 }
 
+static void
+print_ID3_frame(void *closure, const struct id3_frame *frame) {
+  struct tag_value value;
+  (void)closure;
+
+  printf("\t%.*s[size: %zu, ", (int)sizeof(frame->id), frame->id,
+         frame->size);
+  if (id3_frame_text(frame, &value) == EXIT_SUCCESS) {
+    printf("'");
+    tag_value_fput(&value, stdout);
+    printf("'");
+  } else {
+    printf("...");
+  }
+  printf("]\n");
+}
+
+static int
+parse_subchunk_ID3(const u8 *raw, size_t length) {
+  struct tags tags;
+  int major;
+
+  tags_init(&tags);
+  if (length >= 10 && memcmp(raw, "ID3", 3) == 0) {
+    printf("ID3v2.%u[\n", raw[3]);
+    major = id3_parse(raw, length, &tags, print_ID3_frame, NULL);
+    printf("]");
+    if (major < 0) {
+      printf(" (unsupported)");
+    }
+  } else {
+    printf("...");
+  }
+  tags_free(&tags);
+
+  return EXIT_SUCCESS;
+}
+
 static int
 parse_RIFF(const u8 *raw, size_t length) {
   char buf[4];
@@ -259,6 +341,9 @@ parse_RIFF(const u8 *raw, size_t length) {
       if ((res = parse_subchunk_INFO(it, size)) != EXIT_SUCCESS) {
         return res;
       }
+    } else if (memcmp("id3 ", buf, sizeof(buf)) == 0 ||
+               memcmp("ID3 ", buf, sizeof(buf)) == 0) {
+      parse_subchunk_ID3(it, size);
     } else if (is_ascii((const char *)it, size)) {
       print_raw((const char *)it, size);
     } else {
@@ -271,38 +356,1227 @@ parse_RIFF(const u8 *raw, size_t length) {
   return EXIT_SUCCESS;
 }
 
+static int
+print_peaks(int fd, const u8 *raw, size_t length, const struct options *opt) {
+  struct riff_wave wave;
+  enum peak_source source;
+  uint32_t c;
+
+  if (riff_wave_parse(raw, length, &wave) != EXIT_SUCCESS) {
+    fprintf(stderr, "ERROR: not a WAVE file with 'fmt ' and 'data'\n");
+    return EXIT_FAILURE;
+  }
+
+  if (opt->peaks) {
+    float *peaks;
+    if (!(peaks = calloc(wave.fmt.NumChannels, sizeof(*peaks)))) {
+      return EXIT_FAILURE;
+    }
+    if (peak_channels(&wave, peaks, &source) != EXIT_SUCCESS) {
+      fprintf(stderr, "ERROR: unsupported AudioFormat '%s'\n",
+              AudioFormat(wave.fmt.AudioFormat));
+      free(peaks);
+      return EXIT_FAILURE;
+    }
+    printf("Peak[source: '%s'", peak_source_str(source));
+    for (c = 0; c < wave.fmt.NumChannels; ++c) {
+      printf(", Channel%u: %f", c, (double)peaks[c]);
+    }
+    printf("]\n");
+    free(peaks);
+  }
+
+  if (opt->overview) {
+    struct peak_overview ov;
+    uint32_t b;
+    if (peak_overview(&wave, opt->overview, &ov, &source) != EXIT_SUCCESS) {
+      fprintf(stderr, "ERROR: unsupported AudioFormat '%s'\n",
+              AudioFormat(wave.fmt.AudioFormat));
+      return EXIT_FAILURE;
+    }
+    printf("Overview[source: '%s', buckets: %u]\n", peak_source_str(source),
+           ov.buckets);
+    for (b = 0; b < ov.buckets; ++b) {
+      printf("%u", b);
+      for (c = 0; c < ov.channels; ++c) {
+        size_t idx = (size_t)b * ov.channels + c;
+        printf("\t-%f\t%f", (double)ov.neg[idx], (double)ov.pos[idx]);
+      }
+      printf("\n");
+    }
+    peak_overview_free(&ov);
+  }
+
+  if (opt->write_levl) {
+    if (peak_write_levl(fd, raw, length, &wave) != EXIT_SUCCESS) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int
+print_tags(const u8 *raw, size_t length) {
+  struct tags tags;
+  int i;
+
+  tags_init(&tags);
+  if (tags_parse_wave(&tags, raw, length) != EXIT_SUCCESS) {
+    tags_free(&tags);
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < TAG_FIELDS; ++i) {
+    if (tags.field[i].len > 0) {
+      printf("%s: ", tag_field_str((enum tag_field)i));
+      tag_value_fput(&tags.field[i], stdout);
+      printf("\n");
+    }
+  }
+  tags_free(&tags);
+
+  return EXIT_SUCCESS;
+}
+
+static int
+print_query(const u8 *raw, size_t length, const char *paths) {
+  struct query *queries;
+  struct tags tags;
+  size_t n, i;
+  int res;
+
+  if (query_compile(paths, &queries, &n) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  tags_init(&tags);
+  res = query_run(queries, n, raw, length, &tags);
+  for (i = 0; i < n; ++i) {
+    query_fput(&queries[i], stdout);
+    if (!queries[i].found) {
+      res = EXIT_FAILURE;
+    }
+  }
+  tags_free(&tags);
+  free(queries);
+
+  return res;
+}
+
+static int
+classify_files(char *files[], int n) {
+  int res = EXIT_SUCCESS;
+  int i;
+
+  for (i = 0; i < n; ++i) {
+    struct sniff sniff;
+    int fd;
+
+    if ((fd = input_fd(files[i], O_RDONLY)) < 0) {
+      printf("%s\terror: %s\n", files[i], strerror(errno));
+      res = EXIT_FAILURE;
+      continue;
+    }
+    if (sniff_fd(fd, &sniff) != EXIT_SUCCESS) {
+      printf("%s\terror: %s\n", files[i], strerror(errno));
+      res = EXIT_FAILURE;
+    } else if (sniff.form[0]) {
+      printf("%s\t%s/", files[i], sniff_container_str(sniff.container));
+      print_raw(sniff.form, sizeof(sniff.form));
+      printf("\n");
+    } else {
+      printf("%s\t%s\n", files[i], sniff_container_str(sniff.container));
+    }
+    close(fd);
+  }
+
+  return res;
+}
+
+static int
+print_catalog(const char *path) {
+  struct catalog cat;
+  uint64_t i;
+
+  if (catalog_open(&cat, path) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < cat.header->entries; ++i) {
+    const struct catalog_entry *e = &cat.entries[i];
+
+    printf("%s\t", catalog_path(&cat, e));
+    if (e->error) {
+      printf("error: %s\n", strerror(e->error));
+      continue;
+    }
+    printf("%s", sniff_container_str((enum sniff_container)e->container));
+    if (e->form[0]) {
+      printf("/");
+      print_raw(e->form, sizeof(e->form));
+    }
+    printf("\t%u\t%u\t%u\t%u\t%" PRIu64 "\t%016" PRIx64 "\t%016" PRIx64
+           "\t%" PRIu64 "\n",
+           e->AudioFormat, e->SampleRate, e->NumChannels, e->BitsPerSample,
+           e->data_length, e->payload_hash, e->meta_hash, e->chunks_count);
+  }
+  catalog_close(&cat);
+
+  return EXIT_SUCCESS;
+}
+
+static int
+print_shared(const char *path) {
+  struct catalog cat;
+  uint64_t *shared;
+  uint64_t unique, total = 0, total_shared = 0;
+  uint64_t i;
+
+  if (catalog_open(&cat, path) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  if (!(shared = calloc(cat.header->entries + 1, sizeof(*shared))) ||
+      catalog_shared(&cat, shared, &unique) != EXIT_SUCCESS) {
+    free(shared);
+    catalog_close(&cat);
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < cat.header->entries; ++i) {
+    const struct catalog_entry *e = &cat.entries[i];
+    printf("%s\t%" PRIu64 "\t%" PRIu64 "\t%.1f%%\n", catalog_path(&cat, e),
+           e->data_length, shared[i],
+           e->data_length ? 100.0 * (double)shared[i] / (double)e->data_length
+                          : 0.0);
+    total += e->data_length;
+    total_shared += shared[i];
+  }
+  printf("Total[bytes: %" PRIu64 ", shared: %" PRIu64 ", unique: %" PRIu64
+         ", redundant: %" PRIu64 "]\n",
+         total, total_shared, unique, total - unique);
+
+  free(shared);
+  catalog_close(&cat);
+  return EXIT_SUCCESS;
+}
+
+static void
+print_redundancy(const struct analysis *an) {
+  int *droppable;
+  uint32_t dropped, c;
+  size_t p;
+
+  for (c = 0; c < an->channels; ++c) {
+    if (analysis_silent(an, c)) {
+      printf("[Channel%u: silent]\n", c);
+    }
+  }
+  for (p = 0; p < an->pairs; ++p) {
+    const struct analysis_pair *pair = &an->pair[p];
+    double r = analysis_correlation(pair);
+
+    if (analysis_silent(an, pair->a) || analysis_silent(an, pair->b)) {
+      continue;
+    }
+    if (pair->identical) {
+      printf("[Channel%u, Channel%u: identical]\n", pair->a, pair->b);
+    } else if (pair->inverted) {
+      printf("[Channel%u, Channel%u: inverted]\n", pair->a, pair->b);
+    } else if (r >= ANALYSIS_NEAR_IDENTICAL ||
+               r <= -ANALYSIS_NEAR_IDENTICAL) {
+      printf("[Channel%u, Channel%u: correlation: %.6f]\n", pair->a,
+             pair->b, r);
+    }
+  }
+
+  if (!(droppable = calloc(an->channels, sizeof(*droppable)))) {
+    return;
+  }
+  dropped = analysis_droppable(an, droppable);
+  printf("Droppable[channels: %u", dropped);
+  for (c = 0; c < an->channels; ++c) {
+    if (droppable[c]) {
+      printf(", Channel%u", c);
+    }
+  }
+  printf("]\n");
+  free(droppable);
+}
+
+struct timeline_print {
+  const struct catalog *cat;
+};
+
+static void
+print_timeline_interval(void *closure,
+                        const struct timeline_interval *interval) {
+  const struct timeline_print *self = closure;
+  const struct catalog_entry *e = &self->cat->entries[interval->entry];
+  char start[16], end[16];
+
+  printf("%s\t%s\t%s\t%u\n", catalog_path(self->cat, e),
+         timeline_str(interval->start, start),
+         timeline_str(interval->end, end), e->SampleRate);
+}
+
+static int
+print_timeline(const char *path, const char *range) {
+  struct catalog cat;
+  struct timeline_print self;
+  uint64_t from = 0, to = TIMELINE_DAY;
+  const char *it;
+  size_t matches;
+
+  if (range) {
+    if (!(it = timeline_parse(range, &from)) || *it++ != '-' ||
+        !(it = timeline_parse(it, &to)) || *it != '\0') {
+      fprintf(stderr, "ERROR: time range is not HH:MM:SS-HH:MM:SS\n");
+      return EXIT_FAILURE;
+    }
+  }
+  if (catalog_open(&cat, path) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  self.cat = &cat;
+  matches = catalog_timeline(&cat, from, to, print_timeline_interval, &self);
+  printf("Timeline[recordings: %" PRIu64 ", matches: %zu]\n",
+         cat.header->intervals, matches);
+  catalog_close(&cat);
+
+  return EXIT_SUCCESS;
+}
+
+static int
+print_align(const char *ref_path, const char *other_path, unsigned windows) {
+  struct input ref, other;
+  struct riff_wave ref_wave, other_wave;
+  struct align al;
+  struct guard guard;
+  unsigned i;
+  int err;
+  int res = EXIT_FAILURE;
+
+  if ((err = input_open(&ref, ref_path)) != 0) {
+    fprintf(stderr, "open(%s): %s\n", ref_path, strerror(err));
+    return EXIT_FAILURE;
+  }
+  if ((err = input_open(&other, other_path)) != 0) {
+    fprintf(stderr, "open(%s): %s\n", other_path, strerror(err));
+    goto Lref;
+  }
+  /* a file truncated while mapped fails instead of killing the process,
+   * align_run() guards its own reads */
+  guard_push(&guard);
+  if (sigsetjmp(guard.env, 1) != 0) {
+    fprintf(stderr, "ERROR: %s\n", strerror(EIO));
+    res = EXIT_FAILURE;
+    goto Lguard;
+  }
+  if (riff_wave_parse(ref.raw, ref.length, &ref_wave) != EXIT_SUCCESS ||
+      riff_wave_parse(other.raw, other.length, &other_wave) !=
+          EXIT_SUCCESS) {
+    fprintf(stderr, "ERROR: not a WAVE file with 'fmt ' and 'data'\n");
+    goto Lguard;
+  }
+  if (ref_wave.fmt.SampleRate != other_wave.fmt.SampleRate) {
+    fprintf(stderr, "ERROR: SampleRate %u and %u differ\n",
+            ref_wave.fmt.SampleRate, other_wave.fmt.SampleRate);
+    goto Lguard;
+  }
+  errno = 0;
+  if (align_run(&ref_wave, &other_wave, windows, &al) != EXIT_SUCCESS) {
+    if (errno == EIO) {
+      fprintf(stderr, "ERROR: %s\n", strerror(errno));
+    } else {
+      fprintf(stderr, "ERROR: could not align, unsupported AudioFormat or "
+                      "no samples\n");
+    }
+    goto Lguard;
+  }
+
+  printf("Align[offset: %" PRId64 ", seconds: %.6f, confidence: %.3f, "
+         "decimation: %u]\n",
+         al.offset, (double)al.offset / ref_wave.fmt.SampleRate,
+         al.confidence, al.decimation);
+  for (i = 0; i < al.windows; ++i) {
+    const struct align_window *win = &al.window[i];
+    printf("[Window%u: position: %" PRIu64 ", offset: %" PRId64
+           ", confidence: %.3f]\n",
+           i, win->position, win->offset, win->confidence);
+  }
+  if (al.windows > 1) {
+    printf("Drift[ppm: %.3f, frames per hour: %.1f]\n", al.drift,
+           al.drift * 1e-6 * 3600.0 * ref_wave.fmt.SampleRate);
+  }
+  align_free(&al);
+  res = EXIT_SUCCESS;
+
+Lguard:
+  guard_pop(&guard);
+  input_close(&other);
+Lref:
+  input_close(&ref);
+  return res;
+}
+
+static int
+print_sample(const u8 *raw, size_t length, const char *frames) {
+  struct riff_wave wave;
+  struct seek seek;
+  struct seek_location loc;
+  double *values;
+  const char *it = frames;
+  char *end;
+  uint32_t c;
+  int res = EXIT_SUCCESS;
+
+  if (riff_wave_parse(raw, length, &wave) != EXIT_SUCCESS) {
+    fprintf(stderr, "ERROR: not a WAVE file with 'fmt ' and 'data'\n");
+    return EXIT_FAILURE;
+  }
+  if (seek_init(&seek, &wave) != EXIT_SUCCESS) {
+    fprintf(stderr, "ERROR: unsupported AudioFormat '%s'\n",
+            AudioFormat(wave.fmt.AudioFormat));
+    return EXIT_FAILURE;
+  }
+  if (!(values = calloc(seek.channels, sizeof(*values)))) {
+    return EXIT_FAILURE;
+  }
+
+  printf("Seek[codec: %s, frames: %" PRIu64 ", FramesPerBlock: %u]\n",
+         seek_codec_str(seek.codec), seek.frames, seek.frames_per_block);
+  for (;;) {
+    uint64_t frame = strtoull(it, &end, 10);
+    if (end == it || (*end != ',' && *end != '\0')) {
+      fprintf(stderr, "ERROR: '%s' is not a frame number\n", it);
+      res = EXIT_FAILURE;
+      break;
+    }
+    if (seek_locate(&seek, frame, &loc) != EXIT_SUCCESS ||
+        seek_frame(&seek, frame, values) != EXIT_SUCCESS) {
+      fprintf(stderr, "ERROR: frame %" PRIu64 " is past the end\n", frame);
+      res = EXIT_FAILURE;
+    } else {
+      printf("[Frame%" PRIu64 ": block: %" PRIu64 "+%u, index: %u", frame,
+             loc.offset, loc.length, loc.index);
+      for (c = 0; c < seek.channels; ++c) {
+        printf(", Channel%u: %f", c, values[c]);
+      }
+      printf("]\n");
+    }
+    if (*end == '\0') {
+      break;
+    }
+    it = end + 1;
+  }
+  free(values);
+
+  return res;
+}
+
+struct diff_print {
+  const struct catalog *old;
+  const struct catalog *new_;
+  uint64_t added;
+  uint64_t removed;
+  uint64_t modified;
+};
+
+static void
+print_diff_entry(void *closure, unsigned change,
+                 const struct catalog_entry *old,
+                 const struct catalog_entry *new_) {
+  struct diff_print *self = closure;
+  const char *sep = "\t";
+
+  if (change & CATALOG_ADDED) {
+    printf("A\t%s\n", catalog_path(self->new_, new_));
+    ++self->added;
+    return;
+  }
+  if (change & CATALOG_REMOVED) {
+    printf("D\t%s\n", catalog_path(self->old, old));
+    ++self->removed;
+    return;
+  }
+  printf("M\t%s", catalog_path(self->new_, new_));
+  if (change & CATALOG_PAYLOAD) {
+    printf("%spayload", sep);
+    sep = ",";
+  }
+  if (change & CATALOG_META) {
+    printf("%smeta", sep);
+    sep = ",";
+  }
+  if (change & CATALOG_ERROR) {
+    printf("%serror", sep);
+  }
+  printf("\n");
+  ++self->modified;
+}
+
+static int
+print_diff(const char *old_path, const char *new_path) {
+  struct catalog old, new_;
+  struct diff_print self;
+  int res = EXIT_FAILURE;
+
+  if (catalog_open(&old, old_path) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  if (catalog_open(&new_, new_path) != EXIT_SUCCESS) {
+    catalog_close(&old);
+    return EXIT_FAILURE;
+  }
+  memset(&self, 0, sizeof(self));
+  self.old = &old;
+  self.new_ = &new_;
+  if (catalog_diff(&old, &new_, print_diff_entry, &self) != EXIT_SUCCESS) {
+    fprintf(stderr, "ERROR: catalog entries are not sorted by path\n");
+  } else {
+    printf("Diff[added: %" PRIu64 ", removed: %" PRIu64
+           ", modified: %" PRIu64 "]\n",
+           self.added, self.removed, self.modified);
+    res = EXIT_SUCCESS;
+  }
+  catalog_close(&new_);
+  catalog_close(&old);
+
+  return res;
+}
+
+/* Of the stream of one or more segments, see concat.h */
+static int
+report_analysis(const struct riff_wave *segments, struct input *in,
+                size_t count) {
+  const struct riff_wave *wave = &segments[0];
+  struct analysis an;
+  unsigned effective = 0;
+  uint32_t c;
+
+  errno = 0;
+  if (analysis_run_segments(segments, in, count, &an) != EXIT_SUCCESS) {
+    if (errno != 0) {
+      fprintf(stderr, "ERROR: %s\n", strerror(errno));
+    } else {
+      fprintf(stderr, "ERROR: unsupported AudioFormat '%s'\n",
+              AudioFormat(wave->fmt.AudioFormat));
+    }
+    return EXIT_FAILURE;
+  }
+
+  printf("Analysis[frames: %" PRIu64 ", BitsPerSample: %u]\n", an.frames,
+         wave->fmt.BitsPerSample);
+  for (c = 0; c < an.channels; ++c) {
+    unsigned bits = analysis_effective_bits(&an, c);
+    double peak = analysis_peak_dbfs(&an, c);
+
+    if (bits > analysis_container_bits(&an)) {
+      printf("[Channel%u: EffectiveBits: float, Peak: %.2f dBFS", c, peak);
+    } else {
+      printf("[Channel%u: EffectiveBits: %u, Peak: %.2f dBFS", c, bits, peak);
+    }
+    if (bits > 0 && bits <= analysis_container_bits(&an)) {
+      /* from the peak down to the smallest step in use */
+      printf(", DynamicRange: %.1f dB", peak + 6.0206 * (bits - 1));
+    }
+    printf("]\n");
+    if (bits > effective) {
+      effective = bits;
+    }
+  }
+  if (effective > analysis_container_bits(&an)) {
+    printf("EffectiveBitsPerSample: float\n");
+  } else {
+    printf("EffectiveBitsPerSample: %u\n", effective);
+  }
+  print_redundancy(&an);
+  analysis_free(&an);
+
+  return EXIT_SUCCESS;
+}
+
+static int
+print_analysis(const char *path) {
+  struct input in;
+  struct riff_wave wave;
+  int err, res;
+
+  /* a whole file pass, read with the strategy of the filesystem */
+  if ((err = input_open_scan(&in, path)) != 0) {
+    fprintf(stderr, "open(%s): %s\n", path, strerror(err));
+    return EXIT_FAILURE;
+  }
+  if (riff_wave_parse(in.raw, in.length, &wave) != EXIT_SUCCESS) {
+    fprintf(stderr, "ERROR: not a WAVE file with 'fmt ' and 'data'\n");
+    res = EXIT_FAILURE;
+  } else {
+    res = report_analysis(&wave, &in, 1);
+  }
+  input_close(&in);
+  return res;
+}
+
+static int
+report_cutoff(const struct riff_wave *segments, size_t count,
+              unsigned windows) {
+  const struct riff_wave *wave = &segments[0];
+  struct spectrum_cutoff cut;
+
+  errno = 0;
+  if (spectrum_cutoff_segments(segments, count, windows, &cut) !=
+      EXIT_SUCCESS) {
+    if (errno == EIO) {
+      fprintf(stderr, "ERROR: %s\n", strerror(errno));
+    } else {
+      fprintf(stderr, "ERROR: unsupported AudioFormat '%s' or too short\n",
+              AudioFormat(wave->fmt.AudioFormat));
+    }
+    return EXIT_FAILURE;
+  }
+
+  printf("Spectrum[windows: %u, FFTSize: %u, Cutoff: %.0f Hz, SampleRate: "
+         "%u, ",
+         cut.windows, SPECTRUM_FFT, cut.cutoff, wave->fmt.SampleRate);
+  if (cut.original_rate < wave->fmt.SampleRate) {
+    printf("LikelyOriginalRate: %u]\n", cut.original_rate);
+  } else {
+    printf("LikelyOriginalRate: native]\n");
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int
+print_cutoff(const u8 *raw, size_t length, unsigned windows) {
+  struct riff_wave wave;
+
+  if (riff_wave_parse(raw, length, &wave) != EXIT_SUCCESS) {
+    fprintf(stderr, "ERROR: not a WAVE file with 'fmt ' and 'data'\n");
+    return EXIT_FAILURE;
+  }
+  return report_cutoff(&wave, 1, windows);
+}
+
+static int
+print_spectrogram(const struct input *in, const char *path,
+                  unsigned workers) {
+  struct riff_wave wave;
+  struct spectrogram sg;
+  unsigned l;
+
+  if (riff_wave_parse(in->raw, in->length, &wave) != EXIT_SUCCESS) {
+    fprintf(stderr, "ERROR: not a WAVE file with 'fmt ' and 'data'\n");
+    return EXIT_FAILURE;
+  }
+  errno = 0;
+  if (spectrogram_write(in, &wave, path, workers, &sg) != EXIT_SUCCESS) {
+    if (errno == EIO) {
+      fprintf(stderr, "ERROR: %s\n", strerror(errno));
+    } else if (errno == 0) {
+      fprintf(stderr, "ERROR: unsupported AudioFormat '%s'\n",
+              AudioFormat(wave.fmt.AudioFormat));
+    }
+    return EXIT_FAILURE;
+  }
+
+  printf("Spectrogram[levels: %u, tiles: %" PRIu64 ", stored: %" PRIu64
+         ", bytes: %" PRIu64 "]\n",
+         sg.levels, sg.tiles, sg.stored, sg.bytes);
+  for (l = 0; l < sg.levels; ++l) {
+    const struct spectrogram_level *level = &sg.level[l];
+    printf("[Level%u: FFTSize: %u, Hop: %u, Columns: %u, Tiles: %ux%u]\n",
+           l, level->fft, level->hop, level->columns, level->tiles_x,
+           level->tiles_y);
+  }
+  return EXIT_SUCCESS;
+}
+
+/* Per channel peak over the segments, from each segment's cheapest
+ * source, reported as 'data' unless every segment had the same one */
+static int
+report_concat_peaks(const struct concat *cat) {
+  const uint32_t channels = cat->wave[0].fmt.NumChannels;
+  enum peak_source source = PEAK_SOURCE_DATA, first = PEAK_SOURCE_DATA;
+  float *peaks, *segment;
+  size_t i;
+  uint32_t c;
+  int res = EXIT_FAILURE;
+
+  peaks = calloc(channels, sizeof(*peaks));
+  segment = calloc(channels, sizeof(*segment));
+  if (!peaks || !segment) {
+    goto Lfree;
+  }
+  for (i = 0; i < cat->count; ++i) {
+    if (peak_channels(&cat->wave[i], segment, &source) != EXIT_SUCCESS) {
+      fprintf(stderr, "ERROR: unsupported AudioFormat '%s'\n",
+              AudioFormat(cat->wave[i].fmt.AudioFormat));
+      goto Lfree;
+    }
+    if (i == 0) {
+      first = source;
+    } else if (source != first) {
+      first = PEAK_SOURCE_DATA;
+    }
+    for (c = 0; c < channels; ++c) {
+      if (segment[c] > peaks[c]) {
+        peaks[c] = segment[c];
+      }
+    }
+  }
+  printf("Peak[source: '%s'", peak_source_str(first));
+  for (c = 0; c < channels; ++c) {
+    printf(", Channel%u: %f", c, (double)peaks[c]);
+  }
+  printf("]\n");
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(segment);
+  free(peaks);
+  return res;
+}
+
+static int
+report_concat_sample(const struct concat *cat, const char *frames) {
+  const uint32_t channels = cat->seek[0].channels;
+  double *values;
+  const char *it = frames;
+  char *end;
+  uint32_t c;
+  int res = EXIT_SUCCESS;
+
+  if (!(values = calloc(channels, sizeof(*values)))) {
+    return EXIT_FAILURE;
+  }
+  for (;;) {
+    uint64_t frame = strtoull(it, &end, 10);
+    size_t segment = concat_segment(cat, frame);
+
+    if (end == it || (*end != ',' && *end != '\0')) {
+      fprintf(stderr, "ERROR: '%s' is not a frame number\n", it);
+      res = EXIT_FAILURE;
+      break;
+    }
+    if (concat_frame(cat, frame, values) != EXIT_SUCCESS) {
+      fprintf(stderr, "ERROR: frame %" PRIu64 " is past the end\n", frame);
+      res = EXIT_FAILURE;
+    } else {
+      printf("[Frame%" PRIu64 ": segment: %zu, frame: %" PRIu64, frame,
+             segment, frame - cat->first[segment]);
+      for (c = 0; c < channels; ++c) {
+        printf(", Channel%u: %f", c, values[c]);
+      }
+      printf("]\n");
+    }
+    if (*end == '\0') {
+      break;
+    }
+    it = end + 1;
+  }
+  free(values);
+
+  return res;
+}
+
+static int
+report_concat(const struct concat *cat, const struct options *opt) {
+  size_t s;
+  int res = EXIT_SUCCESS;
+
+  printf("Concat[segments: %zu, frames: %" PRIu64 ", SampleRate: %u]\n",
+         cat->count, concat_frames(cat), cat->wave[0].fmt.SampleRate);
+  for (s = 0; s < cat->count; ++s) {
+    printf("[Segment%zu: '%s', first: %" PRIu64 ", frames: %" PRIu64 "]\n",
+           s, cat->path[s], cat->first[s],
+           cat->first[s + 1] - cat->first[s]);
+  }
+  for (s = 0; s + 1 < cat->count; ++s) {
+    const struct concat_seam *seam = &cat->seam[s];
+
+    printf("Seam[frame: %" PRIu64 ", link: %s%s%s", seam->frame,
+           seam->link & CONCAT_TIME ? "time" : "",
+           seam->link == (CONCAT_TIME | CONCAT_NAME) ? "+" : "",
+           seam->link & CONCAT_NAME ? "name" : "");
+    if (seam->timed) {
+      printf(", TimeGap: %" PRId64, seam->time_gap);
+    }
+    printf(", step: %f, nearby: %f, discontinuous: %s]\n", seam->step,
+           seam->nearby, concat_seam_discontinuous(seam) ? "yes" : "no");
+  }
+
+  if (opt->analyze &&
+      report_analysis(cat->wave, cat->in, cat->count) != EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  if (opt->cutoff &&
+      report_cutoff(cat->wave, cat->count, opt->cutoff_windows) !=
+          EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  if (opt->peaks && report_concat_peaks(cat) != EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  if (opt->sample && report_concat_sample(cat, opt->sample) != EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  return res;
+}
+
+/* Every report requested of a single file in turn, as for a run of
+ * --concat, or its chunks when none is */
+static int
+report_file(const char *path, const struct input *in, int levl,
+            const struct options *opt) {
+  int res = EXIT_SUCCESS;
+
+  if (!opt->get && !opt->sample && !opt->cutoff && !opt->spectrogram &&
+      !opt->analyze && !opt->tags && !opt->peaks && !opt->overview &&
+      !opt->write_levl) {
+    return parse_RIFF(in->raw, in->length);
+  }
+  if (opt->get && print_query(in->raw, in->length, opt->get) != EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  if (opt->sample &&
+      print_sample(in->raw, in->length, opt->sample) != EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  if (opt->tags && print_tags(in->raw, in->length) != EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  if (opt->analyze && print_analysis(path) != EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  if (opt->cutoff &&
+      print_cutoff(in->raw, in->length, opt->cutoff_windows) !=
+          EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  if ((opt->peaks || opt->overview || opt->write_levl) &&
+      print_peaks(levl, in->raw, in->length, opt) != EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  if (opt->spectrogram &&
+      print_spectrogram(in, opt->spectrogram, opt->jobs) != EXIT_SUCCESS) {
+    res = EXIT_FAILURE;
+  }
+  return res;
+}
+
+/* Joins the runs of consecutive segments among files and reports each
+ * run, its seams and the requested analyses of its stream. A run whose
+ * mapping fails with SIGBUS is reported as an I/O error. */
+static int
+print_concat(char *files[], size_t length, const struct options *opt) {
+  struct concat cat;
+  struct guard guard;
+  size_t i = 0;
+  int run;
+  int res = EXIT_SUCCESS;
+
+  while (i < length) {
+    memset(&cat, 0, sizeof(cat));
+    guard_push(&guard);
+    if (sigsetjmp(guard.env, 1) != 0) {
+      fprintf(stderr, "%s: %s\n", files[i], strerror(EIO));
+      run = EXIT_FAILURE;
+    } else if (concat_open(&cat, files + i, length - i) != EXIT_SUCCESS) {
+      fprintf(stderr, "%s: not a WAVE file with 'fmt ' and 'data'\n",
+              files[i]);
+      run = EXIT_FAILURE;
+    } else {
+      run = report_concat(&cat, opt);
+    }
+    guard_pop(&guard);
+    if (run != EXIT_SUCCESS) {
+      res = EXIT_FAILURE;
+    }
+    i += cat.count ? cat.count : 1;
+    concat_close(&cat);
+  }
+
+  return res;
+}
+
+/* bytes with an optional K, M or G suffix, 0 on error */
+static uint64_t
+parse_size(const char *s) {
+  char *end;
+  uint64_t res = strtoull(s, &end, 10);
+
+  switch (toupper((unsigned char)*end)) {
+  case 'G':
+    res *= 1024;
+    /* fallthrough */
+  case 'M':
+    res *= 1024;
+    /* fallthrough */
+  case 'K':
+    res *= 1024;
+    ++end;
+    break;
+  }
+  return *end == '\0' ? res : 0;
+}
+
+static void
+print_stats(void) {
+  input_stats_fput(stdout);
+}
+
+/* -1 when s names no enum input_strategy */
+static int
+parse_strategy(const char *s) {
+  int i;
+
+  for (i = INPUT_AUTO; i <= INPUT_DIRECT; ++i) {
+    if (strcmp(s, input_strategy_str((enum input_strategy)i)) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void
+usage(const char *prog) {
+  fprintf(stderr,
+          "%s [options] file\n"
+          "%s --classify file...\n"
+          "%s --concat [--analyze] [--cutoff] [--peaks] [--sample=N[,N]] "
+          "file...\n"
+          "%s --catalog=OUT [--jobs=N] [--resume] file...\n"
+          "%s --list=CATALOG | --shared=CATALOG\n"
+          "%s --timeline=CATALOG [HH:MM:SS-HH:MM:SS]\n"
+          "%s --diff OLD NEW\n"
+          "%s --arrow=OUT [--jobs=N] CATALOG\n"
+          "%s --dedupe=CATALOG [--jobs=N]\n"
+          "%s --edit=LIST [--jobs=N]\n"
+          "%s --align [--drift=N] ref other\n"
+          "%s --serve=SOCKET\n"
+          "  --classify        identify the container of each file\n"
+          "  --concat          join split recorder segments into one stream\n"
+          "                    and report the seams, see concat.h\n"
+          "  --catalog=OUT     scan files into a catalog, with per file\n"
+          "                    content defined chunk lists of the payload\n"
+          "  --jobs=N          worker threads, default one per allowed CPU\n"
+          "                    within the cgroup cpu.max quota\n"
+          "  --memory=SIZE     memory budget shared by the workers, K, M or\n"
+          "                    G suffix, default half the cgroup memory.max\n"
+          "  --metrics=FILE    counters in the Prometheus text format,\n"
+          "                    rewritten every few seconds\n"
+          "  --io=auto|mmap|pread|direct  how files read whole are brought\n"
+          "                    into memory, by default by filesystem\n"
+          "  --stats           files, bytes and throughput per filesystem\n"
+          "                    and --io strategy, at exit\n"
+          "  --resume          continue an interrupted --catalog from its\n"
+          "                    checkpoint\n"
+          "  --list=CATALOG    one line per catalog entry\n"
+          "  --shared=CATALOG  payload bytes shared between files\n"
+          "  --timeline=CATALOG  files recorded during a time of day range,\n"
+          "                    from their 'bext' TimeReference\n"
+          "  --diff            added, removed and modified files between\n"
+          "                    two catalogs\n"
+          "  --arrow=OUT       export a catalog with the tags of its files\n"
+          "                    as an Arrow IPC file\n"
+          "  --dedupe=CATALOG  share the extents of identical payloads\n"
+          "  --edit=LIST       apply tag edits from a CSV or NDJSON list,\n"
+          "                    see edit.h\n"
+          "  --align           offset of other from ref by cross-correlation\n"
+          "  --drift=N         clock drift fitted over N windows\n"
+          "  --serve=SOCKET    answer RANGE and METRICS requests, see serve.h\n"
+          "  --get=PATH[,PATH] bare values of e.g. 'LIST/INFO/INAM'\n"
+          "  --tags            LIST/INFO and ID3 metadata\n"
+          "  --analyze         effective bit depth and peak per channel\n"
+          "  --cutoff          spectral cut off, detects upsampled content\n"
+          "  --cutoff-windows=N  FFT windows sampled over the file\n"
+          "  --spectrogram=OUT  zoomable spectrogram tile pyramid for web\n"
+          "                    viewers, see spectrogram.h\n"
+          "  --sample=N[,N]    decode single frames, in O(1) per frame\n"
+          "  --peaks           per channel peak, from PEAK/levl when present\n"
+          "  --overview=N      N bucket peak envelope\n"
+          "  --write-levl      append a 'levl' peak envelope chunk\n",
+          prog, prog, prog, prog, prog, prog, prog, prog, prog, prog,
+          prog, prog);
+}
+
 int
 main(int argc, char *args[]) {
-  int fd;
-  struct stat st;
-  u8 *raw;
+  static const struct option longopts[] = {
+      {"catalog", required_argument, NULL, 'C'},
+      {"jobs", required_argument, NULL, 'j'},
+      {"memory", required_argument, NULL, 'M'},
+      {"metrics", required_argument, NULL, 'm'},
+      {"io", required_argument, NULL, 'I'},
+      {"stats", no_argument, NULL, 'Z'},
+      {"resume", no_argument, NULL, 'r'},
+      {"list", required_argument, NULL, 'l'},
+      {"shared", required_argument, NULL, 's'},
+      {"timeline", required_argument, NULL, 'T'},
+      {"diff", no_argument, NULL, 'd'},
+      {"arrow", required_argument, NULL, 'X'},
+      {"dedupe", required_argument, NULL, 'D'},
+      {"edit", required_argument, NULL, 'E'},
+      {"classify", no_argument, NULL, 'c'},
+      {"concat", no_argument, NULL, 'J'},
+      {"align", no_argument, NULL, 'A'},
+      {"drift", required_argument, NULL, 'R'},
+      {"serve", required_argument, NULL, 'V'},
+      {"get", required_argument, NULL, 'g'},
+      {"tags", no_argument, NULL, 't'},
+      {"analyze", no_argument, NULL, 'a'},
+      {"cutoff", no_argument, NULL, 'f'},
+      {"cutoff-windows", required_argument, NULL, 'F'},
+      {"spectrogram", required_argument, NULL, 'G'},
+      {"peaks", no_argument, NULL, 'p'},
+      {"sample", required_argument, NULL, 'S'},
+      {"overview", required_argument, NULL, 'o'},
+      {"write-levl", no_argument, NULL, 'W'},
+      {NULL, 0, NULL, 0},
+  };
+  struct options opt;
+  struct guard guard;
+  struct sniff sniff;
+  struct input in;
+  int levl;
   int res = EXIT_FAILURE;
+  int c, err;
 
-  if (argc != 2) {
-    fprintf(stderr, "%s file\n", args[0]);
+  memset(&opt, 0, sizeof(opt));
+  opt.jobs = pool_default_workers();
+  opt.memory = budget_default();
+  opt.cutoff_windows = SPECTRUM_WINDOWS;
+  opt.align_windows = 1;
+  while ((c = getopt_long(argc, args, "j:", longopts, NULL)) != -1) {
+    switch (c) {
+    case 'C':
+      opt.catalog = optarg;
+      break;
+    case 'j':
+      if ((opt.jobs = (unsigned)strtoul(optarg, NULL, 10)) == 0) {
+        usage(args[0]);
+        return res;
+      }
+      break;
+    case 'M':
+      if ((opt.memory = parse_size(optarg)) == 0) {
+        usage(args[0]);
+        return res;
+      }
+      break;
+    case 'm':
+      opt.metrics = optarg;
+      break;
+    case 'I':
+      if ((opt.io = parse_strategy(optarg)) < 0) {
+        usage(args[0]);
+        return res;
+      }
+      break;
+    case 'Z':
+      opt.stats = 1;
+      break;
+    case 'r':
+      opt.resume = 1;
+      break;
+    case 'l':
+      opt.list = optarg;
+      break;
+    case 's':
+      opt.shared = optarg;
+      break;
+    case 'T':
+      opt.timeline = optarg;
+      break;
+    case 'd':
+      opt.diff = 1;
+      break;
+    case 'X':
+      opt.arrow = optarg;
+      break;
+    case 'D':
+      opt.dedupe = optarg;
+      break;
+    case 'E':
+      opt.edit = optarg;
+      break;
+    case 'c':
+      opt.classify = 1;
+      break;
+    case 'J':
+      opt.concat = 1;
+      break;
+    case 'A':
+      opt.align = 1;
+      break;
+    case 'R':
+      opt.align = 1;
+      if ((opt.align_windows = (unsigned)strtoul(optarg, NULL, 10)) < 2) {
+        usage(args[0]);
+        return res;
+      }
+      break;
+    case 'V':
+      opt.serve = optarg;
+      break;
+    case 'g':
+      opt.get = optarg;
+      break;
+    case 't':
+      opt.tags = 1;
+      break;
+    case 'a':
+      opt.analyze = 1;
+      break;
+    case 'f':
+      opt.cutoff = 1;
+      break;
+    case 'F':
+      opt.cutoff = 1;
+      if ((opt.cutoff_windows = (unsigned)strtoul(optarg, NULL, 10)) == 0) {
+        usage(args[0]);
+        return res;
+      }
+      break;
+    case 'p':
+      opt.peaks = 1;
+      break;
+    case 'S':
+      opt.sample = optarg;
+      break;
+    case 'o':
+      opt.overview = (uint32_t)strtoul(optarg, NULL, 10);
+      if (opt.overview == 0) {
+        usage(args[0]);
+        return res;
+      }
+      break;
+    case 'W':
+      opt.write_levl = 1;
+      break;
+    case 'G':
+      opt.spectrogram = optarg;
+      break;
+    default:
+      usage(args[0]);
+      return res;
+    }
+  }
+  budget_set(opt.memory);
+  metrics_init();
+  if (opt.metrics) {
+    if (metrics_file_start(opt.metrics) != EXIT_SUCCESS) {
+      return res;
+    }
+    atexit(metrics_file_stop);
+  }
+  input_set_strategy((enum input_strategy)opt.io);
+  if (opt.stats) {
+    atexit(print_stats);
   }
 
-  if ((fd = open(args[1], O_RDONLY)) < 0) {
-    fprintf(stderr, "open(%s): %s\n", args[1], strerror(errno));
+  if (opt.serve) {
+    return serve(opt.serve);
+  }
+  if (opt.list) {
+    return print_catalog(opt.list);
+  }
+  if (opt.shared) {
+    return print_shared(opt.shared);
+  }
+  if (opt.diff) {
+    if (optind + 2 != argc) {
+      usage(args[0]);
+      return res;
+    }
+    return print_diff(args[optind], args[optind + 1]);
+  }
+  if (opt.timeline) {
+    if (argc - optind > 1) {
+      usage(args[0]);
+      return res;
+    }
+    return print_timeline(opt.timeline, optind < argc ? args[optind] : NULL);
+  }
+  if (opt.arrow) {
+    struct catalog cat;
+    if (optind + 1 != argc) {
+      usage(args[0]);
+      return res;
+    }
+    if (catalog_open(&cat, args[optind]) != EXIT_SUCCESS) {
+      return res;
+    }
+    res = export_arrow(&cat, opt.arrow, opt.jobs);
+    catalog_close(&cat);
     return res;
   }
-
-  if (fstat(fd, &st) < 0) {
-    fprintf(stderr, "fstat(%s): %s\n", args[1], strerror(errno));
-    goto Lclose;
+  if (opt.dedupe) {
+    struct catalog cat;
+    if (catalog_open(&cat, opt.dedupe) != EXIT_SUCCESS) {
+      return res;
+    }
+    res = dedupe_catalog(&cat, opt.jobs);
+    catalog_close(&cat);
+    return res;
+  }
+  if (opt.edit) {
+    return edit_bulk(opt.edit, opt.jobs);
+  }
+  if (opt.catalog && optind < argc) {
+    return catalog_build(opt.catalog, args + optind, (size_t)(argc - optind),
+                         opt.jobs, opt.resume);
+  }
+  if (opt.classify && optind < argc) {
+    return classify_files(args + optind, argc - optind);
+  }
+  if (opt.concat && optind < argc) {
+    return print_concat(args + optind, (size_t)(argc - optind), &opt);
+  }
+  if (opt.align) {
+    if (optind + 2 != argc) {
+      usage(args[0]);
+      return res;
+    }
+    return print_align(args[optind], args[optind + 1], opt.align_windows);
+  }
+  if (optind + 1 != argc) {
+    usage(args[0]);
+    return res;
   }
 
-  if ((raw = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
-      MAP_FAILED) {
-    fprintf(stderr, "mmap(): %s\n", strerror(errno));
+  /* the reports share a mapping, --analyze reads the file again with the
+   * strategy of its filesystem */
+  if ((err = input_open(&in, args[optind])) != 0) {
+    fprintf(stderr, "open(%s): %s\n", args[optind], strerror(err));
+    return res;
+  }
+  levl = in.fd;
+  if (opt.write_levl && (levl = input_fd(args[optind], O_RDWR)) < 0) {
+    fprintf(stderr, "open(%s): %s\n", args[optind], strerror(errno));
     goto Lclose;
   }
 
-  res = parse_RIFF(raw, (size_t)st.st_size);
+  /* a file truncated while mapped fails instead of killing the process */
+  guard_push(&guard);
+  if (sigsetjmp(guard.env, 1) != 0) {
+    fprintf(stderr, "%s: %s\n", args[optind], strerror(EIO));
+    res = EXIT_FAILURE;
+  } else if (sniff_buf(in.raw,
+                       in.length < SNIFF_BYTES ? in.length : SNIFF_BYTES,
+                       &sniff),
+             !sniff_is_riff(&sniff)) {
+    fprintf(stderr, "%s: %s container is not supported\n", args[optind],
+            sniff_container_str(sniff.container));
+  } else {
+    res = report_file(args[optind], &in, levl, &opt);
+  }
+  guard_pop(&guard);
 
-  munmap(raw, (size_t)st.st_size);
+  if (levl != in.fd) {
+    close(levl);
+  }
 Lclose:
-  close(fd);
+  input_close(&in);
   return res;
 }
 
@@ -0,0 +1,116 @@
+#ifndef RIFF_H
+#define RIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* https://sites.google.com/site/musicgapi/technical-documents/wav-file-format
+ * http://soundfile.sapp.org/doc/WaveFormat/
+ *
+ * Non-printing chunk walker shared by the analysis modes. Every pointer
+ * handed out points into the caller's mapping, nothing is copied.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef unsigned char u8;
+
+static inline uint16_t
+rd_le16(const u8 *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t
+rd_le32(const u8 *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static inline void
+wr_le16(u8 *p, uint16_t v) {
+  p[0] = (u8)v;
+  p[1] = (u8)(v >> 8);
+}
+
+static inline void
+wr_le32(u8 *p, uint32_t v) {
+  p[0] = (u8)v;
+  p[1] = (u8)(v >> 8);
+  p[2] = (u8)(v >> 16);
+  p[3] = (u8)(v >> 24);
+}
+
+struct riff_chunk {
+  char id[4];
+  uint32_t size;
+  /* NULL when the chunk is absent */
+  const u8 *data;
+};
+
+struct riff_iter {
+  const u8 *it;
+  const u8 *end;
+};
+
+struct riff_fmt {
+  uint16_t AudioFormat;
+  uint16_t NumChannels;
+  uint32_t SampleRate;
+  uint32_t ByteRate;
+  uint16_t BlockAlign;
+  uint16_t BitsPerSample;
+  /* WAVE_FORMAT_EXTENSIBLE: first two bytes of the SubFormat GUID, else 0 */
+  uint16_t SubFormat;
+  /* the cbSize bytes of format specific fields following cbSize, NULL
+   * when the chunk has none */
+  uint16_t cbSize;
+  const u8 *extension;
+};
+
+struct riff_wave {
+  char form[4];
+  struct riff_fmt fmt;
+  struct riff_chunk data;
+  struct riff_chunk levl;
+  struct riff_chunk peak;
+  struct riff_chunk bext;
+};
+
+/* Validates the RIFF header and positions the iterator at the first
+ * SubChunk. The form type ("WAVE", "AVI ", ...) is stored in form. */
+int
+riff_iter_init(struct riff_iter *self, const u8 *raw, size_t length,
+               char form[4]);
+
+/* Returns 1 and fills out with the next SubChunk, 0 at the end of the
+ * RIFF and -1 on a malformed chunk header. Odd sized chunks are followed by
+ * a pad byte which is skipped. */
+int
+riff_iter_next(struct riff_iter *self, struct riff_chunk *out);
+
+int
+riff_fmt_parse(const struct riff_chunk *chunk, struct riff_fmt *out);
+
+/* The AudioFormat with WAVE_FORMAT_EXTENSIBLE resolved to its SubFormat */
+uint16_t
+riff_fmt_code(const struct riff_fmt *fmt);
+
+int
+riff_wave_parse(const u8 *raw, size_t length, struct riff_wave *out);
+
+/* Number of complete sample frames in the data chunk */
+uint64_t
+riff_wave_frames(const struct riff_wave *wave);
+
+/* EBU Tech 3285 'bext' TimeReference: the first sample counted from
+ * midnight. Fails when there is no 'bext' chunk. */
+int
+riff_wave_time_reference(const struct riff_wave *wave, uint64_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
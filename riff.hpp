@@ -0,0 +1,280 @@
+#ifndef RIFF_HPP
+#define RIFF_HPP
+
+// Header only C++14 layer over riff.h for consumers of the 'data' payload.
+//
+// Views point straight into the caller's mapping like the C API, nothing is
+// copied. The sample type and optionally the channel count are template
+// parameters, so the conversion loops are instantiated per format with no
+// per sample dispatch and a fixed inner trip count the compiler can
+// unroll and vectorise. The format is checked once, when the view is made.
+
+#include "riff.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+namespace riff {
+
+class error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Packed little endian 24-bit sample
+struct int24 {
+  u8 bytes[3];
+};
+static_assert(sizeof(int24) == 3, "int24 must be packed");
+
+template <class T> struct sample_traits;
+
+template <> struct sample_traits<std::uint8_t> {
+  static constexpr std::uint16_t format = 0x0001;
+  static constexpr unsigned bytes = 1;
+  static std::int32_t load_int(const u8 *p) {
+    return std::int32_t(p[0]) - 128;
+  }
+  static float load(const u8 *p) {
+    return float(load_int(p)) * (1.0f / 128);
+  }
+};
+
+template <> struct sample_traits<std::int16_t> {
+  static constexpr std::uint16_t format = 0x0001;
+  static constexpr unsigned bytes = 2;
+  static std::int32_t load_int(const u8 *p) {
+    return std::int16_t(rd_le16(p));
+  }
+  static float load(const u8 *p) {
+    return float(load_int(p)) * (1.0f / 32768);
+  }
+};
+
+template <> struct sample_traits<int24> {
+  static constexpr std::uint16_t format = 0x0001;
+  static constexpr unsigned bytes = 3;
+  static std::int32_t load_int(const u8 *p) {
+    return std::int32_t(std::uint32_t(p[0]) << 8 | std::uint32_t(p[1]) << 16 |
+                        std::uint32_t(p[2]) << 24) >>
+           8;
+  }
+  static float load(const u8 *p) {
+    return float(load_int(p)) * (1.0f / 8388608);
+  }
+};
+
+template <> struct sample_traits<std::int32_t> {
+  static constexpr std::uint16_t format = 0x0001;
+  static constexpr unsigned bytes = 4;
+  static std::int32_t load_int(const u8 *p) {
+    return std::int32_t(rd_le32(p));
+  }
+  static float load(const u8 *p) {
+    return float(load_int(p)) * (1.0f / 2147483648.0f);
+  }
+};
+
+template <> struct sample_traits<float> {
+  static constexpr std::uint16_t format = 0x0003;
+  static constexpr unsigned bytes = 4;
+  static float load(const u8 *p) {
+    std::uint32_t bits = rd_le32(p);
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+  }
+};
+
+// A chunk of the RIFF, data() points into the mapping
+class chunk {
+public:
+  chunk() : c_() {}
+  explicit chunk(const riff_chunk &c) : c_(c) {}
+
+  bool is(const char (&id)[5]) const {
+    return std::memcmp(c_.id, id, 4) == 0;
+  }
+  const char *id() const { return c_.id; }
+  std::uint32_t size() const { return c_.size; }
+  const u8 *data() const { return c_.data; }
+  explicit operator bool() const { return c_.data != nullptr; }
+  const riff_chunk &raw() const { return c_; }
+
+private:
+  riff_chunk c_;
+};
+
+// Range over the SubChunks of a RIFF. A malformed chunk header ends the
+// walk with riff::error.
+class chunks {
+public:
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = chunk;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const chunk *;
+    using reference = const chunk &;
+
+    iterator() : iter_(), cur_(), end_(true) {}
+    explicit iterator(const riff_iter &it) : iter_(it), cur_(), end_(false) {
+      next();
+    }
+
+    reference operator*() const { return cur_; }
+    pointer operator->() const { return &cur_; }
+    iterator &operator++() {
+      next();
+      return *this;
+    }
+    bool operator==(const iterator &o) const {
+      return end_ == o.end_ && (end_ || iter_.it == o.iter_.it);
+    }
+    bool operator!=(const iterator &o) const { return !(*this == o); }
+
+  private:
+    void next() {
+      riff_chunk c;
+      int res = riff_iter_next(&iter_, &c);
+      if (res < 0) {
+        throw error("malformed chunk header");
+      }
+      end_ = res == 0;
+      cur_ = chunk(c);
+    }
+
+    riff_iter iter_;
+    chunk cur_;
+    bool end_;
+  };
+
+  chunks(const void *raw, std::size_t length) {
+    if (riff_iter_init(&iter_, static_cast<const u8 *>(raw), length, form_) !=
+        0) {
+      throw error("not a RIFF");
+    }
+  }
+
+  const char *form() const { return form_; }
+  iterator begin() const { return iterator(iter_); }
+  iterator end() const { return iterator(); }
+
+private:
+  riff_iter iter_;
+  char form_[4];
+};
+
+// Interleaved samples of type T. Channels is the channel count fixed at
+// compile time, or 0 to take it from the 'fmt ' chunk.
+template <class T, unsigned Channels = 0> class sample_view {
+public:
+  using traits = sample_traits<T>;
+
+  sample_view(const u8 *data, std::size_t frames, unsigned channels,
+              std::size_t stride)
+      : data_(data), frames_(frames), channels_(channels), stride_(stride) {}
+
+  std::size_t frames() const { return frames_; }
+  unsigned channels() const { return Channels ? Channels : channels_; }
+  std::size_t size() const { return frames_ * channels(); }
+  const u8 *data() const { return data_; }
+
+  float operator()(std::size_t frame, unsigned channel) const {
+    return traits::load(at(frame, channel));
+  }
+
+  // Interleaved samples normalised to [-1.0, 1.0], size() floats
+  void to_float(float *out) const {
+    // frames are packed, so the payload is one flat run of samples
+    const std::size_t n = size();
+    for (std::size_t i = 0; i < n; ++i) {
+      out[i] = traits::load(data_ + i * traits::bytes);
+    }
+  }
+
+  // One channel normalised to [-1.0, 1.0], frames() floats
+  void channel_to_float(unsigned channel, float *out) const {
+    const u8 *it = data_ + channel * traits::bytes;
+    for (std::size_t f = 0; f < frames_; ++f) {
+      out[f] = traits::load(it + f * stride_);
+    }
+  }
+
+  // Calls fn(frame, const float (&)[N]) per frame, Channels must be fixed
+  template <class Fn> void for_each_frame(Fn &&fn) const {
+    static_assert(Channels != 0, "for_each_frame needs a channel count");
+    float frame[Channels == 0 ? 1 : Channels];
+    for (std::size_t f = 0; f < frames_; ++f) {
+      const u8 *it = data_ + f * stride_;
+      for (unsigned c = 0; c < Channels; ++c) {
+        frame[c] = traits::load(it + c * traits::bytes);
+      }
+      fn(f, static_cast<const float(&)[Channels == 0 ? 1 : Channels]>(frame));
+    }
+  }
+
+  sample_view subview(std::size_t first, std::size_t count) const {
+    if (first > frames_) {
+      first = frames_;
+    }
+    if (count > frames_ - first) {
+      count = frames_ - first;
+    }
+    return sample_view(data_ + first * stride_, count, channels_, stride_);
+  }
+
+private:
+  const u8 *at(std::size_t frame, unsigned channel) const {
+    return data_ + frame * stride_ + channel * traits::bytes;
+  }
+
+  const u8 *data_;
+  std::size_t frames_;
+  unsigned channels_;
+  std::size_t stride_;
+};
+
+// A parsed WAVE, see riff_wave_parse
+class wave {
+public:
+  wave(const void *raw, std::size_t length) {
+    if (riff_wave_parse(static_cast<const u8 *>(raw), length, &w_) != 0) {
+      throw error("not a WAVE file with 'fmt ' and 'data'");
+    }
+  }
+
+  const riff_fmt &fmt() const { return w_.fmt; }
+  std::uint16_t format() const { return riff_fmt_code(&w_.fmt); }
+  std::uint64_t frames() const { return riff_wave_frames(&w_); }
+  chunk data() const { return chunk(w_.data); }
+  const riff_wave &raw() const { return w_; }
+
+  // Whether the payload can be viewed as samples of type T
+  template <class T, unsigned Channels = 0> bool holds() const {
+    using traits = sample_traits<T>;
+    return format() == traits::format &&
+           (Channels == 0 || w_.fmt.NumChannels == Channels) &&
+           w_.fmt.NumChannels != 0 &&
+           w_.fmt.BlockAlign == w_.fmt.NumChannels * traits::bytes;
+  }
+
+  template <class T, unsigned Channels = 0>
+  sample_view<T, Channels> samples() const {
+    if (!holds<T, Channels>()) {
+      throw error("payload does not hold the requested sample type");
+    }
+    return sample_view<T, Channels>(w_.data.data, std::size_t(frames()),
+                                    w_.fmt.NumChannels, w_.fmt.BlockAlign);
+  }
+
+private:
+  riff_wave w_;
+};
+
+} // namespace riff
+
+#endif
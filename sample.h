@@ -0,0 +1,125 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include "riff.h"
+
+#include <string.h>
+
+/* Linear PCM and IEEE float sample decoding for the analysis kernels.
+ * Samples are loaded from the mapping and normalised to [-1.0, 1.0]. */
+
+enum sample_kind {
+  SAMPLE_UNSUPPORTED = 0,
+  SAMPLE_U8,
+  SAMPLE_S16,
+  SAMPLE_S24,
+  SAMPLE_S32,
+  SAMPLE_F32,
+  SAMPLE_F64,
+};
+
+static inline enum sample_kind
+sample_kind(const struct riff_fmt *fmt) {
+  uint16_t code = riff_fmt_code(fmt);
+  unsigned container;
+
+  if (fmt->NumChannels == 0 || fmt->BlockAlign % fmt->NumChannels != 0) {
+    return SAMPLE_UNSUPPORTED;
+  }
+  container = fmt->BlockAlign / fmt->NumChannels;
+
+  if (code == 0x0001) {
+    switch (container) {
+    case 1:
+      return SAMPLE_U8;
+    case 2:
+      return SAMPLE_S16;
+    case 3:
+      return SAMPLE_S24;
+    case 4:
+      return SAMPLE_S32;
+    }
+  } else if (code == 0x0003) {
+    switch (container) {
+    case 4:
+      return SAMPLE_F32;
+    case 8:
+      return SAMPLE_F64;
+    }
+  }
+
+  return SAMPLE_UNSUPPORTED;
+}
+
+static inline unsigned
+sample_bytes(enum sample_kind kind) {
+  switch (kind) {
+  case SAMPLE_U8:
+    return 1;
+  case SAMPLE_S16:
+    return 2;
+  case SAMPLE_S24:
+    return 3;
+  case SAMPLE_S32:
+  case SAMPLE_F32:
+    return 4;
+  case SAMPLE_F64:
+    return 8;
+  case SAMPLE_UNSUPPORTED:
+    break;
+  }
+  return 0;
+}
+
+/* Integer formats as a sign extended value, not normalised */
+static inline int32_t
+sample_load_int(const u8 *p, enum sample_kind kind) {
+  switch (kind) {
+  case SAMPLE_U8:
+    return (int32_t)p[0] - 128;
+  case SAMPLE_S16:
+    return (int16_t)rd_le16(p);
+  case SAMPLE_S24:
+    return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) |
+                     ((uint32_t)p[2] << 24)) >>
+           8;
+  case SAMPLE_S32:
+    return (int32_t)rd_le32(p);
+  case SAMPLE_F32:
+  case SAMPLE_F64:
+  case SAMPLE_UNSUPPORTED:
+    break;
+  }
+  return 0;
+}
+
+static inline double
+sample_load(const u8 *p, enum sample_kind kind) {
+  switch (kind) {
+  case SAMPLE_U8:
+    return (double)sample_load_int(p, kind) / 128.0;
+  case SAMPLE_S16:
+    return (double)sample_load_int(p, kind) / 32768.0;
+  case SAMPLE_S24:
+    return (double)sample_load_int(p, kind) / 8388608.0;
+  case SAMPLE_S32:
+    return (double)sample_load_int(p, kind) / 2147483648.0;
+  case SAMPLE_F32: {
+    uint32_t bits = rd_le32(p);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return (double)f;
+  }
+  case SAMPLE_F64: {
+    uint64_t bits = (uint64_t)rd_le32(p) | ((uint64_t)rd_le32(p + 4) << 32);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+  }
+  case SAMPLE_UNSUPPORTED:
+    break;
+  }
+  return 0.0;
+}
+
+#endif
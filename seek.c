@@ -0,0 +1,379 @@
+#include "seek.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const int16_t ima_steps[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static const int8_t ima_index[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+static const int16_t ms_adapt[16] = {
+    230, 230, 230, 230, 307, 409, 512, 614,
+    768, 614, 512, 409, 307, 230, 230, 230,
+};
+
+static const int16_t ms_coefs[7][2] = {
+    {256, 0}, {512, -256}, {0, 0}, {192, 64},
+    {240, 0}, {460, -208}, {392, -232},
+};
+
+static int32_t
+clamp16(int32_t v) {
+  return v < -32768 ? -32768 : v > 32767 ? 32767 : v;
+}
+
+static int32_t
+alaw_decode(u8 a) {
+  int32_t t, seg;
+
+  a ^= 0x55;
+  t = (a & 0x0F) << 4;
+  seg = (a & 0x70) >> 4;
+  if (seg == 0) {
+    t += 8;
+  } else {
+    t = (t + 0x108) << (seg - 1);
+  }
+  return (a & 0x80) ? t : -t;
+}
+
+static int32_t
+ulaw_decode(u8 u) {
+  int32_t t;
+
+  u = (u8)~u;
+  t = (((u & 0x0F) << 3) + 0x84) << ((u & 0x70) >> 4);
+  return (u & 0x80) ? 0x84 - t : t - 0x84;
+}
+
+/* Frames in a block of length bytes, the last block may be short */
+static uint32_t
+block_frames(const struct seek *self, uint64_t length) {
+  const uint32_t ch = self->channels;
+  uint64_t frames;
+
+  switch (self->codec) {
+  case SEEK_IMA_ADPCM:
+    if (length < 4 * ch) {
+      return 0;
+    }
+    frames = 1 + (length - 4 * ch) / (4 * ch) * 8;
+    break;
+  case SEEK_MS_ADPCM:
+    if (length < 7 * ch) {
+      return 0;
+    }
+    frames = 2 + (length - 7 * ch) * 2 / ch;
+    break;
+  default:
+    frames = length / self->block_align;
+    break;
+  }
+  return frames < self->frames_per_block ? (uint32_t)frames
+                                         : self->frames_per_block;
+}
+
+int
+seek_init(struct seek *self, const struct riff_wave *wave) {
+  const struct riff_fmt *fmt = &wave->fmt;
+  const uint32_t ch = fmt->NumChannels;
+  uint64_t blocks;
+
+  memset(self, 0, sizeof(*self));
+  self->channels = ch;
+  self->block_align = fmt->BlockAlign;
+  self->data = wave->data.data;
+  self->size = wave->data.size;
+  self->frames_per_block = 1;
+  if (ch == 0 || fmt->BlockAlign == 0) {
+    return EXIT_FAILURE;
+  }
+
+  switch (riff_fmt_code(fmt)) {
+  case 0x0002:
+    if (fmt->BitsPerSample != 4 || fmt->BlockAlign < 7 * ch) {
+      return EXIT_FAILURE;
+    }
+    self->codec = SEEK_MS_ADPCM;
+    self->frames_per_block = (fmt->BlockAlign - 7 * ch) * 2 / ch + 2;
+    memcpy(self->coef, ms_coefs, sizeof(ms_coefs));
+    self->coefs = 7;
+    /* wSamplesPerBlock, wNumCoef, aCoef[] */
+    if (fmt->cbSize >= 4) {
+      unsigned n = rd_le16(fmt->extension + 2);
+      unsigned i;
+      self->frames_per_block = rd_le16(fmt->extension);
+      if (n > SEEK_MS_COEFS || 4 + 4 * (uint32_t)n > fmt->cbSize) {
+        return EXIT_FAILURE;
+      }
+      for (i = 0; i < n; ++i) {
+        self->coef[i][0] = (int16_t)rd_le16(fmt->extension + 4 + 4 * i);
+        self->coef[i][1] = (int16_t)rd_le16(fmt->extension + 6 + 4 * i);
+      }
+      if (n > 0) {
+        self->coefs = n;
+      }
+    }
+    break;
+  case 0x0011:
+    if (fmt->BitsPerSample != 4 || fmt->BlockAlign < 4 * ch ||
+        (fmt->BlockAlign - 4 * ch) % (4 * ch) != 0) {
+      return EXIT_FAILURE;
+    }
+    self->codec = SEEK_IMA_ADPCM;
+    self->frames_per_block = (fmt->BlockAlign - 4 * ch) / (4 * ch) * 8 + 1;
+    /* wSamplesPerBlock */
+    if (fmt->cbSize >= 2) {
+      self->frames_per_block = rd_le16(fmt->extension);
+    }
+    break;
+  case 0x0006:
+  case 0x0007:
+    if (fmt->BlockAlign != ch) {
+      return EXIT_FAILURE;
+    }
+    self->codec = riff_fmt_code(fmt) == 0x0006 ? SEEK_ALAW : SEEK_ULAW;
+    break;
+  default:
+    if ((self->kind = sample_kind(fmt)) == SAMPLE_UNSUPPORTED) {
+      return EXIT_FAILURE;
+    }
+    self->codec = SEEK_PCM;
+    break;
+  }
+  if (self->frames_per_block == 0 ||
+      block_frames(self, self->block_align) < self->frames_per_block) {
+    /* wSamplesPerBlock does not fit BlockAlign */
+    self->codec = SEEK_UNSUPPORTED;
+    return EXIT_FAILURE;
+  }
+
+  blocks = self->size / self->block_align;
+  self->frames = blocks * self->frames_per_block +
+                 block_frames(self, self->size % self->block_align);
+  return EXIT_SUCCESS;
+}
+
+const char *
+seek_codec_str(enum seek_codec codec) {
+  switch (codec) {
+  case SEEK_PCM:
+    return "PCM";
+  case SEEK_ALAW:
+    return "A-law";
+  case SEEK_ULAW:
+    return "u-law";
+  case SEEK_IMA_ADPCM:
+    return "IMA ADPCM";
+  case SEEK_MS_ADPCM:
+    return "MS ADPCM";
+  case SEEK_UNSUPPORTED:
+    break;
+  }
+  return "unsupported";
+}
+
+int
+seek_locate(const struct seek *self, uint64_t frame,
+            struct seek_location *out) {
+  uint64_t block, end;
+
+  if (self->codec == SEEK_UNSUPPORTED || frame >= self->frames) {
+    return EXIT_FAILURE;
+  }
+  block = frame / self->frames_per_block;
+  out->first = block * self->frames_per_block;
+  out->index = (uint32_t)(frame - out->first);
+  out->offset = block * self->block_align;
+  end = out->offset + self->block_align;
+  out->length = (uint32_t)((end < self->size ? end : self->size) -
+                           out->offset);
+  return EXIT_SUCCESS;
+}
+
+/* Decodes frames [0, count) of channel c into out[k * stride]. A stride
+ * of 0 leaves only the last frame in out[0]. */
+static void
+ima_channel(const struct seek *self, const u8 *block, uint32_t c,
+            uint32_t count, double *out, size_t stride) {
+  const uint32_t ch = self->channels;
+  const u8 *header = block + 4 * c;
+  int32_t predictor = (int16_t)rd_le16(header);
+  int32_t step = header[2] > 88 ? 88 : header[2];
+  uint32_t k;
+
+  out[0] = predictor / 32768.0;
+  /* 4 bytes of 8 nibbles per channel in turn, low nibble first */
+  for (k = 1; k < count; ++k) {
+    const uint32_t j = (k - 1) % 8;
+    const u8 byte = block[4 * ch + (k - 1) / 8 * 4 * ch + 4 * c + j / 2];
+    const unsigned n = (j & 1) ? byte >> 4 : byte & 0x0F;
+    const int32_t s = ima_steps[step];
+    int32_t diff = s >> 3;
+
+    if (n & 4) {
+      diff += s;
+    }
+    if (n & 2) {
+      diff += s >> 1;
+    }
+    if (n & 1) {
+      diff += s >> 2;
+    }
+    predictor = clamp16((n & 8) ? predictor - diff : predictor + diff);
+    step += ima_index[n & 7];
+    step = step < 0 ? 0 : step > 88 ? 88 : step;
+    out[k * stride] = predictor / 32768.0;
+  }
+}
+
+static void
+ms_channel(const struct seek *self, const u8 *block, uint32_t c,
+           uint32_t count, double *out, size_t stride) {
+  const uint32_t ch = self->channels;
+  unsigned predictor = block[c];
+  int32_t delta = (int16_t)rd_le16(block + ch + 2 * c);
+  int32_t s1 = (int16_t)rd_le16(block + 3 * ch + 2 * c);
+  int32_t s2 = (int16_t)rd_le16(block + 5 * ch + 2 * c);
+  int32_t c1, c2;
+  uint32_t k;
+
+  if (predictor >= self->coefs) {
+    predictor = 0;
+  }
+  c1 = self->coef[predictor][0];
+  c2 = self->coef[predictor][1];
+
+  /* the header holds the first two frames, oldest second */
+  out[0] = s2 / 32768.0;
+  if (count > 1) {
+    out[stride] = s1 / 32768.0;
+  }
+  /* nibbles interleaved over the channels, high nibble first */
+  for (k = 2; k < count; ++k) {
+    const uint32_t nibble = (k - 2) * ch + c;
+    const u8 byte = block[7 * ch + nibble / 2];
+    const unsigned n = (nibble & 1) ? byte & 0x0F : byte >> 4;
+    const int32_t sn = n >= 8 ? (int32_t)n - 16 : (int32_t)n;
+    int32_t predicted = (s1 * c1 + s2 * c2) / 256 + sn * delta;
+
+    s2 = s1;
+    s1 = clamp16(predicted);
+    delta = delta * ms_adapt[n] / 256;
+    if (delta < 16) {
+      delta = 16;
+    }
+    out[k * stride] = s1 / 32768.0;
+  }
+}
+
+/* Frames [0, count) of the block, interleaved */
+static void
+block_decode(const struct seek *self, const u8 *block, uint32_t count,
+             double *out, size_t stride) {
+  uint32_t c;
+
+  for (c = 0; c < self->channels; ++c) {
+    if (self->codec == SEEK_IMA_ADPCM) {
+      ima_channel(self, block, c, count, out + c, stride);
+    } else {
+      ms_channel(self, block, c, count, out + c, stride);
+    }
+  }
+}
+
+int
+seek_frame(const struct seek *self, uint64_t frame, double *out) {
+  struct seek_location loc;
+  const u8 *block;
+  uint32_t c;
+
+  if (seek_locate(self, frame, &loc) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  block = self->data + loc.offset;
+
+  switch (self->codec) {
+  case SEEK_PCM: {
+    const unsigned width = sample_bytes(self->kind);
+    for (c = 0; c < self->channels; ++c) {
+      out[c] = sample_load(block + c * width, self->kind);
+    }
+    break;
+  }
+  case SEEK_ALAW:
+    for (c = 0; c < self->channels; ++c) {
+      out[c] = alaw_decode(block[c]) / 32768.0;
+    }
+    break;
+  case SEEK_ULAW:
+    for (c = 0; c < self->channels; ++c) {
+      out[c] = ulaw_decode(block[c]) / 32768.0;
+    }
+    break;
+  case SEEK_IMA_ADPCM:
+  case SEEK_MS_ADPCM:
+    block_decode(self, block, loc.index + 1, out, 0);
+    break;
+  case SEEK_UNSUPPORTED:
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int
+seek_frames(const struct seek *self, uint64_t first, size_t count,
+            double *out) {
+  const uint32_t ch = self->channels;
+  struct seek_location loc;
+  double *tmp;
+  size_t i;
+
+  if (first > self->frames || count > self->frames - first) {
+    return EXIT_FAILURE;
+  }
+  if (self->codec != SEEK_IMA_ADPCM && self->codec != SEEK_MS_ADPCM) {
+    for (i = 0; i < count; ++i) {
+      if (seek_frame(self, first + i, out + i * ch) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+      }
+    }
+    return EXIT_SUCCESS;
+  }
+
+  /* every block in the range is decoded once */
+  if (!(tmp = malloc((size_t)self->frames_per_block * ch * sizeof(*tmp)))) {
+    return EXIT_FAILURE;
+  }
+  while (count > 0) {
+    size_t n;
+    if (seek_locate(self, first, &loc) != EXIT_SUCCESS) {
+      free(tmp);
+      return EXIT_FAILURE;
+    }
+    n = self->frames_per_block - loc.index;
+    if (n > count) {
+      n = count;
+    }
+    block_decode(self, self->data + loc.offset, loc.index + (uint32_t)n, tmp,
+                 ch);
+    memcpy(out, tmp + (size_t)loc.index * ch, n * ch * sizeof(*out));
+    out += n * ch;
+    first += n;
+    count -= n;
+  }
+  free(tmp);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+#ifndef SEEK_H
+#define SEEK_H
+
+#include "riff.h"
+#include "sample.h"
+
+/* Random access to single sample frames of the 'data' payload.
+ *
+ * Every supported format maps a frame to its block in O(1): linear PCM,
+ * IEEE float and G.711 have one frame per block, IMA and Microsoft ADPCM
+ * have fixed size blocks of wSamplesPerBlock frames. Reading a frame
+ * decodes only the block holding it, up to the frame.
+ */
+
+enum seek_codec {
+  SEEK_UNSUPPORTED = 0,
+  SEEK_PCM, /* linear PCM and IEEE float, see sample_kind */
+  SEEK_ALAW,
+  SEEK_ULAW,
+  SEEK_IMA_ADPCM,
+  SEEK_MS_ADPCM,
+};
+
+#define SEEK_MS_COEFS 256
+
+struct seek {
+  enum seek_codec codec;
+  enum sample_kind kind;
+  uint32_t channels;
+  uint32_t block_align;
+  uint32_t frames_per_block;
+  uint64_t frames;
+  const u8 *data;
+  uint64_t size;
+  /* Microsoft ADPCM predictor coefficients */
+  unsigned coefs;
+  int16_t coef[SEEK_MS_COEFS][2];
+};
+
+struct seek_location {
+  /* the block holding the frame, relative to the start of 'data' */
+  uint64_t offset;
+  uint32_t length;
+  /* first frame of the block and the frame within it */
+  uint64_t first;
+  uint32_t index;
+};
+
+int
+seek_init(struct seek *self, const struct riff_wave *wave);
+
+const char *
+seek_codec_str(enum seek_codec codec);
+
+/* O(1), fails past the last frame */
+int
+seek_locate(const struct seek *self, uint64_t frame,
+            struct seek_location *out);
+
+/* Decodes one frame, normalised to [-1.0, 1.0], into channels doubles */
+int
+seek_frame(const struct seek *self, uint64_t frame, double *out);
+
+/* Decodes count frames from first, interleaved, decoding each block of
+ * the range once */
+int
+seek_frames(const struct seek *self, uint64_t first, size_t count,
+            double *out);
+
+#endif
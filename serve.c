@@ -0,0 +1,566 @@
+#define _GNU_SOURCE
+
+#include "serve.h"
+#include "guard.h"
+#include "input.h"
+#include "metrics.h"
+#include "seek.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+enum serve_format {
+  SERVE_S16,
+  SERVE_F32,
+};
+
+struct serve_file {
+  char *path;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  struct input in;
+  struct riff_wave wave;
+  struct seek seek;
+  unsigned refs;
+  uint64_t used;
+  int cached;
+};
+
+static struct {
+  pthread_mutex_t lock;
+  struct serve_file *slot[SERVE_CACHE];
+  uint64_t clock;
+} cache = {PTHREAD_MUTEX_INITIALIZER, {NULL}, 0};
+
+struct range {
+  double start;
+  double duration;
+  uint32_t rate;
+  uint32_t channels;
+  enum serve_format format;
+  const char *path;
+};
+
+static int
+same_file(const struct serve_file *f, const char *path,
+          const struct stat *st) {
+  return f->dev == st->st_dev && f->ino == st->st_ino &&
+         f->size == st->st_size && f->mtime.tv_sec == st->st_mtim.tv_sec &&
+         f->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+         strcmp(f->path, path) == 0;
+}
+
+static void
+file_free(struct serve_file *f) {
+  input_close(&f->in);
+  free(f->path);
+  free(f);
+}
+
+static struct serve_file *
+file_load(const char *path, const struct stat *st, const char **error) {
+  struct serve_file *f;
+  struct guard guard;
+  int err;
+
+  if (!(f = calloc(1, sizeof(*f))) || !(f->path = strdup(path))) {
+    free(f);
+    *error = "out of memory";
+    return NULL;
+  }
+  f->dev = st->st_dev;
+  f->ino = st->st_ino;
+  f->size = st->st_size;
+  f->mtime = st->st_mtim;
+  if ((err = input_open(&f->in, path)) != 0) {
+    *error = strerror(err);
+    f->in.fd = -1;
+    file_free(f);
+    return NULL;
+  }
+  guard_push(&guard);
+  if (sigsetjmp(guard.env, 1) != 0) {
+    *error = strerror(EIO);
+    metric_add(METRIC_ERRORS_BUS, 1);
+  } else if (riff_wave_parse(f->in.raw, f->in.length, &f->wave) !=
+             EXIT_SUCCESS) {
+    *error = "not a WAVE file with 'fmt ' and 'data'";
+  } else if (seek_init(&f->seek, &f->wave) != EXIT_SUCCESS) {
+    *error = "unsupported AudioFormat";
+  } else {
+    guard_pop(&guard);
+    return f;
+  }
+  guard_pop(&guard);
+  file_free(f);
+  return NULL;
+}
+
+/* The parsed file, from the cache when it has not changed since */
+static struct serve_file *
+file_acquire(const char *path, const char **error) {
+  struct serve_file *f;
+  struct stat st;
+  unsigned i, free_slot = SERVE_CACHE, victim = SERVE_CACHE;
+
+  if (stat(path, &st) < 0) {
+    *error = strerror(errno);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&cache.lock);
+  for (i = 0; i < SERVE_CACHE; ++i) {
+    if ((f = cache.slot[i]) && same_file(f, path, &st)) {
+      ++f->refs;
+      f->used = ++cache.clock;
+      pthread_mutex_unlock(&cache.lock);
+      metric_add(METRIC_CACHE_HITS, 1);
+      return f;
+    }
+  }
+  pthread_mutex_unlock(&cache.lock);
+  metric_add(METRIC_CACHE_MISSES, 1);
+
+  /* parsed outside the lock, a concurrent miss on the same file may parse
+   * it twice but only one copy is cached */
+  if (!(f = file_load(path, &st, error))) {
+    return NULL;
+  }
+  f->refs = 1;
+
+  pthread_mutex_lock(&cache.lock);
+  for (i = 0; i < SERVE_CACHE; ++i) {
+    struct serve_file *cached = cache.slot[i];
+
+    if (cached && same_file(cached, path, &st)) {
+      /* the other copy won the race, this one is dropped */
+      ++cached->refs;
+      cached->used = ++cache.clock;
+      pthread_mutex_unlock(&cache.lock);
+      file_free(f);
+      return cached;
+    }
+  }
+  for (i = 0; i < SERVE_CACHE && free_slot == SERVE_CACHE; ++i) {
+    if (!cache.slot[i]) {
+      free_slot = i;
+    } else if (cache.slot[i]->refs == 0 &&
+               (victim == SERVE_CACHE ||
+                cache.slot[i]->used < cache.slot[victim]->used)) {
+      victim = i;
+    }
+  }
+  if (free_slot == SERVE_CACHE && victim < SERVE_CACHE) {
+    /* evict the least recently used idle entry */
+    file_free(cache.slot[victim]);
+    cache.slot[victim] = NULL;
+    free_slot = victim;
+  }
+  /* with every entry in use the file is served uncached, and dropped on
+   * release */
+  if (free_slot < SERVE_CACHE) {
+    cache.slot[free_slot] = f;
+    f->cached = 1;
+  }
+  f->used = ++cache.clock;
+  pthread_mutex_unlock(&cache.lock);
+
+  return f;
+}
+
+static void
+file_release(struct serve_file *f) {
+  int drop;
+
+  pthread_mutex_lock(&cache.lock);
+  drop = --f->refs == 0 && !f->cached;
+  pthread_mutex_unlock(&cache.lock);
+  if (drop) {
+    file_free(f);
+  }
+}
+
+static int
+send_all(int fd, const void *buf, size_t length) {
+  const char *it = buf;
+
+  while (length > 0) {
+    ssize_t n = send(fd, it, length, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return EXIT_FAILURE;
+    }
+    metric_add(METRIC_SENT_BYTES, (uint64_t)n);
+    it += n;
+    length -= (size_t)n;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int
+send_line(int fd, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static int
+send_line(int fd, const char *fmt, ...) {
+  char line[256];
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if (n < 0) {
+    return EXIT_FAILURE;
+  }
+  return send_all(fd, line, (size_t)n < sizeof(line) ? (size_t)n
+                                                     : sizeof(line) - 1);
+}
+
+static int
+parse_range(char *it, struct range *out) {
+  char *end;
+
+  out->start = strtod(it, &end);
+  if (end == it || *end != ' ' || !(out->start >= 0.0)) {
+    return EXIT_FAILURE;
+  }
+  out->duration = strtod(it = end + 1, &end);
+  if (end == it || *end != ' ' || !(out->duration >= 0.0)) {
+    return EXIT_FAILURE;
+  }
+  out->rate = (uint32_t)strtoul(it = end + 1, &end, 10);
+  if (end == it || *end != ' ' || out->rate == 0) {
+    return EXIT_FAILURE;
+  }
+  out->channels = (uint32_t)strtoul(it = end + 1, &end, 10);
+  if (end == it || *end != ' ' || out->channels == 0 ||
+      out->channels > 64) {
+    return EXIT_FAILURE;
+  }
+  it = end + 1;
+  if (strncmp(it, "s16 ", 4) == 0) {
+    out->format = SERVE_S16;
+  } else if (strncmp(it, "f32 ", 4) == 0) {
+    out->format = SERVE_F32;
+  } else {
+    return EXIT_FAILURE;
+  }
+  out->path = it + 4;
+  return *out->path ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Source channel c of the output, mono is spread and a single output
+ * channel is the mix of all */
+static double
+map_channel(const double *frame, uint32_t channels, uint32_t c,
+            uint32_t out_channels) {
+  double sum = 0.0;
+  uint32_t i;
+
+  if (out_channels == 1 && channels > 1) {
+    for (i = 0; i < channels; ++i) {
+      sum += frame[i];
+    }
+    return sum / channels;
+  }
+  return frame[c % channels];
+}
+
+static int
+range_sendfile(int fd, const struct serve_file *f, uint64_t first,
+               uint64_t frames) {
+  const size_t align = f->wave.fmt.BlockAlign;
+  off_t offset = (off_t)(f->wave.data.data - f->in.raw) +
+                 (off_t)(first * align);
+  size_t length = (size_t)(frames * align);
+
+  while (length > 0) {
+    ssize_t n = sendfile(fd, f->in.fd, &offset, length);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return EXIT_FAILURE;
+    }
+    metric_add(METRIC_SENT_BYTES, (uint64_t)n);
+    length -= (size_t)n;
+  }
+  return EXIT_SUCCESS;
+}
+
+static int
+range_convert(int fd, const struct serve_file *f, const struct range *req,
+              uint64_t first, uint64_t frames) {
+  const uint32_t channels = f->seek.channels;
+  const double ratio = (double)f->wave.fmt.SampleRate / req->rate;
+  const size_t width = req->format == SERVE_S16 ? 2 : 4;
+  const size_t max_source = (size_t)(SERVE_CHUNK * ratio) + 3;
+  struct guard guard;
+  double *source;
+  u8 *out;
+  uint64_t done = 0;
+  int decoded;
+  int res = EXIT_FAILURE;
+
+  source = malloc(max_source * channels * sizeof(*source));
+  out = malloc(SERVE_CHUNK * req->channels * width);
+  if (!source || !out) {
+    goto Lfree;
+  }
+
+  while (done < frames) {
+    const size_t n = frames - done < SERVE_CHUNK ? (size_t)(frames - done)
+                                                 : SERVE_CHUNK;
+    const double p_first = (double)(first + done) * ratio;
+    const double p_last = (double)(first + done + n - 1) * ratio;
+    const uint64_t s0 = (uint64_t)p_first;
+    uint64_t s1 = (uint64_t)p_last + 1;
+    u8 *it = out;
+    size_t j;
+    uint32_t c;
+
+    if (s1 >= f->seek.frames) {
+      s1 = f->seek.frames - 1;
+    }
+    /* the file may be truncated under the cached mapping */
+    guard_push(&guard);
+    if (sigsetjmp(guard.env, 1) == 0) {
+      decoded = seek_frames(&f->seek, s0, (size_t)(s1 - s0 + 1), source) ==
+                EXIT_SUCCESS;
+    } else {
+      decoded = 0;
+      metric_add(METRIC_ERRORS_BUS, 1);
+    }
+    guard_pop(&guard);
+    if (!decoded) {
+      goto Lfree;
+    }
+
+    /* linear interpolation between neighbouring source frames */
+    for (j = 0; j < n; ++j) {
+      const double p = (double)(first + done + j) * ratio;
+      uint64_t i = (uint64_t)p - s0;
+      const double frac = p - (double)(s0 + i);
+      const double *a = source + i * channels;
+      const double *b = s0 + i < s1 ? a + channels : a;
+
+      for (c = 0; c < req->channels; ++c) {
+        double va = map_channel(a, channels, c, req->channels);
+        double vb = map_channel(b, channels, c, req->channels);
+        double v = va + (vb - va) * frac;
+
+        if (req->format == SERVE_S16) {
+          long q = lrint(v * 32768.0);
+          q = q < -32768 ? -32768 : q > 32767 ? 32767 : q;
+          wr_le16(it, (uint16_t)(int16_t)q);
+          it += 2;
+        } else {
+          float fv = (float)v;
+          uint32_t bits;
+          memcpy(&bits, &fv, sizeof(bits));
+          wr_le32(it, bits);
+          it += 4;
+        }
+      }
+    }
+    if (send_all(fd, out, (size_t)(it - out)) != EXIT_SUCCESS) {
+      goto Lfree;
+    }
+    done += n;
+  }
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(out);
+  free(source);
+  return res;
+}
+
+static int
+serve_range(int fd, char *args) {
+  struct range req;
+  struct serve_file *f;
+  const char *error = NULL;
+  uint64_t first, frames, available;
+  size_t width;
+  int direct, res;
+
+  if (parse_range(args, &req) != EXIT_SUCCESS) {
+    metric_add(METRIC_ERRORS_REQUEST, 1);
+    return send_line(fd,
+                     "ERR usage: RANGE start duration rate channels "
+                     "s16|f32 path\n");
+  }
+  if (!(f = file_acquire(req.path, &error))) {
+    metric_add(METRIC_ERRORS_FILE, 1);
+    return send_line(fd, "ERR %s: %s\n", req.path, error);
+  }
+
+  /* output frames, limited to the source */
+  available = f->seek.frames * req.rate / f->wave.fmt.SampleRate;
+  first = (uint64_t)llround(req.start * req.rate);
+  frames = (uint64_t)(req.duration * req.rate);
+  if (first >= available) {
+    frames = 0;
+  } else if (frames > available - first) {
+    frames = available - first;
+  }
+  width = req.format == SERVE_S16 ? 2 : 4;
+
+  direct = f->seek.codec == SEEK_PCM &&
+           f->wave.fmt.SampleRate == req.rate &&
+           f->seek.channels == req.channels &&
+           ((f->seek.kind == SAMPLE_S16 && req.format == SERVE_S16) ||
+            (f->seek.kind == SAMPLE_F32 && req.format == SERVE_F32)) &&
+           f->wave.fmt.BlockAlign == req.channels * width;
+
+  res = send_line(fd, "OK %" PRIu64 " %" PRIu64 "\n", frames,
+                  frames * req.channels * width);
+  if (res == EXIT_SUCCESS && frames > 0) {
+    res = direct ? range_sendfile(fd, f, first, frames)
+                 : range_convert(fd, f, &req, first, frames);
+  }
+  file_release(f);
+  return res;
+}
+
+static int
+serve_metrics(int fd) {
+  char *text = NULL;
+  size_t length = 0;
+  FILE *f;
+  int res;
+
+  if (!(f = open_memstream(&text, &length))) {
+    return send_line(fd, "ERR %s\n", strerror(errno));
+  }
+  metrics_write(f);
+  if (fclose(f) != 0) {
+    free(text);
+    return send_line(fd, "ERR %s\n", strerror(errno));
+  }
+  if ((res = send_line(fd, "OK %zu\n", length)) == EXIT_SUCCESS) {
+    res = send_all(fd, text, length);
+  }
+  free(text);
+  return res;
+}
+
+static void *
+serve_connection(void *arg) {
+  const int fd = (int)(intptr_t)arg;
+  char line[SERVE_LINE];
+  FILE *in;
+
+  if (!(in = fdopen(fd, "r"))) {
+    close(fd);
+    return NULL;
+  }
+  metric_add(METRIC_CONNECTIONS_OPENED, 1);
+  while (fgets(line, sizeof(line), in)) {
+    size_t length = strlen(line);
+    int res;
+
+    metric_add(METRIC_REQUESTS, 1);
+    if (length == 0 || line[length - 1] != '\n') {
+      metric_add(METRIC_ERRORS_REQUEST, 1);
+      send_line(fd, "ERR request too long\n");
+      break;
+    }
+    line[--length] = '\0';
+    if (length > 0 && line[length - 1] == '\r') {
+      line[--length] = '\0';
+    }
+
+    if (strncmp(line, "RANGE ", 6) == 0) {
+      res = serve_range(fd, line + 6);
+    } else if (strcmp(line, "METRICS") == 0) {
+      res = serve_metrics(fd);
+    } else {
+      metric_add(METRIC_ERRORS_REQUEST, 1);
+      res = send_line(fd, "ERR unknown request\n");
+    }
+    if (res != EXIT_SUCCESS) {
+      /* the response may be cut short, the stream is out of sync */
+      metric_add(METRIC_ERRORS_SEND, 1);
+      break;
+    }
+  }
+  fclose(in);
+  metric_add(METRIC_CONNECTIONS_CLOSED, 1);
+
+  return NULL;
+}
+
+int
+serve(const char *socket_path) {
+  struct sockaddr_un addr;
+  struct stat st;
+  pthread_attr_t attr;
+  int fd;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "ERROR: socket path too long\n");
+    return EXIT_FAILURE;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  signal(SIGPIPE, SIG_IGN);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+    fprintf(stderr, "socket(): %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+  /* a stale socket of a previous run */
+  if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(socket_path);
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, 64) < 0) {
+    fprintf(stderr, "bind(%s): %s\n", socket_path, strerror(errno));
+    close(fd);
+    return EXIT_FAILURE;
+  }
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  for (;;) {
+    pthread_t thread;
+    int c = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+
+    if (c < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      fprintf(stderr, "accept(): %s\n", strerror(errno));
+      break;
+    }
+    if (pthread_create(&thread, &attr, serve_connection,
+                       (void *)(intptr_t)c) != 0) {
+      close(c);
+    }
+  }
+  pthread_attr_destroy(&attr);
+  close(fd);
+
+  return EXIT_FAILURE;
+}
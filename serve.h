@@ -0,0 +1,37 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+/* Daemon answering requests over a Unix stream socket, one thread per
+ * connection. Requests are single lines, a connection may send several:
+ *
+ *   RANGE start duration rate channels format path
+ *
+ * returns duration seconds from start seconds of path, converted to rate,
+ * channels and format ("s16" or "f32", little endian, interleaved):
+ *
+ *   OK frames bytes\n
+ *   <bytes of samples>
+ *
+ * or "ERR message\n".
+ *
+ *   METRICS
+ *
+ * returns the counters of metrics.h in the Prometheus text format:
+ *
+ *   OK bytes\n
+ *   <bytes of text>
+ *
+ * Parsed files stay mapped in a small cache keyed by path, device, inode,
+ * size and mtime. A range already in the requested format is sent
+ * straight from the page cache with sendfile(2).
+ */
+
+#define SERVE_CACHE 64
+/* frames converted per write */
+#define SERVE_CHUNK 4096
+#define SERVE_LINE 4096
+
+int
+serve(const char *socket_path);
+
+#endif
@@ -0,0 +1,133 @@
+#include "sniff.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAGIC(a, b, c, d)                                                      \
+  ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) |              \
+   ((uint32_t)(d) << 24))
+
+/* Sony Wave64 'riff' and 'wave' GUIDs */
+static const u8 W64_riff[16] = {0x72, 0x69, 0x66, 0x66, 0x2E, 0x91,
+                                0xCF, 0x11, 0xA5, 0xD6, 0x28, 0xDB,
+                                0x04, 0xC1, 0x00, 0x00};
+static const u8 W64_wave[16] = {0x77, 0x61, 0x76, 0x65, 0xF3, 0xAC,
+                                0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0,
+                                0x4F, 0x8E, 0xDB, 0x8A};
+
+/* Containers identified by the first four bytes alone, the form type of
+ * the RIFF family follows at offset 8 */
+static const struct {
+  uint32_t magic;
+  enum sniff_container container;
+  int has_form;
+} signatures[] = {
+    {MAGIC('R', 'I', 'F', 'F'), SNIFF_RIFF, 1},
+    {MAGIC('R', 'I', 'F', 'X'), SNIFF_RIFX, 1},
+    {MAGIC('R', 'F', '6', '4'), SNIFF_RF64, 1},
+    {MAGIC('B', 'W', '6', '4'), SNIFF_BW64, 1},
+    {MAGIC('F', 'O', 'R', 'M'), SNIFF_AIFF, 1},
+    {MAGIC('f', 'L', 'a', 'C'), SNIFF_FLAC, 0},
+    {MAGIC('O', 'g', 'g', 'S'), SNIFF_OGG, 0},
+};
+
+void
+sniff_buf(const u8 *buf, size_t length, struct sniff *out) {
+  uint32_t magic;
+  size_t i;
+
+  memset(out, 0, sizeof(*out));
+  if (length == 0) {
+    out->container = SNIFF_EMPTY;
+    return;
+  }
+  if (length < 4) {
+    return;
+  }
+
+  magic = rd_le32(buf);
+  for (i = 0; i < sizeof(signatures) / sizeof(signatures[0]); ++i) {
+    if (signatures[i].magic != magic) {
+      continue;
+    }
+    if (signatures[i].has_form) {
+      if (length < 12) {
+        return;
+      }
+      memcpy(out->form, buf + 8, sizeof(out->form));
+    }
+    out->container = signatures[i].container;
+    if (out->container == SNIFF_AIFF) {
+      if (memcmp(out->form, "AIFC", 4) == 0) {
+        out->container = SNIFF_AIFC;
+      } else if (memcmp(out->form, "AIFF", 4) != 0) {
+        out->container = SNIFF_UNKNOWN;
+      }
+    }
+    return;
+  }
+
+  if (length >= 40 && memcmp(buf, W64_riff, 16) == 0) {
+    if (memcmp(buf + 24, W64_wave, 16) == 0) {
+      memcpy(out->form, "WAVE", 4);
+    }
+    out->container = SNIFF_W64;
+    return;
+  }
+
+  /* ID3v2 tagged or a bare MPEG audio frame sync */
+  if (memcmp(buf, "ID3", 3) == 0 ||
+      (buf[0] == 0xFF && (buf[1] & 0xE0) == 0xE0 && (buf[1] & 0x06) != 0)) {
+    out->container = SNIFF_MP3;
+  }
+}
+
+int
+sniff_fd(int fd, struct sniff *out) {
+  u8 buf[SNIFF_BYTES];
+  ssize_t len;
+
+  if ((len = pread(fd, buf, sizeof(buf), 0)) < 0) {
+    return EXIT_FAILURE;
+  }
+  sniff_buf(buf, (size_t)len, out);
+
+  return EXIT_SUCCESS;
+}
+
+const char *
+sniff_container_str(enum sniff_container container) {
+  switch (container) {
+  case SNIFF_UNKNOWN:
+    return "unknown";
+  case SNIFF_EMPTY:
+    return "empty";
+  case SNIFF_RIFF:
+    return "RIFF";
+  case SNIFF_RIFX:
+    return "RIFX";
+  case SNIFF_RF64:
+    return "RF64";
+  case SNIFF_BW64:
+    return "BW64";
+  case SNIFF_W64:
+    return "W64";
+  case SNIFF_AIFF:
+    return "AIFF";
+  case SNIFF_AIFC:
+    return "AIFC";
+  case SNIFF_FLAC:
+    return "FLAC";
+  case SNIFF_OGG:
+    return "Ogg";
+  case SNIFF_MP3:
+    return "MP3";
+  }
+  return "";
+}
+
+int
+sniff_is_riff(const struct sniff *self) {
+  return self->container == SNIFF_RIFF;
+}
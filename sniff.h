@@ -0,0 +1,45 @@
+#ifndef SNIFF_H
+#define SNIFF_H
+
+#include "riff.h"
+
+/* Container identification from the first SNIFF_BYTES of a file */
+
+#define SNIFF_BYTES 64
+
+enum sniff_container {
+  SNIFF_UNKNOWN,
+  SNIFF_EMPTY,
+  SNIFF_RIFF,
+  SNIFF_RIFX,
+  SNIFF_RF64,
+  SNIFF_BW64,
+  SNIFF_W64,
+  SNIFF_AIFF,
+  SNIFF_AIFC,
+  SNIFF_FLAC,
+  SNIFF_OGG,
+  SNIFF_MP3,
+};
+
+struct sniff {
+  enum sniff_container container;
+  /* RIFF style form type, e.g. "WAVE", "AVI ", "WEBP" */
+  char form[4];
+};
+
+void
+sniff_buf(const u8 *buf, size_t length, struct sniff *out);
+
+/* A single pread of the head of the file */
+int
+sniff_fd(int fd, struct sniff *out);
+
+const char *
+sniff_container_str(enum sniff_container container);
+
+/* Whether parse_RIFF understands the container */
+int
+sniff_is_riff(const struct sniff *self);
+
+#endif
@@ -0,0 +1,441 @@
+#include "spectrogram.h"
+#include "budget.h"
+#include "fft.h"
+#include "guard.h"
+#include "pool.h"
+#include "sample.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TILE_BYTES (SPECTROGRAM_TILE_WIDTH * SPECTROGRAM_TILE_HEIGHT)
+#define FFT_MAX (SPECTROGRAM_FFT_MIN << (SPECTROGRAM_FFT_LEVELS - 1))
+
+struct spectrogram_scratch {
+  float re[FFT_MAX];
+  float im[FFT_MAX];
+};
+
+/* One level, computed a batch of tile columns at a time */
+struct spectrogram_run {
+  const struct input *in;
+  const struct riff_wave *wave;
+  enum sample_kind kind;
+  uint64_t frames;
+  const struct spectrogram_level *level;
+  struct fft fft;
+  float *window;
+  /* lowest power of each pixel value, pixels are counted thresholds */
+  float threshold[256];
+  /* tile column of the first of the batch */
+  uint64_t first;
+  /* [column][tile row], TILE_BYTES each */
+  u8 *batch;
+  struct spectrogram_scratch *scratch;
+  int failed;
+};
+
+static unsigned
+spectrogram_levels(uint64_t frames, struct spectrogram_level *level) {
+  uint64_t first_tile = 0;
+  unsigned l;
+
+  for (l = 0; l < SPECTROGRAM_LEVELS; ++l) {
+    struct spectrogram_level *it = &level[l];
+    uint32_t span = (uint32_t)SPECTROGRAM_FFT_MIN << l;
+
+    it->fft = span < FFT_MAX ? span : FFT_MAX;
+    it->hop = span / 2;
+    it->bins = it->fft / 2;
+    it->columns = frames > it->hop ? (uint32_t)((frames + it->hop - 1) /
+                                                it->hop)
+                                   : 1;
+    it->tiles_x = (it->columns + SPECTROGRAM_TILE_WIDTH - 1) /
+                  SPECTROGRAM_TILE_WIDTH;
+    it->tiles_y = it->bins / SPECTROGRAM_TILE_HEIGHT;
+    it->first_tile = first_tile;
+    first_tile += (uint64_t)it->tiles_x * it->tiles_y;
+    if (l + 1 >= SPECTROGRAM_FFT_LEVELS && it->tiles_x == 1) {
+      return l + 1;
+    }
+  }
+  return SPECTROGRAM_LEVELS;
+}
+
+/* Mono mix of n frames from frame, windowed, zero past the end */
+static void
+load_window(const struct spectrogram_run *run, uint64_t frame, float *re) {
+  const uint32_t channels = run->wave->fmt.NumChannels;
+  const uint32_t align = run->wave->fmt.BlockAlign;
+  const unsigned width = sample_bytes(run->kind);
+  const size_t n = run->level->fft;
+  const u8 *it = run->wave->data.data + frame * align;
+  size_t i, valid;
+  uint32_t c;
+
+  valid = frame >= run->frames ? 0
+          : run->frames - frame < n ? (size_t)(run->frames - frame)
+                                    : n;
+  for (i = 0; i < valid; ++i) {
+    double sum = 0.0;
+    for (c = 0; c < channels; ++c) {
+      sum += sample_load(it + c * width, run->kind);
+    }
+    re[i] = (float)(sum / channels) * run->window[i];
+    it += align;
+  }
+  memset(re + valid, 0, (n - valid) * sizeof(*re));
+}
+
+static u8
+quantize(const float *threshold, float power) {
+  unsigned q = 0, step;
+
+  for (step = 128; step > 0; step /= 2) {
+    if (power >= threshold[q + step]) {
+      q += step;
+    }
+  }
+  return (u8)q;
+}
+
+/* pool_fn, one tile column of the batch */
+static void
+spectrogram_column(void *closure, size_t index, unsigned worker) {
+  struct spectrogram_run *run = closure;
+  const struct spectrogram_level *level = run->level;
+  struct spectrogram_scratch *s = &run->scratch[worker];
+  u8 *out = run->batch + index * level->tiles_y * TILE_BYTES;
+  uint64_t column = (run->first + index) * SPECTROGRAM_TILE_WIDTH;
+  struct guard guard;
+  size_t i, k;
+
+  guard_push(&guard);
+  if (sigsetjmp(guard.env, 1) != 0) {
+    guard_pop(&guard);
+    __atomic_store_n(&run->failed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  for (i = 0; i < SPECTROGRAM_TILE_WIDTH && column < level->columns;
+       ++i, ++column) {
+    load_window(run, column * level->hop, s->re);
+    memset(s->im, 0, level->fft * sizeof(*s->im));
+    fft_forward(&run->fft, s->re, s->im);
+    /* rows are contiguous across the tiles of the column, row 0 is the
+     * highest bin */
+    for (k = 0; k < level->bins; ++k) {
+      out[(level->bins - 1 - k) * SPECTROGRAM_TILE_WIDTH + i] = quantize(
+          run->threshold, s->re[k] * s->re[k] + s->im[k] * s->im[k]);
+    }
+  }
+  guard_pop(&guard);
+}
+
+static int
+run_init(struct spectrogram_run *run, const struct spectrogram_level *level) {
+  /* a full scale sine peaks at n / 4 through the Hann window */
+  const double full = (double)level->fft * level->fft / 16.0;
+  unsigned q;
+
+  run->level = level;
+  if (fft_init(&run->fft, level->fft) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  if (!(run->window = malloc(level->fft * sizeof(*run->window)))) {
+    fft_free(&run->fft);
+    return EXIT_FAILURE;
+  }
+  fft_hann(run->window, level->fft);
+  run->threshold[0] = 0.0f;
+  for (q = 1; q < 256; ++q) {
+    double db = SPECTROGRAM_FLOOR_DB +
+                (q - 0.5) * -SPECTROGRAM_FLOOR_DB / 255.0;
+    run->threshold[q] = (float)(full * pow(10.0, db / 10.0));
+  }
+  return EXIT_SUCCESS;
+}
+
+static void
+run_free(struct spectrogram_run *run) {
+  free(run->window);
+  run->window = NULL;
+  fft_free(&run->fft);
+}
+
+/* The output file, tiles are appended in any order and found by index */
+struct spectrogram_file {
+  FILE *f;
+  struct spectrogram *out;
+  uint64_t *index;
+  uint64_t offset;
+  /* a tile column of each level pooled from the one below, filled by
+   * halves, charged to the budget along with each batch */
+  u8 *pending[SPECTROGRAM_LEVELS];
+  uint64_t pending_bytes;
+};
+
+static int
+silent(const u8 *tile) {
+  size_t i;
+
+  for (i = 0; i < TILE_BYTES; ++i) {
+    if (tile[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Appends the tiles of tile column x of level l, silent ones are left
+ * out of the file */
+static int
+put_column(struct spectrogram_file *file, unsigned l, uint32_t x,
+           const u8 *column) {
+  const struct spectrogram_level *level = &file->out->level[l];
+  uint32_t y;
+
+  for (y = 0; y < level->tiles_y; ++y) {
+    const u8 *tile = column + (size_t)y * TILE_BYTES;
+
+    if (silent(tile)) {
+      continue;
+    }
+    file->index[level->first_tile + (uint64_t)y * level->tiles_x + x] =
+        file->offset;
+    fwrite(tile, 1, TILE_BYTES, file->f);
+    file->offset += TILE_BYTES;
+    ++file->out->stored;
+  }
+  return ferror(file->f) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Pools tile column x of level l - 1 into level l and up. A pixel is
+ * monotonic in the power of its bin, so the peak of two pixels is the
+ * pixel of the peak of their FFTs. */
+static int
+put_pooled(struct spectrogram_file *file, unsigned l, uint32_t x,
+           const u8 *child) {
+  u8 *parent = file->pending[l];
+  const size_t half = x % 2 * SPECTROGRAM_TILE_WIDTH / 2;
+  const size_t rows =
+      (size_t)file->out->level[l].tiles_y * SPECTROGRAM_TILE_HEIGHT;
+  size_t row, c;
+  int res;
+
+  for (row = 0; row < rows; ++row) {
+    const u8 *from = child + row * SPECTROGRAM_TILE_WIDTH;
+    u8 *to = parent + row * SPECTROGRAM_TILE_WIDTH + half;
+
+    for (c = 0; c < SPECTROGRAM_TILE_WIDTH / 2; ++c) {
+      to[c] = from[2 * c] > from[2 * c + 1] ? from[2 * c] : from[2 * c + 1];
+    }
+  }
+  if (x % 2 == 0 && x + 1 < file->out->level[l - 1].tiles_x) {
+    return EXIT_SUCCESS;
+  }
+  if ((res = put_column(file, l, x / 2, parent)) == EXIT_SUCCESS &&
+      l + 1 < file->out->levels) {
+    res = put_pooled(file, l + 1, x / 2, parent);
+  }
+  memset(parent, 0, rows * SPECTROGRAM_TILE_WIDTH);
+  return res;
+}
+
+/* Computes and appends the tiles of level l, the last level computed by
+ * FFT feeds the pooled ones */
+static int
+put_level(struct spectrogram_run *run, struct spectrogram_file *file,
+          unsigned l, unsigned workers) {
+  const struct spectrogram_level *level = run->level;
+  const uint32_t align = run->wave->fmt.BlockAlign;
+  const size_t data = (size_t)(run->wave->data.data - run->in->raw);
+  /* the frames of a batch fit a window of the input */
+  const uint64_t column_bytes =
+      (uint64_t)SPECTROGRAM_TILE_WIDTH * level->hop * align;
+  const size_t batch =
+      column_bytes * SPECTROGRAM_BATCH <= BUDGET_WINDOW ? SPECTROGRAM_BATCH
+      : column_bytes < BUDGET_WINDOW ? (size_t)(BUDGET_WINDOW / column_bytes)
+                                     : 1;
+  struct budget_window window;
+  size_t i, length;
+
+  budget_window_init(&window, run->in->raw, run->in->length, run->in->fd);
+  for (run->first = 0; run->first < level->tiles_x; run->first += batch) {
+    uint64_t bytes, from, to, last;
+    int res;
+
+    length = level->tiles_x - run->first < batch
+                 ? (size_t)(level->tiles_x - run->first)
+                 : batch;
+    bytes = (uint64_t)length * level->tiles_y * TILE_BYTES;
+    /* frames of the FFTs of the batch, charged along with it */
+    last = (run->first + length) * SPECTROGRAM_TILE_WIDTH;
+    last = (last < level->columns ? last : level->columns) - 1;
+    from = run->first * SPECTROGRAM_TILE_WIDTH * level->hop;
+    to = last * level->hop + level->fft;
+    from = from < run->frames ? from : run->frames;
+    to = to < run->frames ? to : run->frames;
+    budget_window_with(&window, data + (size_t)(from * align),
+                       (size_t)((to - from) * align),
+                       bytes + file->pending_bytes);
+    if (!(run->batch = calloc(1, (size_t)bytes))) {
+      budget_window_end(&window);
+      return EXIT_FAILURE;
+    }
+    res = pool_run(workers, length, spectrogram_column, run);
+    if (run->failed) {
+      errno = EIO;
+      res = EXIT_FAILURE;
+    }
+    for (i = 0; i < length && res == EXIT_SUCCESS; ++i) {
+      const u8 *column = run->batch + i * level->tiles_y * TILE_BYTES;
+      uint32_t x = (uint32_t)(run->first + i);
+
+      res = put_column(file, l, x, column);
+      if (res == EXIT_SUCCESS && l + 1 == SPECTROGRAM_FFT_LEVELS &&
+          l + 1 < file->out->levels) {
+        res = put_pooled(file, l + 1, x, column);
+      }
+    }
+    free(run->batch);
+    run->batch = NULL;
+    if (res != EXIT_SUCCESS) {
+      budget_window_end(&window);
+      return EXIT_FAILURE;
+    }
+  }
+  budget_window_end(&window);
+  return EXIT_SUCCESS;
+}
+
+static int
+write_pyramid(const struct input *in, const struct riff_wave *wave, FILE *f,
+              unsigned workers, struct spectrogram *out) {
+  struct spectrogram_header header;
+  struct spectrogram_run run;
+  struct spectrogram_file file;
+  const uint64_t column = (FFT_MAX / 2) * SPECTROGRAM_TILE_WIDTH;
+  unsigned l;
+  int res = EXIT_FAILURE;
+
+  memset(&run, 0, sizeof(run));
+  memset(&file, 0, sizeof(file));
+  run.in = in;
+  run.wave = wave;
+  run.kind = sample_kind(&wave->fmt);
+  run.frames = riff_wave_frames(wave);
+  out->levels = spectrogram_levels(run.frames, out->level);
+  out->tiles = out->level[out->levels - 1].first_tile +
+               (uint64_t)out->level[out->levels - 1].tiles_x *
+                   out->level[out->levels - 1].tiles_y;
+  file.f = f;
+  file.out = out;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SPECTROGRAM_MAGIC, sizeof(header.magic));
+  header.version = SPECTROGRAM_VERSION;
+  header.levels = out->levels;
+  header.tile_width = SPECTROGRAM_TILE_WIDTH;
+  header.tile_height = SPECTROGRAM_TILE_HEIGHT;
+  header.SampleRate = wave->fmt.SampleRate;
+  header.floor_db = SPECTROGRAM_FLOOR_DB;
+  header.frames = run.frames;
+  header.tiles = out->tiles;
+  header.index_offset =
+      sizeof(header) + out->levels * sizeof(struct spectrogram_level);
+  file.offset = header.index_offset + out->tiles * sizeof(*file.index);
+
+  if (!(file.index = calloc((size_t)out->tiles, sizeof(*file.index))) ||
+      !(run.scratch = malloc(workers * sizeof(*run.scratch)))) {
+    goto Lfree;
+  }
+  for (l = SPECTROGRAM_FFT_LEVELS; l < out->levels; ++l) {
+    if (!(file.pending[l] = calloc(1, (size_t)column))) {
+      goto Lfree;
+    }
+    file.pending_bytes += column;
+  }
+  /* the index is rewritten once the tiles are placed */
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(out->level, sizeof(struct spectrogram_level), out->levels, f);
+  fwrite(file.index, sizeof(*file.index), (size_t)out->tiles, f);
+
+  for (l = 0; l < out->levels && l < SPECTROGRAM_FFT_LEVELS; ++l) {
+    if (run_init(&run, &out->level[l]) != EXIT_SUCCESS) {
+      goto Lfree;
+    }
+    res = put_level(&run, &file, l, workers);
+    run_free(&run);
+    if (res != EXIT_SUCCESS) {
+      goto Lfree;
+    }
+  }
+  res = EXIT_FAILURE;
+  if (fseeko(f, (off_t)header.index_offset, SEEK_SET) < 0) {
+    goto Lfree;
+  }
+  fwrite(file.index, sizeof(*file.index), (size_t)out->tiles, f);
+  out->bytes = file.offset;
+  res = ferror(f) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+Lfree:
+  for (l = 0; l < SPECTROGRAM_LEVELS; ++l) {
+    free(file.pending[l]);
+  }
+  free(run.scratch);
+  free(file.index);
+  return res;
+}
+
+int
+spectrogram_write(const struct input *in, const struct riff_wave *wave,
+                  const char *path, unsigned workers,
+                  struct spectrogram *out) {
+  char *tmp;
+  FILE *f;
+  int res = EXIT_FAILURE;
+
+  memset(out, 0, sizeof(*out));
+  if (sample_kind(&wave->fmt) == SAMPLE_UNSUPPORTED) {
+    return EXIT_FAILURE;
+  }
+  if (workers == 0) {
+    workers = 1;
+  }
+  if (!(tmp = malloc(strlen(path) + sizeof(".tmp")))) {
+    return EXIT_FAILURE;
+  }
+  sprintf(tmp, "%s.tmp", path);
+  if (!(f = fopen(tmp, "wb"))) {
+    fprintf(stderr, "fopen(%s): %s\n", tmp, strerror(errno));
+    free(tmp);
+    return EXIT_FAILURE;
+  }
+  if (write_pyramid(in, wave, f, workers, out) != EXIT_SUCCESS ||
+      fflush(f) != 0 || ferror(f) || fsync(fileno(f)) < 0) {
+    int err = errno;
+
+    if (err != EIO) {
+      fprintf(stderr, "write(%s): %s\n", tmp, strerror(err));
+    }
+    fclose(f);
+    unlink(tmp);
+    errno = err;
+    goto Lfree;
+  }
+  fclose(f);
+  if (rename(tmp, path) < 0) {
+    fprintf(stderr, "rename(%s): %s\n", path, strerror(errno));
+    unlink(tmp);
+    goto Lfree;
+  }
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(tmp);
+  return res;
+}
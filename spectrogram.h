@@ -0,0 +1,87 @@
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include "input.h"
+#include "riff.h"
+
+/* Zoomable spectrogram for web viewers: a pyramid of levels, each an 8 bit
+ * image of the STFT magnitudes of the mono mix cut into fixed size tiles.
+ *
+ *   spectrogram_header
+ *   spectrogram_level[levels]
+ *   uint64_t index[tiles]    file offset of each tile, 0 when silent
+ *   tiles                    tile_height rows of tile_width pixels
+ *
+ * The first SPECTROGRAM_FFT_LEVELS levels double the FFT size from
+ * SPECTROGRAM_FFT_MIN with a hop of half of it, trading time for frequency
+ * resolution. The levels after them double the hop until the stream fits
+ * one tile, a column holding the peak of the FFTs it spans. Tiles of a
+ * level are indexed by row, from the highest frequencies down, then by
+ * column; the top row of a tile is its highest bin. A pixel maps the level
+ * of its bin from SPECTROGRAM_FLOOR_DB to 0 dBFS onto 0 to 255.
+ *
+ * Every section is 8 byte aligned and stored in the byte order of the
+ * host, spectrograms are not portable between byte orders.
+ */
+
+#define SPECTROGRAM_MAGIC "RIFFSPG"
+#define SPECTROGRAM_VERSION 1
+
+#define SPECTROGRAM_FFT_MIN 256
+#define SPECTROGRAM_FFT_LEVELS 5
+#define SPECTROGRAM_TILE_WIDTH 256
+#define SPECTROGRAM_TILE_HEIGHT 128
+#define SPECTROGRAM_FLOOR_DB -120
+/* upper bound of the levels, the hop of the last one fits 32 bits */
+#define SPECTROGRAM_LEVELS 24
+/* tile columns computed by the workers between writes, fewer when their
+ * frames do not fit BUDGET_WINDOW */
+#define SPECTROGRAM_BATCH 64
+
+struct spectrogram_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t levels;
+  uint32_t tile_width;
+  uint32_t tile_height;
+  uint32_t SampleRate;
+  int32_t floor_db;
+  uint64_t frames;
+  uint64_t tiles;
+  uint64_t index_offset;
+};
+
+struct spectrogram_level {
+  /* frames per FFT and per column */
+  uint32_t fft;
+  uint32_t hop;
+  /* rows, bin k is at k * SampleRate / fft Hz */
+  uint32_t bins;
+  uint32_t columns;
+  uint32_t tiles_x;
+  uint32_t tiles_y;
+  /* of the index, tiles_x * tiles_y entries */
+  uint64_t first_tile;
+};
+
+struct spectrogram {
+  unsigned levels;
+  struct spectrogram_level level[SPECTROGRAM_LEVELS];
+  uint64_t tiles;
+  /* tiles not silent */
+  uint64_t stored;
+  uint64_t bytes;
+};
+
+/* Writes the pyramid of the payload of wave, parsed from a mapping by
+ * input_open(), to path, replaced atomically. Tile columns are computed by
+ * workers in batches of SPECTROGRAM_BATCH, each charged to the memory
+ * budget until written along with the window of the input it reads, see
+ * budget_window_with(). The caller must not hold any of the budget. Fails
+ * with errno EIO when the mapping raises SIGBUS, see guard.h. */
+int
+spectrogram_write(const struct input *in, const struct riff_wave *wave,
+                  const char *path, unsigned workers,
+                  struct spectrogram *out);
+
+#endif
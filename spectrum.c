@@ -0,0 +1,184 @@
+#include "spectrum.h"
+#include "fft.h"
+#include "guard.h"
+#include "sample.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* bins averaged below a candidate cut off */
+#define CLIFF_WIDTH 16
+/* level of the band below the cut off over everything above it */
+#define CLIFF_DB 25.0
+
+static const uint32_t standard_rates[] = {
+    8000,  11025, 16000,  22050,  24000,  32000,  44100,
+    48000, 88200, 96000, 176400, 192000, 352800, 384000,
+};
+
+/* Mono mix of n frames starting at frame of the stream, windowed. The
+ * window may span the seam between two segments. */
+static void
+load_window(const struct riff_wave *segments, enum sample_kind kind,
+            uint64_t frame, const float *window, float *re, size_t n) {
+  const uint32_t channels = segments[0].fmt.NumChannels;
+  const uint32_t align = segments[0].fmt.BlockAlign;
+  const unsigned width = sample_bytes(kind);
+  const u8 *it;
+  uint64_t left;
+  size_t i;
+  uint32_t c;
+
+  while (frame >= (left = riff_wave_frames(segments))) {
+    frame -= left;
+    ++segments;
+  }
+  it = segments->data.data + frame * align;
+  left -= frame;
+  for (i = 0; i < n; ++i) {
+    double sum = 0.0;
+    while (left == 0) {
+      ++segments;
+      it = segments->data.data;
+      left = riff_wave_frames(segments);
+    }
+    for (c = 0; c < channels; ++c) {
+      sum += sample_load(it + c * width, kind);
+    }
+    re[i] = (float)(sum / channels) * window[i];
+    it += align;
+    --left;
+  }
+}
+
+/* Highest bin below which the spectrum sits CLIFF_DB over everything
+ * above it, or bins when there is no such cliff */
+static size_t
+find_cliff(const double *db, size_t bins) {
+  double *above;
+  double sum = 0.0;
+  size_t k;
+
+  if (!(above = malloc((bins + 1) * sizeof(*above)))) {
+    return bins;
+  }
+  above[bins] = -INFINITY;
+  for (k = bins; k-- > 0;) {
+    above[k] = db[k] > above[k + 1] ? db[k] : above[k + 1];
+  }
+
+  for (k = bins - 1; k > CLIFF_WIDTH; --k) {
+    size_t i;
+    sum = 0.0;
+    for (i = k - CLIFF_WIDTH; i < k; ++i) {
+      sum += db[i];
+    }
+    if (sum / CLIFF_WIDTH - above[k] >= CLIFF_DB) {
+      break;
+    }
+  }
+  free(above);
+
+  return k > CLIFF_WIDTH ? k : bins;
+}
+
+int
+spectrum_cutoff(const struct riff_wave *wave, unsigned windows,
+                struct spectrum_cutoff *out) {
+  return spectrum_cutoff_segments(wave, 1, windows, out);
+}
+
+int
+spectrum_cutoff_segments(const struct riff_wave *segments, size_t count,
+                         unsigned windows, struct spectrum_cutoff *out) {
+  const struct riff_wave *wave = &segments[0];
+  const size_t n = SPECTRUM_FFT;
+  const size_t bins = n / 2;
+  const double nyquist = wave->fmt.SampleRate / 2.0;
+  uint64_t frames = 0;
+  enum sample_kind kind;
+  struct fft fft;
+  float *window = NULL, *re = NULL, *im = NULL;
+  double *power = NULL;
+  struct guard guard;
+  size_t cliff, i;
+  unsigned w;
+  int res = EXIT_FAILURE;
+
+  memset(out, 0, sizeof(*out));
+  for (i = 0; i < count; ++i) {
+    frames += riff_wave_frames(&segments[i]);
+  }
+  if ((kind = sample_kind(&wave->fmt)) == SAMPLE_UNSUPPORTED ||
+      frames < n || windows == 0) {
+    return EXIT_FAILURE;
+  }
+  if (fft_init(&fft, n) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  window = malloc(n * sizeof(*window));
+  re = malloc(n * sizeof(*re));
+  im = malloc(n * sizeof(*im));
+  power = calloc(bins, sizeof(*power));
+  if (!window || !re || !im || !power) {
+    goto Lfree;
+  }
+  fft_hann(window, n);
+
+  for (w = 0; w < windows; ++w) {
+    /* centred in each of the equally sized stretches of the payload */
+    uint64_t centre = (2 * (uint64_t)w + 1) * frames / (2 * windows);
+    uint64_t first = centre > n / 2 ? centre - n / 2 : 0;
+    if (first + n > frames) {
+      first = frames - n;
+    }
+
+    guard_push(&guard);
+    if (sigsetjmp(guard.env, 1) != 0) {
+      guard_pop(&guard);
+      errno = EIO;
+      goto Lfree;
+    }
+    load_window(segments, kind, first, window, re, n);
+    guard_pop(&guard);
+    memset(im, 0, n * sizeof(*im));
+    fft_forward(&fft, re, im);
+    for (i = 0; i < bins; ++i) {
+      power[i] +=
+          (double)re[i] * (double)re[i] + (double)im[i] * (double)im[i];
+    }
+  }
+
+  /* averaged power in dB, digital silence floored at -300 dB */
+  for (i = 0; i < bins; ++i) {
+    power[i] = 10.0 * log10(power[i] / windows + 1e-30);
+  }
+  cliff = find_cliff(power, bins);
+
+  out->windows = windows;
+  out->cutoff = (double)cliff * wave->fmt.SampleRate / (double)n;
+  if (out->cutoff > nyquist) {
+    out->cutoff = nyquist;
+  }
+  out->original_rate = wave->fmt.SampleRate;
+  for (i = 0; i < sizeof(standard_rates) / sizeof(standard_rates[0]); ++i) {
+    if (standard_rates[i] >= wave->fmt.SampleRate) {
+      break;
+    }
+    if (standard_rates[i] / 2.0 >= out->cutoff) {
+      out->original_rate = standard_rates[i];
+      break;
+    }
+  }
+  res = EXIT_SUCCESS;
+
+Lfree:
+  free(power);
+  free(im);
+  free(re);
+  free(window);
+  fft_free(&fft);
+  return res;
+}
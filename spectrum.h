@@ -0,0 +1,32 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include "riff.h"
+
+/* Estimates the bandwidth of the content from the power spectrum averaged
+ * over a number of windows spread evenly over the payload. Only the pages
+ * under the windows are read, so fewer windows trade accuracy for I/O.
+ * Upsampled content shows a steep cliff well below the Nyquist frequency. */
+
+#define SPECTRUM_FFT 4096
+#define SPECTRUM_WINDOWS 32
+
+struct spectrum_cutoff {
+  unsigned windows;
+  /* highest frequency with content, the Nyquist frequency if full band */
+  double cutoff;
+  /* the lowest standard rate carrying the content, SampleRate if native */
+  uint32_t original_rate;
+};
+
+int
+spectrum_cutoff(const struct riff_wave *wave, unsigned windows,
+                struct spectrum_cutoff *out);
+
+/* Over the stream of the segments in order, see concat.h. Fails with
+ * errno EIO when a mapping raises SIGBUS, see guard.h. */
+int
+spectrum_cutoff_segments(const struct riff_wave *segments, size_t count,
+                         unsigned windows, struct spectrum_cutoff *out);
+
+#endif
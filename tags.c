@@ -0,0 +1,278 @@
+#include "tags.h"
+#include "id3.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+struct tags_buf {
+  struct tags_buf *next;
+  u8 data[];
+};
+
+/* The INFO ids of each field, the first one is written
+ *
+ * Track Artist (IART)
+ * Album Artist (IAAR)
+ * Composer (ICOM/IMUS)
+ * Title (INAM)
+ * Product (IPRD) - "Album Title"
+ * Album Title (IALB)
+ * Track Number (ITRK/IPRT)
+ * Date Created (ICRD/IYER) - "year"
+ * Genre (IGNR/IGRE)
+ * Comments (ICMT)
+ * Copyright (ICOP)
+ * Software (ISFT)
+ */
+static const struct {
+  char id[4];
+  enum tag_field field;
+} INFO_fields[] = {
+    {{'I', 'A', 'R', 'T'}, TAG_ARTIST},
+    {{'I', 'A', 'A', 'R'}, TAG_ALBUM_ARTIST},
+    {{'I', 'C', 'O', 'M'}, TAG_COMPOSER},
+    {{'I', 'M', 'U', 'S'}, TAG_COMPOSER},
+    {{'I', 'N', 'A', 'M'}, TAG_TITLE},
+    {{'I', 'P', 'R', 'D'}, TAG_ALBUM},
+    {{'I', 'A', 'L', 'B'}, TAG_ALBUM},
+    {{'I', 'T', 'R', 'K'}, TAG_TRACK},
+    {{'I', 'P', 'R', 'T'}, TAG_TRACK},
+    {{'I', 'C', 'R', 'D'}, TAG_DATE},
+    {{'I', 'Y', 'E', 'R'}, TAG_DATE},
+    {{'I', 'G', 'N', 'R'}, TAG_GENRE},
+    {{'I', 'G', 'R', 'E'}, TAG_GENRE},
+    {{'I', 'C', 'M', 'T'}, TAG_COMMENT},
+    {{'I', 'C', 'O', 'P'}, TAG_COPYRIGHT},
+    {{'I', 'S', 'F', 'T'}, TAG_SOFTWARE},
+};
+
+const char *
+tag_field_str(enum tag_field field) {
+  switch (field) {
+  case TAG_TITLE:
+    return "Title";
+  case TAG_ARTIST:
+    return "Artist";
+  case TAG_ALBUM_ARTIST:
+    return "AlbumArtist";
+  case TAG_COMPOSER:
+    return "Composer";
+  case TAG_ALBUM:
+    return "Album";
+  case TAG_TRACK:
+    return "Track";
+  case TAG_DATE:
+    return "Date";
+  case TAG_GENRE:
+    return "Genre";
+  case TAG_COMMENT:
+    return "Comment";
+  case TAG_COPYRIGHT:
+    return "Copyright";
+  case TAG_SOFTWARE:
+    return "Software";
+  case TAG_FIELDS:
+    break;
+  }
+  return "";
+}
+
+int
+tag_field_parse(const char *name, enum tag_field *out) {
+  unsigned f;
+
+  for (f = 0; f < TAG_FIELDS; ++f) {
+    if (strcasecmp(name, tag_field_str((enum tag_field)f)) == 0) {
+      *out = (enum tag_field)f;
+      return EXIT_SUCCESS;
+    }
+  }
+  return EXIT_FAILURE;
+}
+
+const char *
+tag_field_INFO(enum tag_field field) {
+  size_t i;
+
+  for (i = 0; i < sizeof(INFO_fields) / sizeof(INFO_fields[0]); ++i) {
+    if (INFO_fields[i].field == field) {
+      return INFO_fields[i].id;
+    }
+  }
+  return NULL;
+}
+
+int
+tag_INFO_is(const u8 *id, enum tag_field field) {
+  size_t i;
+
+  for (i = 0; i < sizeof(INFO_fields) / sizeof(INFO_fields[0]); ++i) {
+    if (INFO_fields[i].field == field &&
+        memcmp(id, INFO_fields[i].id, 4) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void
+tags_init(struct tags *self) {
+  memset(self, 0, sizeof(*self));
+}
+
+void
+tags_free(struct tags *self) {
+  while (self->owned) {
+    struct tags_buf *next = self->owned->next;
+    free(self->owned);
+    self->owned = next;
+  }
+  memset(self->field, 0, sizeof(self->field));
+}
+
+u8 *
+tags_alloc(struct tags *self, size_t bytes) {
+  struct tags_buf *buf;
+
+  if (!(buf = malloc(sizeof(*buf) + bytes))) {
+    return NULL;
+  }
+  buf->next = self->owned;
+  self->owned = buf;
+
+  return buf->data;
+}
+
+void
+tags_set(struct tags *self, enum tag_field field,
+         const struct tag_value *value) {
+  if (self->field[field].len == 0 && value->len > 0) {
+    self->field[field] = *value;
+  }
+}
+
+int
+tags_parse_INFO(struct tags *self, const u8 *raw, size_t length) {
+  const u8 *it = raw;
+  const u8 *const end = raw + length;
+
+  if (length < 4 || memcmp(it, "INFO", 4) != 0) {
+    return EXIT_FAILURE;
+  }
+  it += 4;
+
+  while ((size_t)(end - it) >= 8) {
+    struct tag_value value;
+    uint32_t size = rd_le32(it + 4);
+    size_t i;
+
+    if ((size_t)size > (size_t)(end - it) - 8) {
+      return EXIT_FAILURE;
+    }
+    value.ptr = it + 8;
+    value.len = size;
+    value.encoding = TAG_LATIN1;
+    while (value.len > 0 && value.ptr[value.len - 1] == '\0') {
+      --value.len;
+    }
+
+    for (i = 0; i < sizeof(INFO_fields) / sizeof(INFO_fields[0]); ++i) {
+      if (memcmp(it, INFO_fields[i].id, 4) == 0) {
+        tags_set(self, INFO_fields[i].field, &value);
+        break;
+      }
+    }
+
+    it += 8 + size;
+    while (it < end && *it == '\0') {
+      ++it;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int
+tags_parse_wave(struct tags *self, const u8 *raw, size_t length) {
+  struct riff_iter iter;
+  struct riff_chunk chunk;
+  char form[4];
+  int res;
+
+  if (riff_iter_init(&iter, raw, length, form) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  /* only the first LIST/INFO, a later one is a tag edit in progress, see
+   * edit.h */
+  while ((res = riff_iter_next(&iter, &chunk)) > 0) {
+    if (memcmp(chunk.id, "LIST", 4) == 0 && chunk.size >= 4 &&
+        memcmp(chunk.data, "INFO", 4) == 0) {
+      tags_parse_INFO(self, chunk.data, chunk.size);
+      break;
+    }
+  }
+
+  /* a second pass so LIST/INFO takes precedence regardless of order */
+  riff_iter_init(&iter, raw, length, form);
+  while ((res = riff_iter_next(&iter, &chunk)) > 0) {
+    if (memcmp(chunk.id, "id3 ", 4) == 0 || memcmp(chunk.id, "ID3 ", 4) == 0) {
+      id3_parse_tags(chunk.data, chunk.size, self);
+    }
+  }
+
+  return res < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void
+fput_utf8(uint32_t cp, FILE *out) {
+  if (cp < 0x80) {
+    fputc((int)cp, out);
+  } else if (cp < 0x800) {
+    fputc((int)(0xC0 | (cp >> 6)), out);
+    fputc((int)(0x80 | (cp & 0x3F)), out);
+  } else if (cp < 0x10000) {
+    fputc((int)(0xE0 | (cp >> 12)), out);
+    fputc((int)(0x80 | ((cp >> 6) & 0x3F)), out);
+    fputc((int)(0x80 | (cp & 0x3F)), out);
+  } else {
+    fputc((int)(0xF0 | (cp >> 18)), out);
+    fputc((int)(0x80 | ((cp >> 12) & 0x3F)), out);
+    fputc((int)(0x80 | ((cp >> 6) & 0x3F)), out);
+    fputc((int)(0x80 | (cp & 0x3F)), out);
+  }
+}
+
+void
+tag_value_fput(const struct tag_value *value, FILE *out) {
+  const u8 *it = value->ptr;
+  const u8 *const end = value->ptr + value->len;
+
+  switch (value->encoding) {
+  case TAG_UTF8:
+    fwrite(it, 1, value->len, out);
+    break;
+  case TAG_LATIN1:
+    for (; it < end; ++it) {
+      fput_utf8(*it, out);
+    }
+    break;
+  case TAG_UTF16LE:
+  case TAG_UTF16BE: {
+    const int be = value->encoding == TAG_UTF16BE;
+    for (; end - it >= 2; it += 2) {
+      uint32_t cp = be ? (uint32_t)((it[0] << 8) | it[1])
+                       : (uint32_t)((it[1] << 8) | it[0]);
+      if (cp >= 0xD800 && cp < 0xDC00 && end - it >= 4) {
+        uint32_t lo = be ? (uint32_t)((it[2] << 8) | it[3])
+                         : (uint32_t)((it[3] << 8) | it[2]);
+        if (lo >= 0xDC00 && lo < 0xE000) {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+          it += 2;
+        }
+      }
+      fput_utf8(cp, out);
+    }
+  } break;
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef TAGS_H
+#define TAGS_H
+
+#include "riff.h"
+
+#include <stdio.h>
+
+/* Common metadata merged from LIST/INFO and ID3v2 chunks.
+ *
+ * Values point into the mapping whenever the source allows it; only
+ * unsynchronised ID3 data is decoded into buffers owned by the tags.
+ */
+
+enum tag_field {
+  TAG_TITLE,
+  TAG_ARTIST,
+  TAG_ALBUM_ARTIST,
+  TAG_COMPOSER,
+  TAG_ALBUM,
+  TAG_TRACK,
+  TAG_DATE,
+  TAG_GENRE,
+  TAG_COMMENT,
+  TAG_COPYRIGHT,
+  TAG_SOFTWARE,
+  TAG_FIELDS,
+};
+
+enum tag_encoding {
+  TAG_LATIN1,
+  TAG_UTF16LE,
+  TAG_UTF16BE,
+  TAG_UTF8,
+};
+
+struct tag_value {
+  const u8 *ptr;
+  size_t len;
+  enum tag_encoding encoding;
+};
+
+struct tags_buf;
+
+struct tags {
+  struct tag_value field[TAG_FIELDS];
+  struct tags_buf *owned;
+};
+
+const char *
+tag_field_str(enum tag_field field);
+
+/* Inverse of tag_field_str(), case insensitive */
+int
+tag_field_parse(const char *name, enum tag_field *out);
+
+/* The 4 character LIST/INFO id written for field */
+const char *
+tag_field_INFO(enum tag_field field);
+
+/* Whether the INFO id is read into field, e.g. 'IPRD' and 'IALB' */
+int
+tag_INFO_is(const u8 *id, enum tag_field field);
+
+void
+tags_init(struct tags *self);
+
+void
+tags_free(struct tags *self);
+
+/* Scratch memory released by tags_free() */
+u8 *
+tags_alloc(struct tags *self, size_t bytes);
+
+/* Only sets the field if no earlier source provided it */
+void
+tags_set(struct tags *self, enum tag_field field,
+         const struct tag_value *value);
+
+/* LIST chunk payload starting with "INFO" */
+int
+tags_parse_INFO(struct tags *self, const u8 *raw, size_t length);
+
+/* LIST/INFO first, then any 'id3 '/'ID3 ' chunk fills remaining fields */
+int
+tags_parse_wave(struct tags *self, const u8 *raw, size_t length);
+
+/* Writes the value as UTF-8 */
+void
+tag_value_fput(const struct tag_value *value, FILE *out);
+
+#endif
@@ -0,0 +1,158 @@
+#include "timeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NS 1000000000ULL
+
+static int
+interval_cmp(const void *a, const void *b) {
+  const struct timeline_interval *f = a;
+  const struct timeline_interval *s = b;
+  if (f->start != s->start) {
+    return f->start < s->start ? -1 : 1;
+  }
+  if (f->end != s->end) {
+    return f->end < s->end ? -1 : 1;
+  }
+  return f->entry < s->entry ? -1 : f->entry > s->entry;
+}
+
+static uint64_t
+augment(struct timeline_interval *intervals, size_t lo, size_t hi) {
+  size_t mid;
+  uint64_t max, sub;
+
+  if (lo >= hi) {
+    return 0;
+  }
+  mid = lo + (hi - lo) / 2;
+  max = intervals[mid].end;
+  if ((sub = augment(intervals, lo, mid)) > max) {
+    max = sub;
+  }
+  if ((sub = augment(intervals, mid + 1, hi)) > max) {
+    max = sub;
+  }
+  intervals[mid].max_end = max;
+  return max;
+}
+
+void
+timeline_build(struct timeline_interval *intervals, size_t length) {
+  qsort(intervals, length, sizeof(*intervals), interval_cmp);
+  augment(intervals, 0, length);
+}
+
+struct query {
+  const struct timeline_interval *intervals;
+  uint64_t from;
+  uint64_t to;
+  /* the first pass of a query wrapping over midnight, already reported */
+  uint64_t skip_from;
+  uint64_t skip_to;
+  timeline_fn fn;
+  void *closure;
+  size_t matches;
+};
+
+static void
+query(struct query *self, size_t lo, size_t hi) {
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    const struct timeline_interval *node = &self->intervals[mid];
+
+    if (node->max_end <= self->from) {
+      return;
+    }
+    query(self, lo, mid);
+    if (node->start >= self->to) {
+      return;
+    }
+    if (node->end > self->from &&
+        !(node->start < self->skip_to && node->end > self->skip_from)) {
+      self->fn(self->closure, node);
+      ++self->matches;
+    }
+    lo = mid + 1;
+  }
+}
+
+size_t
+timeline_overlap(const struct timeline_interval *intervals, size_t length,
+                 uint64_t from, uint64_t to, timeline_fn fn, void *closure) {
+  struct query self;
+
+  self.intervals = intervals;
+  self.from = from;
+  self.to = to > from ? to : to + TIMELINE_DAY;
+  self.skip_from = 0;
+  self.skip_to = 0;
+  self.fn = fn;
+  self.closure = closure;
+  self.matches = 0;
+  query(&self, 0, length);
+
+  if (to <= from) {
+    /* past midnight, recordings starting after it are found before the
+     * range; the first pass covered those starting the day before */
+    self.skip_from = self.from;
+    self.skip_to = self.to;
+    self.from = 0;
+    self.to = to;
+    query(&self, 0, length);
+    return self.matches;
+  }
+
+  /* recordings that started the day before show up with an end past
+   * midnight, the same time of day one day later */
+  self.skip_from = self.from;
+  self.skip_to = self.to;
+  self.from += TIMELINE_DAY;
+  self.to += TIMELINE_DAY;
+  query(&self, 0, length);
+
+  return self.matches;
+}
+
+uint64_t
+timeline_ns(uint64_t samples, uint32_t rate) {
+  return samples / rate * NS + samples % rate * NS / rate;
+}
+
+static const char *
+parse_field(const char *it, unsigned max, uint64_t *out) {
+  if (it[0] < '0' || it[0] > '9' || it[1] < '0' || it[1] > '9') {
+    return NULL;
+  }
+  *out = (uint64_t)(it[0] - '0') * 10 + (uint64_t)(it[1] - '0');
+  return *out <= max ? it + 2 : NULL;
+}
+
+const char *
+timeline_parse(const char *it, uint64_t *out) {
+  uint64_t h, m, s, scale = NS;
+
+  if (!(it = parse_field(it, 23, &h)) || *it++ != ':' ||
+      !(it = parse_field(it, 59, &m)) || *it++ != ':' ||
+      !(it = parse_field(it, 59, &s))) {
+    return NULL;
+  }
+  *out = ((h * 60 + m) * 60 + s) * NS;
+  if (*it == '.') {
+    for (++it; *it >= '0' && *it <= '9'; ++it) {
+      scale /= 10;
+      *out += (uint64_t)(*it - '0') * scale;
+    }
+  }
+  return it;
+}
+
+const char *
+timeline_str(uint64_t ns, char *buf) {
+  const uint64_t ms = ns / 1000000;
+  snprintf(buf, 16, "%02u:%02u:%02u.%03u", (unsigned)(ms / 3600000 % 100),
+           (unsigned)(ms / 60000 % 60), (unsigned)(ms / 1000 % 60),
+           (unsigned)(ms % 1000));
+  return buf;
+}
@@ -0,0 +1,53 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Interval index of recording times, in nanoseconds since midnight.
+ *
+ * The intervals are sorted by start and read as an implicit balanced
+ * tree: the node of the range [lo, hi) is its middle element and max_end
+ * is the greatest end within that range. An overlap query prunes every
+ * subtree ending before the query and every node starting after it, so it
+ * visits O(log n + k) nodes straight from the memory-mapped catalog.
+ */
+
+#define TIMELINE_DAY (86400ULL * 1000000000ULL)
+
+struct timeline_interval {
+  uint64_t start;
+  /* exclusive, past TIMELINE_DAY for recordings running over midnight */
+  uint64_t end;
+  uint64_t max_end;
+  uint64_t entry;
+};
+
+/* Sorts the intervals by start and fills in max_end */
+void
+timeline_build(struct timeline_interval *intervals, size_t length);
+
+typedef void (*timeline_fn)(void *closure,
+                            const struct timeline_interval *interval);
+
+/* Calls fn in start order for each interval overlapping [from, to). A
+ * range with to <= from wraps over midnight. Returns the number of
+ * matches. */
+size_t
+timeline_overlap(const struct timeline_interval *intervals, size_t length,
+                 uint64_t from, uint64_t to, timeline_fn fn, void *closure);
+
+/* Samples since midnight at rate to nanoseconds */
+uint64_t
+timeline_ns(uint64_t samples, uint32_t rate);
+
+/* Parses HH:MM:SS[.fraction], returns the first unparsed character or
+ * NULL on a malformed time */
+const char *
+timeline_parse(const char *it, uint64_t *out);
+
+/* Formats as HH:MM:SS.mmm, buf holds at least 16 bytes */
+const char *
+timeline_str(uint64_t ns, char *buf);
+
+#endif
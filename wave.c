@@ -0,0 +1,154 @@
+#include "riff.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+int
+riff_iter_init(struct riff_iter *self, const u8 *raw, size_t length,
+               char form[4]) {
+  uint32_t chunk_size;
+
+  if (length < 12) {
+    return EXIT_FAILURE;
+  }
+  /* RIFX, the big endian form, is not supported */
+  if (memcmp(raw, "RIFF", 4) != 0) {
+    return EXIT_FAILURE;
+  }
+  chunk_size = rd_le32(raw + 4);
+  if ((size_t)chunk_size > length - 8 || chunk_size < 4) {
+    return EXIT_FAILURE;
+  }
+  memcpy(form, raw + 8, 4);
+
+  self->it = raw + 12;
+  self->end = raw + 8 + chunk_size;
+  return EXIT_SUCCESS;
+}
+
+int
+riff_iter_next(struct riff_iter *self, struct riff_chunk *out) {
+  size_t remaining = (size_t)(self->end - self->it);
+
+  if (remaining == 0) {
+    return 0;
+  }
+  if (remaining < 8) {
+    return -1;
+  }
+  memcpy(out->id, self->it, sizeof(out->id));
+  out->size = rd_le32(self->it + 4);
+  if ((size_t)out->size > remaining - 8) {
+    return -1;
+  }
+  out->data = self->it + 8;
+
+  self->it = out->data + out->size;
+  if ((out->size & 1) && self->it != self->end) {
+    ++self->it;
+  }
+  return 1;
+}
+
+int
+riff_fmt_parse(const struct riff_chunk *chunk, struct riff_fmt *out) {
+  const u8 *it = chunk->data;
+
+  if (chunk->size < 16) {
+    return EXIT_FAILURE;
+  }
+  memset(out, 0, sizeof(*out));
+  out->AudioFormat = rd_le16(it);
+  out->NumChannels = rd_le16(it + 2);
+  out->SampleRate = rd_le32(it + 4);
+  out->ByteRate = rd_le32(it + 8);
+  out->BlockAlign = rd_le16(it + 12);
+  out->BitsPerSample = rd_le16(it + 14);
+
+  if (chunk->size >= 18) {
+    out->cbSize = rd_le16(it + 16);
+    if (out->cbSize > 0 && (uint32_t)out->cbSize + 18 <= chunk->size) {
+      out->extension = it + 18;
+    } else {
+      out->cbSize = 0;
+    }
+  }
+
+  /* cbSize, wValidBitsPerSample, dwChannelMask, SubFormat */
+  if (out->AudioFormat == WAVE_FORMAT_EXTENSIBLE && chunk->size >= 40) {
+    out->SubFormat = rd_le16(it + 24);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+uint16_t
+riff_fmt_code(const struct riff_fmt *fmt) {
+  if (fmt->AudioFormat == WAVE_FORMAT_EXTENSIBLE) {
+    return fmt->SubFormat;
+  }
+  return fmt->AudioFormat;
+}
+
+int
+riff_wave_parse(const u8 *raw, size_t length, struct riff_wave *out) {
+  struct riff_iter iter;
+  struct riff_chunk chunk;
+  int have_fmt = 0;
+  int res;
+
+  memset(out, 0, sizeof(*out));
+  if (riff_iter_init(&iter, raw, length, out->form) != EXIT_SUCCESS) {
+    return EXIT_FAILURE;
+  }
+  if (memcmp(out->form, "WAVE", 4) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  while ((res = riff_iter_next(&iter, &chunk)) > 0) {
+    if (memcmp(chunk.id, "fmt ", 4) == 0) {
+      if (riff_fmt_parse(&chunk, &out->fmt) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+      }
+      have_fmt = 1;
+    } else if (memcmp(chunk.id, "data", 4) == 0) {
+      out->data = chunk;
+    } else if (memcmp(chunk.id, "levl", 4) == 0) {
+      out->levl = chunk;
+    } else if (memcmp(chunk.id, "PEAK", 4) == 0) {
+      out->peak = chunk;
+    } else if (memcmp(chunk.id, "bext", 4) == 0) {
+      out->bext = chunk;
+    }
+  }
+  if (res < 0 || !have_fmt || !out->data.data) {
+    return EXIT_FAILURE;
+  }
+  if (out->fmt.NumChannels == 0 || out->fmt.BlockAlign == 0) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+uint64_t
+riff_wave_frames(const struct riff_wave *wave) {
+  return wave->data.size / wave->fmt.BlockAlign;
+}
+
+int
+riff_wave_time_reference(const struct riff_wave *wave, uint64_t *out) {
+  /* Description[256] Originator[32] OriginatorReference[32]
+   * OriginationDate[10] OriginationTime[8] TimeReferenceLow
+   * TimeReferenceHigh */
+  const size_t offset = 256 + 32 + 32 + 10 + 8;
+  const u8 *it = wave->bext.data;
+
+  if (!it || wave->bext.size < offset + 8) {
+    return EXIT_FAILURE;
+  }
+  *out = (uint64_t)rd_le32(it + offset + 4) << 32 | rd_le32(it + offset);
+  return EXIT_SUCCESS;
+}